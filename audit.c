@@ -0,0 +1,476 @@
+/**
+ * This C file contains the audit log. Commands never
+ * touch the file themselves: a record is pushed onto
+ * a lock-free stack with one compare-and-swap, and the
+ * push that finds the stack empty wakes the writer
+ * thread through an eventfd. The writer takes the
+ * whole stack at once, puts it back in order, and
+ * appends it with writev, so records that pile up
+ * while it writes or syncs go out together in the
+ * next batch.
+ *
+ * A forked child has no writer thread, so records of
+ * commands run inside one (a function in a pipeline,
+ * say) are written right away instead.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+#include "audit.h"
+#include "options.h"
+#include "stats.h"
+
+// permissions of a new audit log, before the umask
+#define AUDIT_MODE 0600
+// most iovecs handed to one writev
+#define AUDIT_IOVECS (IOV_MAX < 256 ? IOV_MAX : 256)
+
+struct audit_record {
+  struct audit_record* next;
+  long id;
+  pid_t logger;
+  pid_t pid;
+  int ended;
+  int status;
+  struct timespec wall;
+  long long mono_ns;
+  // of a start: working directory and arguments, escaped
+  char* text;
+  // time, kind and numbers, formatted by the writer; left
+  // empty for a record that is not to be written
+  char head[128];
+};
+
+/**
+ * A command whose start was written and whose end
+ * was not yet.
+ */
+struct pending {
+  long id;
+  pid_t logger;
+  pid_t pid;
+  long long start_ns;
+  struct pending* next;
+};
+
+static int enabled = 0;
+static int in_child = 0;
+static int log_fd = -1;
+// process whose records these are; ids count per process
+static pid_t logger;
+static int wake_fd = -1;
+static pthread_t writer;
+static atomic_int stopping = 0;
+static atomic_long next_id = 0;
+static _Atomic(struct audit_record*) queue = NULL;
+
+// guards pending and the formatting of records, so a
+// fork never copies them half changed
+static pthread_mutex_t format_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pending* pending = NULL;
+
+/**
+ * Appends text to out with tabs, new lines and
+ * backslashes escaped, so every record stays one
+ * line of tab separated fields.
+ *
+ * Return value: void
+ */
+static void put_escaped(FILE* out, const char* text)
+{
+  for(; *text; text++) {
+    if(*text == '\t') fputs("\\t", out);
+    else if(*text == '\n') fputs("\\n", out);
+    else if(*text == '\\') fputs("\\\\", out);
+    else putc(*text, out);
+  }
+}
+
+/**
+ * Finds and removes the pending command a record of
+ * an end belongs to.
+ *
+ * Return value: the command, which the caller frees, NULL if unknown
+ */
+static struct pending* take_pending(struct audit_record* r)
+{
+  struct pending** link;
+  struct pending* p;
+
+  for(link = &pending; (p = *link); link = &p->next) {
+    if(r->id ? p->id == r->id && p->logger == r->logger
+	     : p->pid == r->pid) {
+      *link = p->next;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Fills in the head of a record and keeps track of
+ * the commands still running.
+ *
+ * Return value: void
+ */
+static void format_record(struct audit_record* r)
+{
+  struct pending* p;
+  struct tm tm;
+  int len;
+
+  gmtime_r(&r->wall.tv_sec, &tm);
+  len = strftime(r->head, sizeof(r->head), "%Y-%m-%dT%H:%M:%S", &tm);
+  len += snprintf(r->head + len, sizeof(r->head) - len, ".%03ldZ",
+		  r->wall.tv_nsec / 1000000);
+
+  if(!r->ended) {
+    if((p = malloc(sizeof(struct pending)))) {
+      p->id = r->id;
+      p->logger = r->logger;
+      p->pid = r->pid;
+      p->start_ns = r->mono_ns;
+      p->next = pending;
+      pending = p;
+    }
+    snprintf(r->head + len, sizeof(r->head) - len, "\tstart\t%d.%ld\t%d\t",
+	     r->logger, r->id, r->pid);
+    return;
+  }
+
+  // processes the shell only waits for, like the ends of
+  // a process substitution, were never started here
+  if(!(p = take_pending(r))) {
+    r->head[0] = 0;
+    return;
+  }
+  snprintf(r->head + len, sizeof(r->head) - len,
+	   "\texit\t%d.%ld\t%d\t%d\t%lld\n", p->logger, p->id, p->pid,
+	   r->status, (r->mono_ns - p->start_ns) / 1000000);
+  free(p);
+}
+
+/**
+ * Writes every iovec, picking up after partial writes.
+ *
+ * Return value: void
+ */
+static void write_all(struct iovec* iov, int n)
+{
+  static int reported = 0;
+  ssize_t done;
+
+  while(n > 0) {
+    if((done = writev(log_fd, iov, n)) == -1) {
+      if(errno == EINTR) continue;
+      // a full disk must not stop the shell, but should be seen
+      if(!reported++) {
+	fprintf(stderr, "Error: audit log: %s\n", strerror(errno));
+      }
+      return;
+    }
+    while(n > 0 && (size_t) done >= iov->iov_len) {
+      done -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if(n > 0) {
+      iov->iov_base = (char*) iov->iov_base + done;
+      iov->iov_len -= done;
+    }
+  }
+}
+
+/**
+ * Formats, writes and frees a list of records, oldest
+ * first.
+ *
+ * Return value: void
+ */
+static void write_records(struct audit_record* list)
+{
+  struct iovec iov[AUDIT_IOVECS];
+  struct audit_record* r;
+  int n = 0;
+
+  pthread_mutex_lock(&format_lock);
+  for(r = list; r; r = r->next) {
+    format_record(r);
+  }
+  pthread_mutex_unlock(&format_lock);
+
+  for(r = list; r; r = r->next) {
+    if(!r->head[0]) continue;
+    if(n > AUDIT_IOVECS - 2) {
+      write_all(iov, n);
+      n = 0;
+    }
+    iov[n].iov_base = r->head;
+    iov[n++].iov_len = strlen(r->head);
+    if(r->text) {
+      iov[n].iov_base = r->text;
+      iov[n++].iov_len = strlen(r->text);
+    }
+  }
+  write_all(iov, n);
+
+  while(list) {
+    r = list->next;
+    free(list->text);
+    free(list);
+    list = r;
+  }
+}
+
+/**
+ * Takes every queued record off the stack.
+ *
+ * Return value: the records oldest first, NULL if there are none
+ */
+static struct audit_record* take_queue()
+{
+  struct audit_record* r = atomic_exchange_explicit(&queue, NULL,
+						    memory_order_acquire);
+  struct audit_record* ordered = NULL;
+
+  // the stack holds the newest record first
+  while(r) {
+    struct audit_record* next = r->next;
+    r->next = ordered;
+    ordered = r;
+    r = next;
+  }
+  return ordered;
+}
+
+/**
+ * Thread body of the writer. Between batches it sleeps
+ * on the eventfd, or until a sync held back by
+ * "set auditsync" is due.
+ *
+ * Return value: NULL
+ */
+static void* writer_thread(void* arg)
+{
+  struct pollfd pfd = { wake_fd, POLLIN, 0 };
+  struct audit_record* batch;
+  long long last_sync = 0, since;
+  unsigned long long wakes;
+  int unsynced = 0, wait_ms;
+
+  while(1) {
+    wait_ms = -1;
+    if(unsynced && options.auditsync) {
+      since = (now_ns() - last_sync) / 1000000;
+      wait_ms = since >= options.auditsync ? 0 : options.auditsync - since;
+    }
+    if(wait_ms != 0 && poll(&pfd, 1, wait_ms) == 1 &&
+       read(wake_fd, &wakes, sizeof(wakes)) == -1) {
+      // only resetting the count matters, and a wake may be stale
+    }
+
+    if((batch = take_queue())) {
+      write_records(batch);
+      unsynced = 1;
+    }
+    if(unsynced && options.auditsync &&
+       (now_ns() - last_sync) / 1000000 >= options.auditsync) {
+      fdatasync(log_fd);
+      last_sync = now_ns();
+      unsynced = 0;
+    }
+    if(atomic_load(&stopping) && !atomic_load(&queue)) break;
+  }
+  return NULL;
+}
+
+/**
+ * Queues a record for the writer, or in a forked
+ * child writes it right away.
+ *
+ * Return value: void
+ */
+static void push_record(struct audit_record* r)
+{
+  struct audit_record* head;
+  unsigned long long one = 1;
+
+  if(in_child) {
+    r->next = NULL;
+    write_records(r);
+    return;
+  }
+
+  head = atomic_load_explicit(&queue, memory_order_relaxed);
+  do {
+    r->next = head;
+  } while(!atomic_compare_exchange_weak_explicit(&queue, &head, r,
+						 memory_order_release,
+						 memory_order_relaxed));
+  // only the first record of a batch has to wake the writer
+  if(!head && write(wake_fd, &one, sizeof(one)) == -1) {
+    // the counter is full, so the writer is awake anyway
+  }
+}
+
+/**
+ * Makes a new record with both clocks read.
+ *
+ * Return value: the record, NULL if out of memory
+ */
+static struct audit_record* new_record(int ended, pid_t pid)
+{
+  struct audit_record* r = calloc(1, sizeof(struct audit_record));
+
+  if(!r) return NULL;
+  r->ended = ended;
+  r->logger = logger;
+  r->pid = pid;
+  clock_gettime(CLOCK_REALTIME, &r->wall);
+  r->mono_ns = now_ns();
+  return r;
+}
+
+/**
+ * Fork handlers: the child gets the pending commands
+ * whole, and from then on writes its own records.
+ *
+ * Return value: void
+ */
+static void lock_format()
+{
+  pthread_mutex_lock(&format_lock);
+}
+
+static void unlock_format()
+{
+  pthread_mutex_unlock(&format_lock);
+}
+
+static void child_after_fork()
+{
+  in_child = 1;
+  logger = getpid();
+  pthread_mutex_unlock(&format_lock);
+}
+
+/**
+ * Opens the audit log if MYSHELL_AUDIT_LOG names one
+ * and starts the writer thread.
+ *
+ * Return value: 0 if the log is open or not wanted, -1 on error
+ */
+int audit_open()
+{
+  const char* path = getenv("MYSHELL_AUDIT_LOG");
+
+  if(!path || !*path) return 0;
+
+  if((log_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+		    AUDIT_MODE)) == -1) {
+    fprintf(stderr, "Error: Could not open audit log %s: %s\n", path,
+	    strerror(errno));
+    return -1;
+  }
+  if((wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1 ||
+     pthread_create(&writer, NULL, writer_thread, NULL) != 0) {
+    fprintf(stderr, "Error: Could not start the audit log writer\n");
+    if(wake_fd != -1) close(wake_fd);
+    close(log_fd);
+    return -1;
+  }
+
+  logger = getpid();
+  pthread_atfork(lock_format, unlock_format, child_after_fork);
+  atexit(audit_close);
+  enabled = 1;
+  return 0;
+}
+
+/**
+ * Queues the record of a command that is starting.
+ *
+ * Return value: id to pass to audit_exit, 0 if the log is off
+ */
+long audit_start(pid_t pid, char** argv)
+{
+  struct audit_record* r;
+  char* cwd;
+  size_t len;
+  FILE* out;
+  long id;
+  int i;
+
+  if(!enabled || !(r = new_record(0, pid ? pid : getpid()))) return 0;
+  // the writer may free r as soon as it is queued
+  r->id = id = atomic_fetch_add(&next_id, 1) + 1;
+
+  if(!(out = open_memstream(&r->text, &len))) {
+    free(r);
+    return 0;
+  }
+  if((cwd = getcwd(NULL, 0))) {
+    put_escaped(out, cwd);
+    free(cwd);
+  }
+  putc('\t', out);
+  for(i = 0; argv[i]; i++) {
+    if(i) putc(' ', out);
+    put_escaped(out, argv[i]);
+  }
+  putc('\n', out);
+  fclose(out);
+
+  push_record(r);
+  return id;
+}
+
+/**
+ * Queues the record of a command that ended.
+ *
+ * Return value: void
+ */
+void audit_exit(long id, pid_t pid, int status)
+{
+  struct audit_record* r;
+
+  if(!enabled || !(r = new_record(1, pid))) return;
+  r->id = id;
+  r->status = status;
+  push_record(r);
+}
+
+/**
+ * Writes out everything queued, syncs the log and
+ * stops the writer thread.
+ *
+ * Return value: void
+ */
+void audit_close()
+{
+  unsigned long long one = 1;
+
+  if(!enabled || in_child) return;
+  enabled = 0;
+
+  atomic_store(&stopping, 1);
+  if(write(wake_fd, &one, sizeof(one)) == -1) {
+    // the counter is full, so the writer is awake anyway
+  }
+  pthread_join(writer, NULL);
+  if(options.auditsync) fdatasync(log_fd);
+}
@@ -0,0 +1,63 @@
+/**
+ * This is the header class for audit.c
+ *
+ * These methods keep the audit log named by
+ * MYSHELL_AUDIT_LOG: one line when a command starts,
+ * with the time, working directory and arguments, and
+ * one when it ends, with its exit status and how long
+ * it ran. Commands only queue their records; a writer
+ * thread appends them to the file in batches.
+ */
+
+#ifndef AUDIT_H
+# define AUDIT_H
+
+#include <sys/types.h>
+
+/**
+ * Opens the audit log if MYSHELL_AUDIT_LOG names one
+ * and starts the writer thread. Records queued until
+ * the shell exits are written before it does.
+ *
+ * Return value: 0 if the log is open or not wanted, -1 on error
+ */
+int audit_open();
+
+/**
+ * Queues the record of a command that is starting.
+ *
+ * pid:
+ *    process id running the command, 0 for a built-in
+ *    running inside the shell
+ * argv:
+ *     the command and its arguments
+ *
+ * Return value: id to pass to audit_exit, 0 if the log is off
+ */
+long audit_start(pid_t pid, char** argv);
+
+/**
+ * Queues the record of a command that ended. A
+ * process the log saw no start for is ignored.
+ *
+ * id:
+ *   the id from audit_start, or 0 to find the command by pid
+ * pid:
+ *    process id of the command when id is 0
+ * status:
+ *       exit status of the command, see shell_status
+ *
+ * Return value: void
+ */
+void audit_exit(long id, pid_t pid, int status);
+
+/**
+ * Writes out everything queued, syncs the log and
+ * stops the writer thread. Used before the shell
+ * replaces itself with a command, and at exit.
+ *
+ * Return value: void
+ */
+void audit_close();
+
+#endif
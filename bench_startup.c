@@ -0,0 +1,159 @@
+/**
+ * Startup benchmark for the shell's non-interactive
+ * mode. It measures time-to-first-exec: the time from
+ * spawning "shell_main -c cmd" until cmd starts running.
+ *
+ * cmd is this same program run with --stamp, which
+ * writes the CLOCK_MONOTONIC time it started at into a
+ * pipe. Spawning the stamp program directly gives the
+ * baseline, so the difference is the shell's own cost.
+ *
+ * usage: bench_startup <shell> [iterations]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define DEFAULT_ITERATIONS 1000
+#define STAMP_FD 3
+
+extern char** environ;
+
+/**
+ * Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+static long long now_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Compares two sample values for qsort.
+ */
+static int compare_samples(const void* a, const void* b)
+{
+  long long x = *(const long long*) a;
+  long long y = *(const long long*) b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Spawns argv with the write end of a pipe on STAMP_FD
+ * and returns the nanoseconds until the stamp program
+ * reported that it was running, or -1 on failure.
+ */
+static long long time_to_exec(char** argv)
+{
+  posix_spawn_file_actions_t actions;
+  long long start, stamp = -1;
+  int fds[2], status;
+  pid_t pid;
+
+  if(pipe(fds) == -1) return -1;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addclose(&actions, fds[0]);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STAMP_FD);
+
+  start = now_ns();
+  if(posix_spawn(&pid, argv[0], &actions, NULL, argv, environ) != 0) {
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+
+  if(read(fds[0], &stamp, sizeof(stamp)) != sizeof(stamp)) stamp = -1;
+  close(fds[0]);
+  waitpid(pid, &status, 0);
+
+  return stamp == -1 ? -1 : stamp - start;
+}
+
+/**
+ * Runs one series of measurements and prints its summary.
+ *
+ * Return value: median in nanoseconds, -1 on failure
+ */
+static long long run_series(const char* label, char** argv, int iterations)
+{
+  long long* samples = malloc(sizeof(long long) * iterations);
+  long long total = 0, median;
+  int i;
+
+  for(i = 0; i < iterations; i++) {
+    if((samples[i] = time_to_exec(argv)) < 0) {
+      fprintf(stderr, "bench_startup: %s failed to report a stamp\n", label);
+      free(samples);
+      return -1;
+    }
+    total += samples[i];
+  }
+
+  qsort(samples, iterations, sizeof(long long), compare_samples);
+  median = samples[iterations / 2];
+  printf("%-8s min %8.1f us  median %8.1f us  p99 %8.1f us  mean %8.1f us\n",
+	 label, samples[0] / 1e3, median / 1e3,
+	 samples[iterations * 99 / 100] / 1e3, total / 1e3 / iterations);
+
+  free(samples);
+  return median;
+}
+
+int main(int argc, char* argv[])
+{
+  char self[4096];
+  char command[4096 + 16];
+  char* direct[3];
+  char* shell[4];
+  long long base, via_shell;
+  int iterations = DEFAULT_ITERATIONS;
+  ssize_t n;
+
+  // stamp mode: report when exec reached us
+  if(argc > 1 && strcmp(argv[1], "--stamp") == 0) {
+    long long t = now_ns();
+    return write(STAMP_FD, &t, sizeof(t)) == sizeof(t) ? 0 : 1;
+  }
+
+  if(argc < 2) {
+    fprintf(stderr, "usage: %s <shell> [iterations]\n", argv[0]);
+    return 2;
+  }
+  if(argc > 2 && atoi(argv[2]) > 0) iterations = atoi(argv[2]);
+
+  if((n = readlink("/proc/self/exe", self, sizeof(self) - 1)) == -1) {
+    perror("readlink");
+    return 1;
+  }
+  self[n] = '\0';
+  snprintf(command, sizeof(command), "%s --stamp", self);
+
+  direct[0] = self;
+  direct[1] = "--stamp";
+  direct[2] = NULL;
+
+  shell[0] = argv[1];
+  shell[1] = "-c";
+  shell[2] = command;
+  shell[3] = NULL;
+
+  printf("time-to-first-exec over %d runs\n", iterations);
+  if((base = run_series("direct", direct, iterations)) < 0) return 1;
+  if((via_shell = run_series("shell", shell, iterations)) < 0) return 1;
+  printf("shell overhead (median): %.1f us\n", (via_shell - base) / 1e3);
+  return 0;
+}
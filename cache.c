@@ -0,0 +1,656 @@
+/**
+ * This C file contains the content-addressed
+ * output cache behind the cache built-in. Every
+ * entry is a directory named after the 128-bit
+ * key holding the stdout, stderr and exit status
+ * of one run; hits are streamed out with sendfile.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+#include "cache.h"
+#include "jobs.h"
+#include "redirect.h"
+
+#define CACHE_DEFAULT_SIZE (256LL * 1024 * 1024)
+#define CACHE_READ_SIZE 65536
+// file in the store holding the running total of its size
+#define CACHE_TOTAL_FILE ".total"
+// room for the path of the store, an entry in it, and a file in that
+#define CACHE_DIR_SIZE 4096
+#define CACHE_ENTRY_SIZE (CACHE_DIR_SIZE + 40)
+#define CACHE_FILE_SIZE (CACHE_ENTRY_SIZE + 16)
+
+// 128-bit FNV-1a parameters
+#define FNV128_PRIME (((unsigned __int128) 1 << 88) + 0x13b)
+#define FNV128_OFFSET_HI 0x6c62272e07bb0142ULL
+#define FNV128_OFFSET_LO 0x62b821756295c58dULL
+
+typedef unsigned __int128 cache_key;
+
+/**
+ * One entry of the store, used when deciding
+ * which entries to evict.
+ */
+struct cache_entry {
+  char name[40];
+  long long size;
+  time_t used;
+};
+
+/**
+ * Feeds len bytes of data into the running hash.
+ *
+ * Return value: void
+ */
+static void hash_bytes(cache_key* h, const void* data, size_t len)
+{
+  const unsigned char* p = data;
+  cache_key v = *h;
+  size_t i;
+
+  for(i = 0; i < len; i++) {
+    v ^= p[i];
+    v *= FNV128_PRIME;
+  }
+  *h = v;
+}
+
+/**
+ * Feeds a string and its terminating null byte into the
+ * hash, so that ("ab", "c") and ("a", "bc") differ.
+ *
+ * Return value: void
+ */
+static void hash_string(cache_key* h, const char* s)
+{
+  hash_bytes(h, s, strlen(s) + 1);
+}
+
+/**
+ * Feeds the contents of a file into the hash.
+ *
+ * Return value: 0 on success, -1 if the file could not be read
+ */
+static int hash_file_contents(cache_key* h, const char* path)
+{
+  char buf[CACHE_READ_SIZE];
+  ssize_t n;
+  int fd;
+
+  if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) return -1;
+
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  while((n = read(fd, buf, sizeof(buf))) > 0) {
+    hash_bytes(h, buf, n);
+  }
+  close(fd);
+  return n < 0 ? -1 : 0;
+}
+
+/**
+ * Feeds the identity and modification time of a
+ * file into the hash without reading its contents.
+ *
+ * Return value: 0 on success, -1 if the file could not be stat'ed
+ */
+static int hash_file_mtime(cache_key* h, const char* path)
+{
+  struct stat st;
+
+  if(stat(path, &st) == -1) return -1;
+
+  hash_bytes(h, &st.st_dev, sizeof(st.st_dev));
+  hash_bytes(h, &st.st_ino, sizeof(st.st_ino));
+  hash_bytes(h, &st.st_size, sizeof(st.st_size));
+  hash_bytes(h, &st.st_mtim, sizeof(st.st_mtim));
+  return 0;
+}
+
+/**
+ * Feeds the command's standard input into the hash.
+ * A closed stdin, a terminal and /dev/null are keyed
+ * by kind alone. Pipes and files are read to the end
+ * into a memfd, which the command then reads instead.
+ * Anything else, and the shell's own stdin, which may
+ * be the script being run, cannot be keyed.
+ *
+ * io:
+ *   where the built-in reads
+ * in_fd:
+ *      set to the descriptor the command should read
+ *
+ * Return value: 1 if keyed, 0 if the command must run uncached,
+ *               -1 if the input could not be copied
+ */
+static int hash_input(cache_key* h, const struct builtin_io* io, int* in_fd)
+{
+  char buf[CACHE_READ_SIZE];
+  struct stat st, null_st;
+  ssize_t n;
+  int fd;
+
+  *in_fd = io->in_fd;
+  if(io->in_fd == -1) {
+    hash_string(h, "<&-");
+    return 1;
+  }
+  if(fstat(io->in_fd, &st) == -1) return 0;
+  if(isatty(io->in_fd)) {
+    hash_string(h, "tty");
+    return 1;
+  }
+  if(S_ISCHR(st.st_mode)) {
+    if(stat("/dev/null", &null_st) == -1 || st.st_rdev != null_st.st_rdev) {
+      return 0;
+    }
+    hash_string(h, "null");
+    return 1;
+  }
+  if(io->in_fd == STDIN_FILENO) return 0;
+
+  if((fd = memfd_create("cache-stdin", MFD_CLOEXEC)) == -1) return -1;
+  hash_string(h, "<");
+  while((n = read(io->in_fd, buf, sizeof(buf))) != 0) {
+    if(n < 0) {
+      if(errno == EINTR) continue;
+      close(fd);
+      return -1;
+    }
+    hash_bytes(h, buf, n);
+    if(write(fd, buf, n) != n) {
+      close(fd);
+      return -1;
+    }
+  }
+  lseek(fd, 0, SEEK_SET);
+  *in_fd = fd;
+  return 1;
+}
+
+/**
+ * Builds the directory used for the store and
+ * creates it, along with its parents, if missing.
+ *
+ * Return value: 0 on success, -1 on error
+ */
+static int cache_directory(char* dir, size_t size)
+{
+  char* env = getenv("MYSHELL_CACHE_DIR");
+  char* p;
+
+  if(env && *env) {
+    snprintf(dir, size, "%s", env);
+  }
+  else if(getenv("HOME")) {
+    snprintf(dir, size, "%s/.cache/myshell", getenv("HOME"));
+  }
+  else {
+    return -1;
+  }
+
+  for(p = dir + 1; *p; p++) {
+    if(*p == '/') {
+      *p = '\0';
+      mkdir(dir, 0700);
+      *p = '/';
+    }
+  }
+  if(mkdir(dir, 0700) == -1 && errno != EEXIST) return -1;
+  return 0;
+}
+
+/**
+ * Copies everything from in_fd to out_fd, using
+ * sendfile and falling back to read/write when the
+ * kernel refuses the pair of file descriptors.
+ *
+ * Return value: void
+ */
+static void replay_fd(int in_fd, int out_fd)
+{
+  char buf[CACHE_READ_SIZE];
+  ssize_t n;
+
+  while((n = sendfile(out_fd, in_fd, NULL, 1 << 30)) > 0);
+  if(n == 0) return;
+
+  while((n = read(in_fd, buf, sizeof(buf))) > 0) {
+    char* p = buf;
+    while(n > 0) {
+      ssize_t w = write(out_fd, p, n);
+      if(w <= 0) return;
+      p += w;
+      n -= w;
+    }
+  }
+}
+
+/**
+ * Streams the stdout and stderr files of an entry
+ * directory to the shell's stdout and stderr.
+ *
+ * entry:
+ *      path of the entry directory
+ * io:
+ *   where the built-in writes
+ *
+ * Return value: 0 on success, -1 if the files are missing
+ */
+static int replay_outputs(const char* entry, struct builtin_io* io)
+{
+  char path[CACHE_FILE_SIZE];
+  int out_fd, err_fd;
+
+  snprintf(path, sizeof(path), "%s/out", entry);
+  out_fd = open(path, O_RDONLY | O_CLOEXEC);
+  snprintf(path, sizeof(path), "%s/err", entry);
+  err_fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(out_fd == -1 || err_fd == -1) {
+    if(out_fd != -1) close(out_fd);
+    if(err_fd != -1) close(err_fd);
+    return -1;
+  }
+
+  fflush(io->out);
+  fflush(io->err);
+  replay_fd(out_fd, io->out_fd);
+  replay_fd(err_fd, io->err_fd);
+  close(out_fd);
+  close(err_fd);
+  return 0;
+}
+
+/**
+ * Replays a stored entry: stdout, stderr and status.
+ *
+ * entry:
+ *      path of the entry directory
+ * io:
+ *   where the built-in writes
+ * status:
+ *       set to the stored exit status
+ *
+ * Return value: 0 on a complete hit, -1 if the entry is unusable
+ */
+static int replay_entry(const char* entry, struct builtin_io* io, int* status)
+{
+  char path[CACHE_FILE_SIZE];
+  char status_text[32];
+  int fd, n;
+
+  snprintf(path, sizeof(path), "%s/status", entry);
+  if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) return -1;
+  n = read(fd, status_text, sizeof(status_text) - 1);
+  close(fd);
+  if(n <= 0) return -1;
+  status_text[n] = '\0';
+
+  if(replay_outputs(entry, io) == -1) return -1;
+
+  // touching the entry marks it as recently used for eviction
+  utimensat(AT_FDCWD, entry, NULL, 0);
+  *status = atoi(status_text);
+  return 0;
+}
+
+/**
+ * Compares two store entries by time of last use.
+ *
+ * Return value: negative, zero or positive as for qsort
+ */
+static int compare_entries(const void* a, const void* b)
+{
+  const struct cache_entry* x = a;
+  const struct cache_entry* y = b;
+
+  return (x->used > y->used) - (x->used < y->used);
+}
+
+/**
+ * Removes an entry directory and its three files.
+ *
+ * Return value: void
+ */
+static void remove_entry(const char* dir, const char* name)
+{
+  static const char* files[] = { "out", "err", "status" };
+  char path[CACHE_FILE_SIZE];
+  int i;
+
+  for(i = 0; i < 3; i++) {
+    snprintf(path, sizeof(path), "%s/%s/%s", dir, name, files[i]);
+    unlink(path);
+  }
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  rmdir(path);
+}
+
+/**
+ * Evicts least recently used entries until the
+ * store is no larger than its configured bound.
+ *
+ * dir:
+ *    path of the store
+ * limit:
+ *      bound in bytes
+ *
+ * Return value: size in bytes of what is left in the store
+ */
+static long long evict_entries(const char* dir, long long limit)
+{
+  struct cache_entry* entries = NULL;
+  struct cache_entry* grown;
+  size_t count = 0, cap = 0, i;
+  long long total = 0;
+  struct dirent* d;
+  DIR* store;
+  int store_fd;
+
+  if(!(store = opendir(dir))) return 0;
+  store_fd = dirfd(store);
+
+  while((d = readdir(store))) {
+    struct stat st;
+    struct cache_entry e;
+    char path[128];
+
+    if(d->d_name[0] == '.' || strlen(d->d_name) != 32) continue;
+    if(fstatat(store_fd, d->d_name, &st, 0) == -1) continue;
+
+    memset(&e, 0, sizeof(e));
+    strcpy(e.name, d->d_name);
+    e.used = st.st_mtime;
+    snprintf(path, sizeof(path), "%s/out", e.name);
+    if(fstatat(store_fd, path, &st, 0) == 0) e.size += st.st_size;
+    snprintf(path, sizeof(path), "%s/err", e.name);
+    if(fstatat(store_fd, path, &st, 0) == 0) e.size += st.st_size;
+    total += e.size;
+
+    if(count == cap) {
+      cap = cap ? cap * 2 : 64;
+      if(!(grown = realloc(entries, sizeof(*entries) * cap))) continue;
+      entries = grown;
+    }
+    entries[count++] = e;
+  }
+  closedir(store);
+
+  if(total > limit) {
+    qsort(entries, count, sizeof(*entries), compare_entries);
+    for(i = 0; i < count && total > limit; i++) {
+      remove_entry(dir, entries[i].name);
+      total -= entries[i].size;
+    }
+  }
+  free(entries);
+  return total;
+}
+
+/**
+ * Adds a newly stored entry to the running total
+ * of the store, and only walks the store to evict
+ * once the total passes the bound. The total is
+ * kept in a file under an exclusive lock, so
+ * concurrent shells add up correctly. Entries
+ * replaced or removed by others can leave it too
+ * high, which just brings the next walk forward;
+ * the walk writes back the true size.
+ *
+ * dir:
+ *    path of the store
+ * size:
+ *     size in bytes of the new entry
+ *
+ * Return value: void
+ */
+static void account_entry(const char* dir, long long size)
+{
+  char* env = getenv("MYSHELL_CACHE_SIZE");
+  long long limit = env ? atoll(env) : CACHE_DEFAULT_SIZE;
+  char path[CACHE_ENTRY_SIZE], text[32];
+  long long total;
+  ssize_t n;
+  int fd;
+
+  if(limit <= 0) limit = CACHE_DEFAULT_SIZE;
+  snprintf(path, sizeof(path), "%s/" CACHE_TOTAL_FILE, dir);
+  if((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1) return;
+  if(flock(fd, LOCK_EX) == -1) {
+    close(fd);
+    return;
+  }
+
+  n = pread(fd, text, sizeof(text) - 1, 0);
+  text[n > 0 ? n : 0] = '\0';
+  total = atoll(text) + size;
+  if(total > limit) total = evict_entries(dir, limit);
+
+  // fixed width, so a new total always overwrites the old one whole
+  n = snprintf(text, sizeof(text), "%20lld\n", total);
+  pwrite(fd, text, n, 0);
+  close(fd);
+}
+
+/**
+ * Runs the command without the store, for when the
+ * store cannot be used.
+ *
+ * io:
+ *   where the built-in reads and writes
+ *
+ * Return value: exit status of the command
+ */
+static int run_uncached(char** command, struct builtin_io* io)
+{
+  int std_fds[3] = { io->in_fd, io->out_fd, io->err_fd };
+  pid_t pid;
+
+  fflush(io->out);
+  fflush(io->err);
+  if(spawn_with_io(command, std_fds, io, &pid) != 0) {
+    fprintf(io->err, "Error: Could not execute command %s\n", command[0]);
+    return 127;
+  }
+  return wait_child(pid);
+}
+
+/**
+ * Runs the command with its stdout and stderr sent to
+ * files in a fresh directory and replays them from
+ * there, then publishes the directory as the entry
+ * for the key with rename so concurrent shells never
+ * see half-written entries. An entry is only
+ * published once all of its files were written; the
+ * output of a run that could not be stored is still
+ * replayed.
+ *
+ * io:
+ *   where the built-in reads and writes
+ * exit_status:
+ *            set to the exit status of the command
+ *
+ * Return value: size in bytes of the stored output, -1 if the
+ *               result was not stored
+ */
+static long long run_and_store(char** command, const char* dir, const char* entry,
+			 struct builtin_io* io, int* exit_status)
+{
+  char tmp[CACHE_ENTRY_SIZE], path[CACHE_FILE_SIZE];
+  int std_fds[3], out_fd, err_fd, fd, err, stored = 0;
+  struct stat out_st, err_st;
+  long long size = -1;
+  pid_t pid;
+
+  // the thread id keeps pipeline stages of one shell apart
+  snprintf(tmp, sizeof(tmp), "%s/.tmp.%d.%d", dir, (int) getpid(),
+	   (int) gettid());
+  remove_entry(dir, tmp + strlen(dir) + 1);
+  if(mkdir(tmp, 0700) == -1) {
+    *exit_status = run_uncached(command, io);
+    return -1;
+  }
+
+  snprintf(path, sizeof(path), "%s/out", tmp);
+  out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  snprintf(path, sizeof(path), "%s/err", tmp);
+  err_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if(out_fd == -1 || err_fd == -1) {
+    if(out_fd != -1) close(out_fd);
+    if(err_fd != -1) close(err_fd);
+    remove_entry(dir, tmp + strlen(dir) + 1);
+    *exit_status = run_uncached(command, io);
+    return -1;
+  }
+
+  // stderr shares the stdout file when the two go to one place, so
+  // 2>&1 keeps its interleaving on replay
+  std_fds[0] = io->in_fd;
+  std_fds[1] = out_fd;
+  std_fds[2] = io->err_fd == io->out_fd ? out_fd : err_fd;
+  fflush(io->out);
+  fflush(io->err);
+  if((err = spawn_with_io(command, std_fds, io, &pid)) == 0) {
+    *exit_status = wait_child(pid);
+    if(fstat(out_fd, &out_st) == 0 && fstat(err_fd, &err_st) == 0) {
+      size = out_st.st_size + err_st.st_size;
+    }
+  }
+  close(out_fd);
+  close(err_fd);
+  if(err != 0) {
+    fprintf(io->err, "Error: Could not execute command %s\n", command[0]);
+    remove_entry(dir, tmp + strlen(dir) + 1);
+    *exit_status = 127;
+    return -1;
+  }
+
+  // only normal exits are worth keeping, a missing command or
+  // a killed run says nothing about the inputs
+  if(*exit_status != 127 && *exit_status < 128 && size != -1) {
+    snprintf(path, sizeof(path), "%s/status", tmp);
+    if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		  0600)) != -1) {
+      stored = dprintf(fd, "%d\n", *exit_status) > 0;
+      if(close(fd) == -1) stored = 0;
+    }
+  }
+
+  if(replay_outputs(tmp, io) == -1) stored = 0;
+  if(!stored) {
+    remove_entry(dir, tmp + strlen(dir) + 1);
+    return -1;
+  }
+
+  // an entry that could not be replayed is in the way of rename
+  remove_entry(dir, entry + strlen(dir) + 1);
+  if(rename(tmp, entry) == -1) {
+    // another shell stored the same key first, use theirs
+    remove_entry(dir, tmp + strlen(dir) + 1);
+  }
+  return size;
+}
+
+/**
+ * Runs a command through the output cache.
+ *
+ *   cache [-e VAR]... [-i FILE]... [-m FILE]... [--] command [args]
+ *
+ * parsed_input:
+ *             the command and arguments entered in by the user
+ * io:
+ *   where the built-in reads and writes
+ *
+ * Return value: exit status of the command, replayed or not
+ */
+int cached_command(char** parsed_input, struct builtin_io* io)
+{
+  char dir[CACHE_DIR_SIZE], entry[CACHE_ENTRY_SIZE], cwd[4096];
+  struct builtin_io keyed;
+  long long size;
+  cache_key key = ((cache_key) FNV128_OFFSET_HI << 64) | FNV128_OFFSET_LO;
+  char** command;
+  int i, status;
+
+  // options come first, the command starts at the first other word
+  for(i = 1; parsed_input[i] && parsed_input[i][0] == '-'; i += 2) {
+    char* opt = parsed_input[i];
+
+    if(strcmp(opt, "--") == 0) {
+      i++;
+      break;
+    }
+    if(!parsed_input[i + 1] || opt[2] != '\0' ||
+       (opt[1] != 'e' && opt[1] != 'i' && opt[1] != 'm')) {
+      fprintf(io->err, "usage: cache [-e VAR]... [-i FILE]... [-m FILE]... "
+	      "[--] command [args]\n");
+      return 2;
+    }
+
+    // the option itself is hashed too, so -i f and -m f differ
+    hash_string(&key, opt);
+    hash_string(&key, parsed_input[i + 1]);
+    if(opt[1] == 'e') {
+      char* value = getenv(parsed_input[i + 1]);
+      hash_string(&key, value ? value : "");
+    }
+    else if((opt[1] == 'i' ? hash_file_contents(&key, parsed_input[i + 1])
+	     : hash_file_mtime(&key, parsed_input[i + 1])) == -1) {
+      fprintf(io->err, "cache: cannot read input file %s\n", parsed_input[i + 1]);
+      return 1;
+    }
+  }
+
+  command = parsed_input + i;
+  if(!command[0]) {
+    fprintf(io->err, "cache: no command given\n");
+    return 2;
+  }
+
+  hash_string(&key, getcwd(cwd, sizeof(cwd)) ? cwd : "");
+  for(i = 0; command[i]; i++) {
+    hash_string(&key, command[i]);
+  }
+  // a run stored with stderr in the stdout file only replays right
+  // where the two still go to one place
+  hash_string(&key, io->err_fd == io->out_fd ? "2>&1" : "");
+
+  // only stdout and stderr are stored, so output sent to a higher
+  // descriptor would be lost on a hit
+  if(io->num_redirects > 0) return run_uncached(command, io);
+
+  // the command reads its input from the copy that was hashed
+  keyed = *io;
+  if((i = hash_input(&key, io, &keyed.in_fd)) == -1) {
+    fprintf(io->err, "cache: cannot read standard input\n");
+    return 1;
+  }
+  if(i == 0 || cache_directory(dir, sizeof(dir)) == -1) {
+    // without a key or a store the command simply runs uncached
+    status = run_uncached(command, &keyed);
+  }
+  else {
+    snprintf(entry, sizeof(entry), "%s/%016llx%016llx", dir,
+	     (unsigned long long) (key >> 64), (unsigned long long) key);
+    if(replay_entry(entry, &keyed, &status) == -1 &&
+       (size = run_and_store(command, dir, entry, &keyed, &status)) != -1) {
+      account_entry(dir, size);
+    }
+  }
+
+  if(keyed.in_fd != io->in_fd) close(keyed.in_fd);
+  return status;
+}
@@ -0,0 +1,48 @@
+/**
+ * This is the header class for cache.c
+ *
+ * These methods implement the cache built-in,
+ * which replays the saved output of deterministic
+ * commands instead of running them again.
+ */
+
+#ifndef CACHE_H
+# define CACHE_H
+
+#include "command.h"
+
+/**
+ * Runs a command through the output cache.
+ *
+ *   cache [-e VAR]... [-i FILE]... [-m FILE]... [--] command [args]
+ *
+ * The key is a hash of the arguments, the current
+ * directory, the values of every -e variable, the
+ * contents of every -i file, the size and mtime of
+ * every -m file, whether stderr goes where stdout
+ * does, and the standard input: piped or redirected
+ * input is read in full and hashed, a terminal,
+ * /dev/null or closed stdin only by kind. Other
+ * input, such as the shell's own stdin when it is a
+ * script, makes the command run uncached. On a hit the stored stdout,
+ * stderr and exit status are replayed; on a miss
+ * the command is run and its results are stored.
+ * The command gets the built-in's descriptors; one
+ * given descriptors above 2 runs uncached, since
+ * only stdout and stderr are stored.
+ *
+ * The store lives in $MYSHELL_CACHE_DIR (default
+ * ~/.cache/myshell) and is kept under
+ * $MYSHELL_CACHE_SIZE bytes (default 256 MiB) by
+ * evicting the least recently used entries.
+ *
+ * parsed_input:
+ *             the command and arguments entered in by the user
+ * io:
+ *   where the built-in reads and writes
+ *
+ * Return value: exit status of the command, replayed or not
+ */
+int cached_command(char** parsed_input, struct builtin_io* io);
+
+#endif
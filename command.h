@@ -0,0 +1,120 @@
+/**
+ * This is the header class for the parsed form of
+ * a command line, shared by process.c, which builds
+ * it, and commands.c/redirect.c, which execute it.
+ *
+ * A line is a list of pipelines separated by ';' or
+ * '&'. A pipeline is one or more commands joined by
+ * '|'. A command is its argument vector plus the
+ * redirections that are applied, in order, in the
+ * child that runs it.
+ */
+
+#ifndef COMMAND_H
+# define COMMAND_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/**
+ * In the words of a function body, a $1 ... $9, $0,
+ * $#, $@ or $* that was not single-quoted is kept
+ * as this byte followed by the character after the
+ * '$', and bound to the call's arguments each time
+ * the function runs.
+ */
+#define PARAM_MARK '\001'
+
+/**
+ * Kinds of redirection actions.
+ *
+ * REDIRECT_OPEN:  open path with flags onto fd   (<, >, >>, <>)
+ * REDIRECT_DUP:   make fd a copy of src_fd         (>&N, <&N)
+ * REDIRECT_CLOSE: close fd                         (>&-, <&-)
+ * REDIRECT_COPROC: make fd a copy of the input or, for
+ *                  flags O_RDONLY, the output of the
+ *                  coprocess named path (>&name, <&name);
+ *                  resolve_coprocs sets src_fd to the
+ *                  shell's descriptor for it
+ * REDIRECT_HEREDOC: make fd a copy of src_fd, the pipe or
+ *                   memfd holding a here-document body
+ *                   (<<WORD, <<-WORD, <<< word); src_fd is
+ *                   the shell's and owned by the command
+ *
+ * The src_fd of a DUP is a descriptor of the command
+ * itself, as left by the redirections before it; those
+ * of COPROC and HEREDOC are the shell's own.
+ */
+enum redirect_kind {
+  REDIRECT_OPEN,
+  REDIRECT_DUP,
+  REDIRECT_CLOSE,
+  REDIRECT_COPROC,
+  REDIRECT_HEREDOC
+};
+
+struct redirect {
+  enum redirect_kind kind;
+  int fd;
+  int src_fd;
+  int flags;
+  char* path;
+};
+
+struct command {
+  char** argv;
+  int argc;
+  struct redirect* redirects;
+  int num_redirects;
+  // directory to start in, NULL for the shell's
+  const char* cwd;
+};
+
+struct pipeline {
+  struct command* commands;
+  int num_commands;
+  int bg;
+  // capacity of the pipes in KiB from a pipesize prefix, 0 = the option
+  int pipe_size;
+};
+
+/**
+ * A process substitution, <(cmd) or >(cmd), started
+ * while its line was parsed.
+ */
+struct substitution {
+  // the shell's end of the pipe, named as /dev/fd/fd in a word
+  int fd;
+  pid_t pid;
+};
+
+struct command_list {
+  struct pipeline* pipelines;
+  int num_pipelines;
+  // ended by parse_string once the line has run
+  struct substitution* substitutions;
+  int num_substitutions;
+};
+
+/**
+ * Where a built-in reads and writes. Built-ins never
+ * use the shell's own stdin/stdout, so the same code
+ * runs at the prompt, behind redirections, or as a
+ * pipeline stage on a thread of its own. out and err
+ * are stdio streams on out_fd and err_fd.
+ * redirects are copies and closes that give the
+ * built-in's descriptors above 2 to a program it
+ * starts; a forked built-in has none, since its
+ * descriptors are already in place.
+ */
+struct builtin_io {
+  int in_fd;
+  int out_fd;
+  int err_fd;
+  FILE* out;
+  FILE* err;
+  struct redirect* redirects;
+  int num_redirects;
+};
+
+#endif
@@ -7,67 +7,365 @@
  * command line.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/wait.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 
+#include "cache.h"
 #include "commands.h"
+#include "dir.h"
+#include "draw.h"
+#include "fdcache.h"
+#include "files.h"
+#include "functions.h"
+#include "jobs.h"
+#include "jobsched.h"
+#include "coproc.h"
+#include "audit.h"
+#include "stats.h"
+#include "meter.h"
+#include "options.h"
+#include "redirect.h"
+#include "pager.h"
 
 extern char** environ;
 
+int last_exit_status = 0;
+int exec_in_place = 0;
+
+/**
+ * Describes one of the shell's built-in commands.
+ * The table below is the single place a built-in
+ * is registered: the parser asks it whether a word
+ * is a built-in and help reads its usage lines.
+ * Built-ins marked in_shell change the shell itself
+ * and never run on a thread of their own.
+ */
+struct builtin {
+  const char* name;
+  int (*run)(char** parsed_input, struct builtin_io* io);
+  int in_shell;
+  const char* usage;
+  const char* summary;
+};
+
+int change_directory(char** parsed_input, struct builtin_io* io);
+int clear_screen(char** parsed_input, struct builtin_io* io);
+int echo(char** parsed_input, struct builtin_io* io);
+int environment_strings(char** parsed_input, struct builtin_io* io);
+int help(char** parsed_input, struct builtin_io* io);
+int pause_program(char** parsed_input, struct builtin_io* io);
+int quit(char** parsed_input, struct builtin_io* io);
+int timeout_usage(char** parsed_input, struct builtin_io* io);
+int priority_usage(char** parsed_input, struct builtin_io* io);
+int pipesize_usage(char** parsed_input, struct builtin_io* io);
+
+static const struct builtin built_ins[] = {
+  { "alias", alias_command, 1, "alias [name[=value]]...",
+    "List aliases, or make name run the commands in value" },
+  { "cache", cached_command, 0,
+    "cache [-e VAR] [-i FILE] [-m FILE] <command>",
+    "Replay the stored output of <command> if its inputs are unchanged" },
+  { "cat", cat_command, 0, "cat [file]...",
+    "Write files to the output, copying inside the kernel" },
+  { "cd", change_directory, 1, "cd <directory>",
+    "Change the current default directory to <directory>" },
+  { "clr", clear_screen, 0, "clr", "Clear the screen" },
+  { "coproc", coproc_command, 1, "coproc [NAME command [args] | -c NAME]",
+    "Start command with pipes to and from it, kept open as NAME" },
+  { "cp", cp_command, 0, "cp <source>... <target>",
+    "Copy files, inside the kernel where the file system allows" },
+  { "dir", list_directory, 0, "dir [-alU] <directory>",
+    "List the contents of directory <directory>" },
+  { "echo", echo, 0, "echo [-n] <comment>",
+    "Display <comment> on the display, followed by a new line unless -n" },
+  { "environ", environment_strings, 0, "environ",
+    "List all the environment strings" },
+  { "help", help, 0, "help [command]",
+    "Display the user manual, or the help for one command" },
+  { "meter", meter_command, 0, "cmd1 | meter [label] | cmd2",
+    "Pass data on, reporting its rate and which side made it wait" },
+  { "pause", pause_program, 0, "pause",
+    "Pause the operation of the shell until \"ENTER/RETURN\" key is pressed" },
+  { "pipesize", pipesize_usage, 0, "pipesize KiB <command> | ...",
+    "Give the pipes of this pipeline KiB of buffer" },
+  { "priority", priority_usage, 0, "priority N <command> &",
+    "Queue background <command> ahead of jobs with a lower N" },
+  { "quit", quit, 1, "quit", "Quit the shell" },
+  { "set", set_options, 1, "set [name=value]",
+    "List the shell options, or set one to on, off or a number" },
+  { "timeout", timeout_usage, 0, "timeout DURATION [-k KILL_AFTER] <command>",
+    "Run <command>, stopping it with status 124 if it runs past DURATION" },
+  { "unalias", unalias_command, 1, "unalias name...",
+    "Remove aliases" },
+  { "wc", wc_command, 0, "wc -l [file]...",
+    "Count the lines of files; other options run wc from PATH" },
+};
+
+#define NUM_BUILT_INS (sizeof(built_ins) / sizeof(built_ins[0]))
+
+// time between SIGTERM and SIGKILL when timeout is given no -k
+#define TIMEOUT_KILL_AFTER_MS 5000
+// exit status of a timeout prefix that could not be parsed
+#define TIMEOUT_USAGE_STATUS 125
+#define TIMEOUT_USAGE "usage: timeout DURATION [-k KILL_AFTER] command [args]\n"
+#define PRIORITY_USAGE "usage: priority N command [args] &\n"
+#define PIPESIZE_USAGE "usage: pipesize KiB command [args] | ...\n"
+
+/**
+ * A built-in about to run inside the shell, either on
+ * the calling thread or as a pipeline stage on a thread
+ * of its own. opened holds the descriptors its
+ * redirections opened, which are closed once it ends.
+ * A stage thread also owns its two pipe ends.
+ */
+struct builtin_run {
+  const struct builtin* b;
+  struct command* cmd;
+  struct builtin_io io;
+  int* opened;
+  int num_opened;
+  int pipe_in;
+  int pipe_out;
+  int status;
+  // record of the stage in the audit log
+  long audit_id;
+  pthread_t thread;
+};
+
+// commonly used system commands, listed in the manual after the built-ins
+static const char* manual_system_commands[] = {
+  "cal - Returns a calendar with the current day highlighted",
+  "date - Returns the current date",
+  "ls - Lists the content of a directory",
+  "ps - Returns list of currently running processes",
+  "time - Returns the current time",
+  "who - Returns various information on current user",
+};
+
+#define NUM_MANUAL_SYSTEM_COMMANDS \
+  (sizeof(manual_system_commands) / sizeof(manual_system_commands[0]))
+
+static const char* manual_footer =
+  "\n"
+  "Commands may be combined on one line:\n"
+  "  cmd1 ; cmd2      run cmd1, then cmd2\n"
+  "  cmd1 | cmd2      send the output of cmd1 to the input of cmd2\n"
+  "  cmd > file       write the output of cmd to file, truncating it\n"
+  "  cmd >> file      append the output of cmd to file\n"
+  "  cmd < file       read the input of cmd from file\n"
+  "  cmd N> file      redirect file descriptor N (also N>>, N<, N<>)\n"
+  "  cmd 2>&1         make stderr a copy of stdout (N>&M, N<&M, N>&-)\n"
+  "  cmd &> file      write both stdout and stderr to file (&>> appends)\n"
+  "  cmd1 |& cmd2     pipe both stdout and stderr of cmd1 to cmd2\n"
+  "  cmd <<WORD       read the input of cmd from the following lines,\n"
+  "                   up to a line holding only WORD (<<- strips tabs)\n"
+  "  cmd <<< word     read the input of cmd from word\n"
+  "  cmd <(cmd2)      pass cmd2's output to cmd as a /dev/fd/N file\n"
+  "  cmd >(cmd2)      pass a /dev/fd/N file feeding cmd2's input to cmd\n"
+  "  cmd &            run cmd in the background, or queue it while\n"
+  "                   \"set maxjobs\", maxload or maxpressure hold it back\n"
+  "\n"
+  "Built-ins other than cd, quit and set that appear in a pipeline run\n"
+  "on a thread inside the shell instead of in a forked child.\n"
+  "\n"
+  "name() { commands; } defines a function; the body may also span\n"
+  "lines up to a line holding only '}'. Inside it $1 to $9, $# and $@\n"
+  "are the arguments of the call. Built-ins come first, then functions\n"
+  "and aliases, then PATH.\n"
+  "\n"
+  "coproc NAME command starts command with its input and output on\n"
+  "pipes the shell keeps open: >&NAME writes to it and <&NAME reads\n"
+  "from it, so one process can answer many later commands.\n"
+  "\n"
+  "At the prompt, Up and Down recall earlier command lines and Ctrl-R\n"
+  "searches them. The history is shared by all sessions and kept in\n"
+  "~/.myshell_history, or the file named by MYSHELL_HISTFILE.\n"
+  "Tab completes built-in, PATH command and file names; a second Tab\n"
+  "lists the candidates.\n"
+  "\n"
+  "MYSHELL_PROMPT sets the prompt: %d is the working directory, %b the\n"
+  "git branch, %t the time the last command took if a second or more,\n"
+  "%s its status if not 0, %j the number of background jobs.\n"
+  "\n"
+  "MYSHELL_AUDIT_LOG names a file that gets a line when each command\n"
+  "starts and when it ends, written in batches by a thread of its own.\n"
+  "\n"
+  "Running the shell with a file name as its only argument executes\n"
+  "every line of that file and exits. \"-c 'command'\" runs a single\n"
+  "command line and -s reads command lines from standard input; both\n"
+  "skip the banner and prompt and exit with the last command's status.\n";
+
+/**
+ * Looks up a built-in command by name.
+ *
+ * name:
+ *     command name to look up
+ *
+ * Return value: the matching built-in, NULL otherwise
+ */
+static const struct builtin* find_built_in(const char* name)
+{
+  size_t i;
+
+  for(i = 0; i < NUM_BUILT_INS; i++) {
+    if(strcmp(built_ins[i].name, name) == 0) {
+      return &built_ins[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Determines whether command names a built-in command.
+ *
+ * command:
+ *        command to check
+ *
+ * Return value: 1 if built-in, 0 otherwise
+ */
+int is_built_in(char* command)
+{
+  return find_built_in(command) != NULL;
+}
+
+/**
+ * Names the built-in commands one at a time, in
+ * the order of the table.
+ *
+ * i:
+ *  index of the built-in
+ *
+ * Return value: name of built-in i, NULL past the last one
+ */
+const char* built_in_name(size_t i)
+{
+  return i < NUM_BUILT_INS ? built_ins[i].name : NULL;
+}
+
 /**
  * Prints out the help screen for the user.
- * The system help is displayed after a brief
- * help screen for all the special built-in 
- * commands specific to this shell. All output
- * is piped through the more filter.
+ * The manual is compiled into the shell and
+ * shown through an in-process pager, so no
+ * other program is started. With an argument,
+ * only the help for that command is shown.
  *
- * Return value: void
+ * Return value: 0 on success, 1 on error
  */
-void help()
-{
-  puts("User manual for MYSHELL\n"
-       "\n"
-       "The following commands are supported by this shell:\n\n"
-       "cal - Returns a calendar with the current day highlighted\n"
-       "cd <directory> - Change the current default directory to <directory>\n"
-       "clr - Clear the screen\n"
-       "date - Returns the current date\n"
-       "dir <directory> - List the contents of directory <directory>\n"
-       "echo <comment> - Display <comment> on the display, followed by a new line\n"
-       "environ - List all the environment strings\n"
-       "help - Display the user manual\n"
-       "ls - Lists the content of a directory\n"
-       "pause - Pause the operation of the shell until \"ENTER/RETURN\" key is pressed\n"
-       "ps - Returns list of currently running processes\n"
-       "quit - Quit the shell\n"
-       "time - Returns the current time\n"
-       "who - Returns various information on current user\n"
-       "\n"
-       "The following is the user manual for the shell on this computer...\n"
-       );
-
-  // since help command isn't supported through execing
-  system("bash -c help | more");
+int help(char** parsed_input, struct builtin_io* io)
+{
+  char* text;
+  size_t len;
+  FILE* manual = open_memstream(&text, &len);
+  const struct builtin* b;
+  size_t i;
+
+  if(!manual) {
+    fprintf(io->err, "Error: Could not build the user manual\n");
+    return 1;
+  }
+
+  if(parsed_input[1]) {
+    if(!(b = find_built_in(parsed_input[1]))) {
+      fprintf(manual, "help: no help for '%s', it is not a built-in command\n",
+	      parsed_input[1]);
+    }
+    else {
+      fprintf(manual, "%s - %s\n", b->usage, b->summary);
+    }
+  }
+  else {
+    fputs("User manual for MYSHELL\n"
+	  "\n"
+	  "The following built-in commands are supported by this shell:\n\n",
+	  manual);
+    for(i = 0; i < NUM_BUILT_INS; i++) {
+      fprintf(manual, "%s - %s\n", built_ins[i].usage, built_ins[i].summary);
+    }
+    fputs("\nThe following system commands are commonly used:\n\n", manual);
+    for(i = 0; i < NUM_MANUAL_SYSTEM_COMMANDS; i++) {
+      fprintf(manual, "%s\n", manual_system_commands[i]);
+    }
+    fputs(manual_footer, manual);
+  }
+
+  fclose(manual);
+  // anything printed earlier has to come out first
+  fflush(io->out);
+  page_text(text, len, io->in_fd, io->out_fd);
+  free(text);
+  return 0;
+}
+
+/**
+ * Changes the current working directory to the
+ * first argument, or to HOME when none is given.
+ *
+ * Return value: 0 on success, 1 on error
+ */
+int change_directory(char** parsed_input, struct builtin_io* io)
+{
+  char* target = parsed_input[1];
+
+  if(!target) {
+    target = getenv("HOME");
+  }
+  if(!target || chdir(target) < 0) {
+    fprintf(io->err, "Error encountered while trying to change directories...\n");
+    return 1;
+  }
+  // relative redirection targets name other files now
+  fdcache_clear();
+  prompt_directory_changed();
+  return 0;
+}
+
+/**
+ * Prints its arguments separated by spaces. A
+ * leading -n leaves off the trailing new line.
+ *
+ * Return value: 0
+ */
+int echo(char** parsed_input, struct builtin_io* io)
+{
+  int i = 1, newline = 1;
+
+  if(parsed_input[1] && strcmp(parsed_input[1], "-n") == 0) {
+    newline = 0;
+    i++;
+  }
+  for(; parsed_input[i]; i++) {
+    if(i > 2 - newline) fputc(' ', io->out);
+    fputs(parsed_input[i], io->out);
+  }
+  if(newline) fputc('\n', io->out);
+  return 0;
 }
 
 /**
  * Prints out all the environment strings.
  *
- * Return value: void
+ * Return value: 0
  */
-void environment_strings()
+int environment_strings(char** parsed_input, struct builtin_io* io)
 {
   int i;
   char *s = *environ;
   
   for(i = 1; s; i++) {
-    printf("%s\n", s);
+    fprintf(io->out, "%s\n", s);
     s = *(environ + i);
   }
+  return 0;
 }
 
 /**
@@ -82,223 +380,936 @@ void clr()
   printf("\033[H\033[J");
 }
 
+/**
+ * Built-in version of clr.
+ *
+ * Return value: 0
+ */
+int clear_screen(char** parsed_input, struct builtin_io* io)
+{
+  fputs("\033[H\033[J", io->out);
+  return 0;
+}
+
 /**
  * Pauses operation of the shell
  * until the user presses the ENTER/RETURN
  * key.
  *
- * Return value: void
+ * Return value: 0
  */
-void pause_program()
+int pause_program(char** parsed_input, struct builtin_io* io)
 {
-  while(getchar() != '\n');
+  char c;
+
+  fflush(io->out);
+  while(read(io->in_fd, &c, 1) == 1 && c != '\n');
+  return 0;
 }
 
 /**
  * Quits the shell.
  *
- * Return value: void
+ * Return value: does not return
  */
-void quit()
+int quit(char** parsed_input, struct builtin_io* io)
 {
-  printf("Goodbye...\n");
+  fprintf(io->out, "Goodbye...\n");
+  fflush(io->out);
   exit(0);
 }
 
 /**
- * Executes any built-in command that the
- * user entered. 
+ * The timeout built-in. A well-formed timeout prefix
+ * is taken off the command before it runs, see
+ * strip_timeout, so this only runs for a bad one.
  *
- * parsed_input:
- *             the commands and arguments entered in by the user
+ * Return value: the usage error status, 125
+ */
+int timeout_usage(char** parsed_input, struct builtin_io* io)
+{
+  fputs(TIMEOUT_USAGE, io->err);
+  return TIMEOUT_USAGE_STATUS;
+}
+
+/**
+ * Parses a duration: a number of seconds that may
+ * have a fraction and an s, m, h or d suffix.
+ *
+ * Return value: 0 on success, -1 if text is not a duration
+ */
+static int parse_duration(const char* text, long* ms)
+{
+  char* end;
+  double value = strtod(text, &end);
+  double unit;
+
+  if(end == text || value < 0) return -1;
+  switch(*end) {
+  case 0: case 's': unit = 1000; break;
+  case 'm': unit = 60 * 1000; break;
+  case 'h': unit = 60 * 60 * 1000; break;
+  case 'd': unit = 24 * 60 * 60 * 1000; break;
+  default: return -1;
+  }
+  if(*end && end[1]) return -1;
+  if(value * unit > 365.0 * 24 * 60 * 60 * 1000) return -1;
+
+  *ms = (long) (value * unit + 0.5);
+  return 0;
+}
+
+/**
+ * Takes "timeout DURATION [-k KILL_AFTER]" prefixes
+ * off the front of a command. The shortest deadline
+ * and kill delay seen so far are kept in timeout_ms
+ * and kill_after_ms, as the whole pipeline is one job.
+ *
+ * cmd:
+ *    the parsed command
+ * timeout_ms:
+ *           shortest deadline so far, 0 for none
+ * kill_after_ms:
+ *              shortest time between SIGTERM and SIGKILL so far
+ *
+ * Return value: 0 on success, -1 if a prefix is malformed
+ */
+static int strip_timeout(struct command* cmd, long* timeout_ms,
+			 long* kill_after_ms)
+{
+  while(cmd->argc > 0 && strcmp(cmd->argv[0], "timeout") == 0) {
+    long duration = -1, kill_after = TIMEOUT_KILL_AFTER_MS;
+    int i = 1, j;
+
+    // -k may come before or after the duration
+    while(cmd->argv[i]) {
+      if(strcmp(cmd->argv[i], "-k") == 0) {
+	if(!cmd->argv[i + 1] || parse_duration(cmd->argv[i + 1],
+					       &kill_after) == -1) {
+	  return -1;
+	}
+	i += 2;
+      }
+      else if(duration == -1) {
+	if(parse_duration(cmd->argv[i], &duration) == -1) return -1;
+	i++;
+      }
+      else {
+	break;
+      }
+    }
+    if(duration == -1 || !cmd->argv[i]) return -1;
+
+    if(duration > 0 && (*timeout_ms == 0 || duration < *timeout_ms)) {
+      *timeout_ms = duration;
+    }
+    if(kill_after < *kill_after_ms) *kill_after_ms = kill_after;
+
+    for(j = 0; j < i; j++) {
+      free(cmd->argv[j]);
+    }
+    memmove(cmd->argv, cmd->argv + i, sizeof(char*) * (cmd->argc - i + 1));
+    cmd->argc -= i;
+  }
+  return 0;
+}
+
+/**
+ * The priority built-in. Like timeout it is a prefix
+ * taken off the command, see strip_prefix, so this
+ * only runs for a malformed one.
+ *
+ * Return value: 2
+ */
+int priority_usage(char** parsed_input, struct builtin_io* io)
+{
+  fputs(PRIORITY_USAGE, io->err);
+  return 2;
+}
+
+/**
+ * The pipesize built-in, another prefix that only
+ * runs when malformed.
+ *
+ * Return value: 2
+ */
+int pipesize_usage(char** parsed_input, struct builtin_io* io)
+{
+  fputs(PIPESIZE_USAGE, io->err);
+  return 2;
+}
+
+/**
+ * Takes a "name N" prefix, such as "priority 5",
+ * off the front of a command.
+ *
+ * cmd:
+ *    the parsed command
+ * name:
+ *     the prefix word
+ * min, max:
+ *         allowed range of N
+ * value:
+ *      set to N when the prefix is found
+ *
+ * Return value: 1 if taken off, 0 if absent, -1 if malformed
+ */
+static int strip_prefix(struct command* cmd, const char* name, long min,
+			long max, int* value)
+{
+  char* end;
+  long n;
+
+  if(cmd->argc == 0 || strcmp(cmd->argv[0], name) != 0) return 0;
+  if(cmd->argc < 3) return -1;
+
+  n = strtol(cmd->argv[1], &end, 10);
+  if(*end || end == cmd->argv[1] || n < min || n > max) return -1;
+  *value = n;
+
+  free(cmd->argv[0]);
+  free(cmd->argv[1]);
+  memmove(cmd->argv, cmd->argv + 2, sizeof(char*) * (cmd->argc - 1));
+  cmd->argc -= 2;
+  return 1;
+}
+
+/**
+ * Takes the priority and pipesize prefixes, in any
+ * order, off the first command of a pipeline.
+ * Priorities only order the background job queue
+ * and are dropped for foreground jobs.
+ *
+ * priority:
+ *         set to N of "priority N"
+ *
+ * Return value: 0 on success, -1 after printing the usage
+ *               of a malformed prefix
+ */
+static int strip_pipeline_prefixes(struct pipeline* p, int* priority)
+{
+  struct command* first = &p->commands[0];
+  int found;
+
+  do {
+    if((found = strip_prefix(first, "priority", -1000, 1000, priority)) == -1) {
+      fputs(PRIORITY_USAGE, stderr);
+      return -1;
+    }
+    if(!found && (found = strip_prefix(first, "pipesize", 1, PIPESIZE_MAX,
+				       &p->pipe_size)) == -1) {
+      fputs(PIPESIZE_USAGE, stderr);
+      return -1;
+    }
+  } while(found);
+  return 0;
+}
+
+/**
+ * Gives a pipe the capacity asked for by the pipeline
+ * or the pipesize option. Requests over the system
+ * limit get the limit, unless the shell is allowed
+ * to go past it.
+ *
+ * fd:
+ *   either end of the pipe
+ * kib:
+ *    capacity in KiB, 0 to leave the kernel default
  *
  * Return value: void
  */
-void execute_built_in_command(char** parsed_input)
+static void size_pipe(int fd, int kib)
+{
+  static long limit = 0;
+  FILE* f;
+
+  if(!kib || fcntl(fd, F_SETPIPE_SZ, kib * 1024L) != -1) return;
+  if(errno != EPERM) return;
+
+  if(!limit) {
+    limit = 1024 * 1024;
+    if((f = fopen("/proc/sys/fs/pipe-max-size", "re"))) {
+      if(fscanf(f, "%ld", &limit) != 1) limit = 1024 * 1024;
+      fclose(f);
+    }
+  }
+  fcntl(fd, F_SETPIPE_SZ, limit);
+}
+
+/**
+ * Where one descriptor of a built-in points while its
+ * redirections are opened: a descriptor of the shell,
+ * or -1 once the redirections closed it.
+ */
+struct fd_slot {
+  int fd;
+  int target;
+};
+
+/**
+ * Finds a descriptor of a built-in in its map.
+ *
+ * Return value: the entry, NULL if the built-in never had fd
+ */
+static struct fd_slot* find_fd_slot(struct fd_slot* map, int num, int fd)
 {
-  char* ownCommands[12];
-  int argSwitch = 0;
   int i;
 
-  ownCommands[0] = "cd";
-  ownCommands[1] = "cd;";
-  ownCommands[2] = "clr";
-  ownCommands[3] = "clr;";
-  ownCommands[4] = "environ";
-  ownCommands[5] = "environ;";
-  ownCommands[6] = "help";
-  ownCommands[7] = "help;";
-  ownCommands[8] = "pause";
-  ownCommands[9] = "pause;";
-  ownCommands[10] = "quit";
-  ownCommands[11] = "quit;";
-
-  for(i = 0; i < 12; i++) { 
-    if(strcmp(parsed_input[0], ownCommands[i]) == 0) { 
-      argSwitch = i; 
-      break; 
-    } 
-  }
-
-  switch(argSwitch) {
-  case 0:
-    if(parsed_input[1]) {
-      if(chdir(parsed_input[1]) < 0) {
-	fprintf(stderr, "Error encountered while trying to change directories...\n");
+  for(i = 0; i < num; i++) {
+    if(map[i].fd == fd) return &map[i];
+  }
+  return NULL;
+}
+
+/**
+ * Write function of the stream handed to a built-in
+ * for a closed descriptor, which fails every write
+ * like write(2) on it would.
+ *
+ * Return value: -1
+ */
+static ssize_t write_closed(void* cookie, const char* buf, size_t size)
+{
+  errno = EBADF;
+  return -1;
+}
+
+/**
+ * Opens a stdio stream for a built-in's output.
+ *
+ * fd:
+ *   descriptor to write to, -1 if the redirections closed it
+ * buffered:
+ *         0 for a stream that writes every call right away
+ *
+ * Return value: the stream, NULL on error
+ */
+static FILE* open_builtin_stream(int fd, int buffered)
+{
+  static const cookie_io_functions_t closed = { NULL, write_closed, NULL,
+						 NULL };
+  FILE* f;
+
+  f = fd == -1 ? fopencookie(NULL, "w", closed)
+    : fdopen(fcntl(fd, F_DUPFD_CLOEXEC, 0), "w");
+  if(f && !buffered) setvbuf(f, NULL, _IONBF, 0);
+  return f;
+}
+
+/**
+ * Opens the redirections of a built-in that runs in
+ * the shell. Rather than moving the shell's own
+ * descriptors around, each redirection updates a map
+ * of where every descriptor it names points, and the
+ * built-in is handed fds 0, 1 and 2 of the result,
+ * and the others for any program it starts.
+ * Copies like 1>&5 look up the map, never the
+ * shell's own fds; a closed fd is -1, so the
+ * built-in's reads and writes on it fail with EBADF.
+ *
+ * run:
+ *    the built-in to set up, its io and opened fds are filled in
+ * in_fd:
+ *      file descriptor to use as stdin, -1 for the shell's
+ * out_fd:
+ *       file descriptor to use as stdout, -1 for the shell's
+ *
+ * Return value: 0 on success, -1 if a redirection failed
+ */
+static int open_builtin_io(struct builtin_run* run, int in_fd, int out_fd)
+{
+  struct command* cmd = run->cmd;
+  struct fd_slot* map = calloc(cmd->num_redirects + 3, sizeof(struct fd_slot));
+  struct fd_slot* slot;
+  int num = 3, i, fd;
+
+  map[0].fd = STDIN_FILENO;
+  map[0].target = in_fd != -1 ? in_fd : STDIN_FILENO;
+  map[1].fd = STDOUT_FILENO;
+  map[1].target = out_fd != -1 ? out_fd : STDOUT_FILENO;
+  map[2].fd = STDERR_FILENO;
+  map[2].target = STDERR_FILENO;
+  run->opened = calloc(cmd->num_redirects + 1, sizeof(int));
+  run->num_opened = 0;
+
+  for(i = 0; i < cmd->num_redirects; i++) {
+    struct redirect* r = &cmd->redirects[i];
+
+    switch(r->kind) {
+    case REDIRECT_OPEN:
+      if((fd = fdcache_get(r->path, r->flags)) == -1) {
+	if((fd = open(r->path, r->flags | O_CLOEXEC, REDIRECT_MODE)) == -1) {
+	  fprintf(stderr, "Error: Could not open %s: %s\n", r->path,
+		  strerror(errno));
+	  free(map);
+	  return -1;
+	}
+	run->opened[run->num_opened++] = fd;
       }
-    }
-    else {
-      if(chdir(getenv("HOME")) < 0) {
-	fprintf(stderr, "Error encountered while trying to change directories...\n");
+      break;
+    case REDIRECT_DUP:
+      if(!(slot = find_fd_slot(map, num, r->src_fd)) || slot->target == -1) {
+	fprintf(stderr, "Error: %d: bad file descriptor\n", r->src_fd);
+	free(map);
+	return -1;
       }
+      fd = slot->target;
+      break;
+    case REDIRECT_CLOSE:
+      fd = -1;
+      break;
+    default:
+      // here-documents and coprocesses, which the shell opened
+      fd = r->src_fd;
+      break;
+    }
+
+    if(!(slot = find_fd_slot(map, num, r->fd))) {
+      slot = &map[num++];
+      slot->fd = r->fd;
     }
-    break;
-  case 1:
-    if(chdir(getenv("HOME")) < 0) {
-      fprintf(stderr, "Error encountered while trying to change directories...\n");
-    }
-    break;
-  case 2:
-  case 3:
-    clr();
-    break;
-  case 4:
-  case 5:
-    environment_strings();
-    break;
-  case 6:
-  case 7:
-    help();
-    break;
-  case 8:
-  case 9:
-    pause_program();
-    break;
-  case 10:
-  case 11:
-    quit();
-    break;
-  default:
-    break;
+    slot->target = fd;
+  }
+
+  run->io.in_fd = map[0].target;
+  run->io.out_fd = map[1].target;
+  run->io.err_fd = map[2].target;
+  // the rest is passed on to programs the built-in starts
+  run->io.redirects = calloc(num, sizeof(struct redirect));
+  run->io.num_redirects = 0;
+  for(i = 3; i < num && run->io.redirects; i++) {
+    struct redirect* r = &run->io.redirects[run->io.num_redirects++];
+
+    r->kind = map[i].target == -1 ? REDIRECT_CLOSE : REDIRECT_DUP;
+    r->fd = map[i].fd;
+    r->src_fd = map[i].target;
+  }
+  free(map);
+
+  // the streams get descriptors of their own so closing
+  // them never closes a pipe end or a cached file
+  run->io.out = run->io.out_fd == STDOUT_FILENO ? stdout
+    : open_builtin_stream(run->io.out_fd, 1);
+  if(run->io.err_fd == STDERR_FILENO) run->io.err = stderr;
+  else if(run->io.err_fd == run->io.out_fd) run->io.err = run->io.out;
+  else run->io.err = open_builtin_stream(run->io.err_fd, 0);
+  if(!run->io.out || !run->io.err) {
+    fprintf(stderr, "Error: Could not set up the output of %s\n", cmd->argv[0]);
+    return -1;
   }
+  return 0;
 }
 
+/**
+ * Determines whether a built-in wrote to an output
+ * its redirections closed, which fails the built-in
+ * like a failed write would.
+ *
+ * Return value: 1 if true, 0 otherwise
+ */
+static int wrote_to_closed(struct builtin_run* run)
+{
+  return (run->io.out_fd == -1 && run->io.out &&
+	  (fflush(run->io.out) == EOF || ferror(run->io.out))) ||
+    (run->io.err_fd == -1 && run->io.err &&
+     (fflush(run->io.err) == EOF || ferror(run->io.err)));
+}
+
+/**
+ * Runs a built-in whose io is open and reports a
+ * write to a closed output.
+ *
+ * Return value: exit status of the built-in
+ */
+static int run_builtin_io(struct builtin_run* run)
+{
+  int status = run->b->run(run->cmd->argv, &run->io);
+
+  if(wrote_to_closed(run)) {
+    fprintf(stderr, "Error: %s: write error: %s\n", run->cmd->argv[0],
+	    strerror(EBADF));
+    if(status == 0) status = 1;
+  }
+  return status;
+}
+
+/**
+ * Flushes and closes everything open_builtin_io opened
+ * along with the pipe ends the built-in owns.
+ *
+ * Return value: void
+ */
+static void close_builtin_io(struct builtin_run* run)
+{
+  int i;
+
+  if(run->io.out && run->io.out != stdout) fclose(run->io.out);
+  else if(run->io.out) fflush(stdout);
+  if(run->io.err && run->io.err != stderr && run->io.err != run->io.out) {
+    fclose(run->io.err);
+  }
+  for(i = 0; i < run->num_opened; i++) {
+    close(run->opened[i]);
+  }
+  free(run->opened);
+  run->opened = NULL;
+  run->num_opened = 0;
+  free(run->io.redirects);
+  run->io.redirects = NULL;
+  run->io.num_redirects = 0;
+
+  if(run->pipe_in != -1) close(run->pipe_in);
+  if(run->pipe_out != -1) close(run->pipe_out);
+  run->pipe_in = run->pipe_out = -1;
+}
+
+/**
+ * Thread body of a built-in pipeline stage. Closing
+ * its pipe ends when done is what lets the next stage
+ * see the end of its input.
+ *
+ * arg:
+ *    the struct builtin_run of the stage
+ *
+ * Return value: NULL
+ */
+static void* run_built_in_stage(void* arg)
+{
+  struct builtin_run* run = arg;
+  sigset_t pipe_signal;
+
+  // a reader that went away must fail the write with
+  // EPIPE instead of taking down the whole shell
+  sigemptyset(&pipe_signal);
+  sigaddset(&pipe_signal, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe_signal, NULL);
+
+  run->status = run_builtin_io(run);
+  close_builtin_io(run);
+  return NULL;
+}
+
+/**
+ * Runs a built-in command in a forked child with the
+ * command's redirections applied there. Only used for
+ * built-ins that have to leave the shell untouched
+ * while sharing a pipeline with other commands, and
+ * for background pipelines. Functions and aliases
+ * that are part of a pipeline run the same way.
+ *
+ * b:
+ *  built-in to run, NULL for a function or alias
+ * cmd:
+ *    the parsed command
+ * in_fd:
+ *      file descriptor to use as stdin, -1 to inherit
+ * out_fd:
+ *       file descriptor to use as stdout, -1 to inherit
+ * pgid:
+ *     process group to put the child in, 0 for a new group
+ *     led by it, -1 to stay in the shell's
+ *
+ * Return value: process id of the child, -1 on error
+ */
+static pid_t fork_built_in(const struct builtin* b, struct command* cmd,
+			   int in_fd, int out_fd, pid_t pgid)
+{
+  struct builtin_io io = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+  pid_t pid;
+  int status;
+
+  fflush(stdout);
+  if((pid = fork()) < 0) {
+    printf("Error: Failed forking child...\n");
+    return -1;
+  }
+  // both sides set the group so neither can race the other
+  if(pgid != -1) setpgid(pid ? pid : 0, pgid);
+  if(pid == 0) {
+    if(cmd->cwd && chdir(cmd->cwd) == -1) {
+      fprintf(stderr, "Error: Could not enter %s\n", cmd->cwd);
+      _exit(1);
+    }
+    if(in_fd != -1) dup2(in_fd, STDIN_FILENO);
+    if(out_fd != -1) dup2(out_fd, STDOUT_FILENO);
+    if(apply_redirects(cmd) == -1) _exit(1);
+    coproc_close_all(cmd);
+
+    io.out = stdout;
+    io.err = stderr;
+    status = b ? b->run(cmd->argv, &io) : run_definition(cmd->argv);
+    fflush(stdout);
+    _exit(status);
+  }
+  return pid;
+}
+
+/**
+ * Executes any built-in command that the
+ * user entered. The built-in always runs right in
+ * the shell: its redirections are opened and handed
+ * to it, so the shell's own stdin and stdout stay
+ * untouched and no child is forked.
+ *
+ * cmd:
+ *    the parsed command entered in by the user
+ *
+ * Return value: void
+ */
+void execute_built_in_command(struct command* cmd)
+{
+  struct builtin_run run;
+  long id;
+
+  memset(&run, 0, sizeof(run));
+  run.b = find_built_in(cmd->argv[0]);
+  run.cmd = cmd;
+  run.pipe_in = run.pipe_out = -1;
+  if(!run.b) return;
+
+  id = audit_start(0, cmd->argv);
+  if(open_builtin_io(&run, -1, -1) == -1) {
+    last_exit_status = 1;
+  }
+  else {
+    last_exit_status = run_builtin_io(&run);
+  }
+  close_builtin_io(&run);
+  audit_exit(id, 0, last_exit_status);
+}
 /**
  * Executes any system commands that the
  * user entered.
  *
- * parsed_input:
- *             the commands and arguments entered in by the user
+ * cmd:
+ *    the parsed command entered in by the user
  * bg:
  *   1 if an & symbol was given, 0 otherwise
  *
  * Return value: void
  */
-void execute_unix_command(char** parsed_input, int bg)
+void execute_unix_command(struct command* cmd, int bg)
 {
-  pid_t pid = fork();
-  int status;
-  
-  if(pid < 0) { 
-    printf("Error: Failed forking child...\n"); 
-    return; 
-  }
-  else if(pid == 0) {
-    if(execvp(parsed_input[0], parsed_input) < 0) { 
+  struct rusage usage;
+  pid_t pid;
+  int status, err;
+  long id;
+
+  // anything still buffered would otherwise be written twice
+  fflush(stdout);
+
+  // nothing runs after this command, so skip the fork
+  if(exec_in_place && !bg) {
+    // its end cannot be logged, but its start has to be written
+    audit_start(0, cmd->argv);
+    audit_close();
+    if(apply_redirects(cmd) == 0) {
+      execvp(cmd->argv[0], cmd->argv);
       printf("Error: Could not execute command...\n");
-      return;
-    } 
+    }
+    fflush(stdout);
+    _exit(127);
+  }
+
+  if((err = spawn_command(cmd, -1, -1, -1, &pid)) != 0) {
+    printf("Error: Could not execute command %s: %s\n", cmd->argv[0],
+	   strerror(err));
+    last_exit_status = 127;
+    return;
+  }
+  id = audit_start(pid, cmd->argv);
+
+  // if there is an & symbol in input, return to command
+  // line immediately - only wait if bg = 0
+  if(!bg) {
+    wait_exit(pid);
+    while(wait4(pid, &status, 0, &usage) == -1 && errno == EINTR);
+    last_exit_status = shell_status(status);
+    audit_exit(id, pid, last_exit_status);
+    stats_reaped(pid, last_exit_status, &usage);
   }
   else {
-    // if there is an & symbol in input, return to command
-    // line immediately - only wait if bg = 0
-    if(!bg) wait(NULL);
-    else {
-      // if process is supposed to be run in background,
-      // wait for process to finish but still continue to execute
-      // other commands in foreground
-      waitpid(-1, &status, WNOHANG);
+    // if process is supposed to be run in background,
+    // track it so it is reaped once it finishes, while
+    // other commands continue to execute in foreground
+    track_child(pid);
+    reap_children();
+  }
+}
+
+/**
+ * Starts a built-in pipeline stage on a thread of its
+ * own. On success the thread owns in_fd and out_fd.
+ *
+ * run:
+ *    the stage, with b and cmd filled in
+ * in_fd:
+ *      read end of the previous pipe, -1 for the shell's stdin
+ * out_fd:
+ *       write end of the next pipe, -1 for the shell's stdout
+ *
+ * Return value: 0 if the thread started, -1 otherwise
+ */
+static int start_built_in_stage(struct builtin_run* run, int in_fd, int out_fd)
+{
+  run->pipe_in = run->pipe_out = -1;
+  if(open_builtin_io(run, in_fd, out_fd) == -1) {
+    close_builtin_io(run);
+    return -1;
+  }
+  run->pipe_in = in_fd;
+  run->pipe_out = out_fd;
+  if(pthread_create(&run->thread, NULL, run_built_in_stage, run) != 0) {
+    run->pipe_in = run->pipe_out = -1;
+    close_builtin_io(run);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Starts every stage of a background pipeline and
+ * tracks the processes, without waiting for them.
+ * Built-in stages run in forked children here.
+ *
+ * p:
+ *  the parsed pipeline
+ * pids:
+ *     if not NULL, set to the process ids of the stages
+ *
+ * Return value: number of processes started
+ */
+int start_background(struct pipeline* p, pid_t* pids)
+{
+  int prev_read = -1, started = 0;
+  int i, err;
+
+  fflush(stdout);
+  for(i = 0; i < p->num_commands; i++) {
+    struct command* cmd = &p->commands[i];
+    const struct builtin* b;
+    // 0 read, 1 write
+    int pipefd[2] = { -1, -1 };
+    pid_t pid = -1;
+
+    if(i < p->num_commands - 1 && pipe2(pipefd, O_CLOEXEC) < 0) {
+      printf("Error: Pipe could not be initialized\n");
+      break;
+    }
+    if(pipefd[1] != -1) {
+      size_pipe(pipefd[1], p->pipe_size ? p->pipe_size : options.pipesize);
+    }
+
+    if(cmd->argc == 0) {
+      // nothing to run
+    }
+    else if((b = find_built_in(cmd->argv[0])) ||
+	    is_definition(cmd->argv[0])) {
+      pid = fork_built_in(b, cmd, prev_read, pipefd[1], -1);
+    }
+    else if((err = spawn_command(cmd, prev_read, pipefd[1], -1, &pid)) != 0) {
+      printf("Error: Could not execute command %s: %s\n", cmd->argv[0],
+	     strerror(err));
+      pid = -1;
+    }
+    if(pid > 0) {
+      // track the child so it is reaped once it finishes, while
+      // other commands continue to execute in foreground
+      track_child(pid);
+      audit_start(pid, cmd->argv);
+      if(pids) pids[started] = pid;
+      started++;
     }
-    return; 
-  } 
+
+    if(prev_read != -1) close(prev_read);
+    if(pipefd[1] != -1) close(pipefd[1]);
+    prev_read = pipefd[0];
+  }
+  if(prev_read != -1) close(prev_read);
+  return started;
 }
 
 /**
- * Executes any system command line input that separated by pipes.
+ * Executes a pipeline of any number of commands,
+ * connecting each command's stdout to the next
+ * command's stdin. Every system command's
+ * redirections are applied after its pipe ends, in
+ * its own process. Built-in stages of a foreground
+ * pipeline run on threads of the shell, so a stage
+ * like "environ | grep PATH" costs no fork.
  *
- * parsed1:
- *        the left side of the pipe
- * parsed2:
- *        the right side of the pipe
- * bg:
- *   1 if an & symbol was given, 0 otherwise
+ * A pipeline with a deadline, from a timeout prefix
+ * or "set timeout", runs as a job in a process group
+ * of its own with every stage in a process, so the
+ * whole job can be signalled when time runs out.
+ * Only built-ins that change the shell itself, like
+ * cd and set, have no deadline.
+ *
+ * p:
+ *  the parsed pipeline
  *
  * Return value: void
  */
-void execute_pipe(char** parsed1, char** parsed2, int bg)
+void execute_pipeline(struct pipeline* p)
 {
-  // 0 read, 1 write
-  int pipefd[2];  
-  pid_t p1, p2;
-  int status;
-  
-  if(pipe(pipefd) < 0) { 
-    printf("Error: Pipe could not be initialized\n"); 
-    return; 
+  struct builtin_run* threads;
+  pid_t* pids;
+  int* statuses;
+  long timeout_ms = 0, kill_after_ms = TIMEOUT_KILL_AFTER_MS;
+  pid_t pgid = -1;
+  int prev_read = -1, gave_terminal = 0;
+  int i, err, status = 127, priority = 0, defined = 0;
+
+  if(strip_pipeline_prefixes(p, &priority) == -1) {
+    last_exit_status = 2;
+    return;
   }
-  
-  p1 = fork(); 
-  if(p1 < 0) { 
-    printf("Error: Could not fork\n"); 
-    return; 
-  } 
-  
-  if(p1 == 0) { 
-    // child 1 executing...
-    // only needs to write at write end 
-    close(pipefd[0]); 
-    dup2(pipefd[1], STDOUT_FILENO); 
-    close(pipefd[1]); 
-    
-    if(execvp(parsed1[0], parsed1) < 0) { 
-      printf("Error: Could not execute command 1...\n"); 
+  if(resolve_coprocs(p) == -1) {
+    last_exit_status = 1;
+    return;
+  }
+  for(i = 0; i < p->num_commands; i++) {
+    if(strip_timeout(&p->commands[i], &timeout_ms, &kill_after_ms) == -1) {
+      fputs(TIMEOUT_USAGE, stderr);
+      last_exit_status = TIMEOUT_USAGE_STATUS;
       return;
-    } 
-  }
-  else { 
-    // parent executing...
-    p2 = fork(); 
-    
-    if(p2 < 0) { 
-      printf("Error: Could not fork\n"); 
-      return; 
-    } 
-    
-    // child 2 executing... 
-    // only needs to read at read end 
-    if (p2 == 0) { 
-      close(pipefd[1]); 
-      dup2(pipefd[0], STDIN_FILENO); 
-      close(pipefd[0]); 
-      if(execvp(parsed2[0], parsed2) < 0) { 
-	printf("Error: Could not execute command 2...\n"); 
+    }
+  }
+  if(!timeout_ms && !p->bg) timeout_ms = options.timeout * 1000L;
+  if(timeout_ms && p->bg) {
+    fprintf(stderr, "timeout: only foreground jobs can have a deadline\n");
+    timeout_ms = 0;
+  }
+
+  if(p->num_commands == 1) {
+    struct command* cmd = &p->commands[0];
+    const struct builtin* b = cmd->argc ? find_built_in(cmd->argv[0]) : NULL;
+
+    if(cmd->argc == 0) {
+      // only redirections, which are opened for their side effects
+      pid_t pid = fork();
+      if(pid == 0) _exit(apply_redirects(cmd) == -1);
+      if(pid > 0) last_exit_status = wait_child(pid);
+      return;
+    }
+    // built-ins only leave the shell to get a deadline
+    if(b && (b->in_shell || !timeout_ms)) {
+      execute_built_in_command(cmd);
+      return;
+    }
+    // so do functions and aliases, unless redirected
+    if(!b && is_definition(cmd->argv[0])) {
+      if(!p->bg && !timeout_ms && !cmd->num_redirects) {
+	long id = audit_start(0, cmd->argv);
+
+	last_exit_status = run_definition(cmd->argv);
+	audit_exit(id, 0, last_exit_status);
 	return;
-      } 
-    }
-    else { 
-      // parent executing, waiting for two children 
-      if(!bg) {
-        close(pipefd[0]);
-        close(pipefd[1]);
-        waitpid(p1, &status, 0);
-	waitpid(p2, &status, 0);
+      }
+      defined = 1;
+    }
+  }
+
+  if(p->bg) {
+    // background jobs wait their turn when a job limit is set
+    if(jobsched_submit(p, priority) == -1) start_background(p, NULL);
+    reap_children();
+    return;
+  }
+  if(p->num_commands == 1 && !timeout_ms && !defined) {
+    execute_unix_command(&p->commands[0], 0);
+    return;
+  }
+
+  pids = calloc(p->num_commands, sizeof(pid_t));
+  statuses = calloc(p->num_commands, sizeof(int));
+  threads = calloc(p->num_commands, sizeof(struct builtin_run));
+  fflush(stdout);
+  if(timeout_ms) pgid = 0;
+
+  for(i = 0; i < p->num_commands; i++) {
+    struct command* cmd = &p->commands[i];
+    const struct builtin* b;
+    // 0 read, 1 write
+    int pipefd[2] = { -1, -1 };
+
+    if(i < p->num_commands - 1 && pipe2(pipefd, O_CLOEXEC) < 0) {
+      printf("Error: Pipe could not be initialized\n");
+      pids[i] = -1;
+      break;
+    }
+    if(pipefd[1] != -1) {
+      size_pipe(pipefd[1], p->pipe_size ? p->pipe_size : options.pipesize);
+    }
+
+    pids[i] = -1;
+    if(cmd->argc == 0) {
+      // nothing to run
+    }
+    else if((b = find_built_in(cmd->argv[0])) && !b->in_shell && !timeout_ms) {
+      threads[i].b = b;
+      threads[i].cmd = cmd;
+      if(start_built_in_stage(&threads[i], prev_read, pipefd[1]) == 0) {
+	threads[i].audit_id = audit_start(0, cmd->argv);
+	// the thread closes these once the built-in is done
+	prev_read = pipefd[1] = -1;
       }
       else {
-	waitpid(-1, &status, WNOHANG);
-	waitpid(-1, &status, WNOHANG);
+	threads[i].b = NULL;
       }
-    } 
-  } 
-}
+    }
+    else if(b || is_definition(cmd->argv[0])) {
+      pids[i] = fork_built_in(b, cmd, prev_read, pipefd[1], pgid);
+    }
+    else if((err = spawn_command(cmd, prev_read, pipefd[1], pgid,
+				 &pids[i])) != 0) {
+      printf("Error: Could not execute command %s: %s\n", cmd->argv[0],
+	     strerror(err));
+      pids[i] = -1;
+    }
 
+    if(pids[i] > 0) audit_start(pids[i], cmd->argv);
 
+    // the first process started leads the job's group
+    if(pgid == 0 && pids[i] > 0) {
+      pgid = pids[i];
+      gave_terminal = give_terminal(pgid);
+    }
+
+    // the children hold their own copies of the pipe ends
+    if(prev_read != -1) close(prev_read);
+    if(pipefd[1] != -1) close(pipefd[1]);
+    prev_read = pipefd[0];
+  }
+  if(prev_read != -1) close(prev_read);
+
+  if(timeout_ms && pgid > 0 &&
+     wait_job(pids, p->num_commands, pgid, timeout_ms, kill_after_ms,
+	      statuses)) {
+    status = TIMEOUT_STATUS;
+  }
+  else {
+    for(i = 0; i < p->num_commands; i++) {
+      if(threads[i].b) {
+	pthread_join(threads[i].thread, NULL);
+	status = threads[i].status;
+	audit_exit(threads[i].audit_id, 0, status);
+      }
+      else if(pids[i] <= 0) {
+	status = 127;
+      }
+      else if(timeout_ms) {
+	status = statuses[i];
+      }
+      else {
+	status = wait_child(pids[i]);
+      }
+    }
+  }
+  if(gave_terminal) take_terminal();
+
+  last_exit_status = status;
+  free(threads);
+  free(statuses);
+  free(pids);
+}
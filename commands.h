@@ -12,6 +12,26 @@
 #ifndef COMMANDS_H
  # define COMMANDS_H
 
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "command.h"
+
+/**
+ * Exit status of the last foreground command,
+ * following the usual shell convention of
+ * 128 + signal number for killed commands.
+ */
+extern int last_exit_status;
+
+/**
+ * When set, a foreground system command replaces
+ * the shell with execvp instead of running in a
+ * forked child. Used by -c when the command line
+ * holds a single command, so nothing runs after it.
+ */
+extern int exec_in_place;
+
 /**
  * Clears the screen. 
  * One could also use the clear system
@@ -21,42 +41,75 @@
  */
 void clr();
 
+/**
+ * Determines whether command names one of
+ * the shell's built-in commands.
+ *
+ * command:
+ *        command to check
+ *
+ * Return value: 1 if built-in, 0 otherwise
+ */
+int is_built_in(char* command);
+
+/**
+ * Names the built-in commands one at a time, in
+ * the order they are registered.
+ *
+ * i:
+ *  index of the built-in
+ *
+ * Return value: name of built-in i, NULL past the last one
+ */
+const char* built_in_name(size_t i);
+
 /**
  * Executes any built-in command that the
  * user entered. 
  *
- * parsed_input:
- *             the commands and arguments entered in by the user
+ * cmd:
+ *    the parsed command entered in by the user
  *
  * Return value: void
  */
-void execute_built_in_command(char** parsed_input);
+void execute_built_in_command(struct command* cmd);
 
 /**
  * Executes any system commands that the
  * user entered.
  *
- * parsed_input:
- *             the commands and arguments entered in by the user
+ * cmd:
+ *    the parsed command entered in by the user
  * bg:
  *   1 if an & symbol was given, 0 otherwise
  *
  * Return value: void
  */
-void execute_unix_command(char** parsed_input, int bg);
+void execute_unix_command(struct command* cmd, int bg);
 
 /**
- * Executes any system command line input that separated by pipes.
+ * Starts every stage of a background pipeline and
+ * tracks the processes, without waiting for them.
  *
- * parsed1:
- *        the left side of the pipe
- * parsed2:
- *        the right side of the pipe
- * bg:
- *   1 if an & symbol was given, 0 otherwise
+ * p:
+ *  the parsed pipeline
+ * pids:
+ *     if not NULL, set to the process ids of the stages
+ *
+ * Return value: number of processes started
+ */
+int start_background(struct pipeline* p, pid_t* pids);
+
+/**
+ * Executes a pipeline of any number of commands,
+ * connecting each command's stdout to the next
+ * command's stdin.
+ *
+ * p:
+ *  the parsed pipeline
  *
  * Return value: void
  */
-void execute_pipe(char** parsed1, char** parsed2, int bg);
+void execute_pipeline(struct pipeline* p);
 
 #endif
@@ -0,0 +1,399 @@
+/**
+ * This C file contains the completion of command
+ * names and file names for the line editor.
+ *
+ * Executables found in PATH are kept in one sorted
+ * array of names, so a prefix lookup is a binary
+ * search. A background thread builds the array once
+ * and then waits on inotify; when a PATH directory
+ * changes only that directory is read again and a new
+ * array is swapped in under the lock.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "complete.h"
+#include "commands.h"
+
+// changes that make a PATH directory worth reading again
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+		      IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+// quiet time that ends a burst of changes, such as a package install
+#define SETTLE_MS 100
+
+/**
+ * Executable names found in one PATH directory.
+ */
+struct path_dir {
+  char* path;
+  int wd;
+  char** names;
+  size_t count;
+  int changed;
+};
+
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t index_ready = PTHREAD_COND_INITIALIZER;
+static int index_started = 0;
+static int index_built = 0;
+
+// sorted, unique names pointing into the path_dir lists
+static char** index_names = NULL;
+static size_t index_count = 0;
+static struct path_dir* dirs = NULL;
+static size_t num_dirs = 0;
+
+/**
+ * Appends a copy of item to the candidates.
+ *
+ * Return value: void
+ */
+static void add_completion(struct completions* c, const char* item)
+{
+  if(c->count == c->cap) {
+    c->cap = c->cap ? c->cap * 2 : 16;
+    c->items = realloc(c->items, sizeof(char*) * c->cap);
+  }
+  c->items[c->count++] = strdup(item);
+}
+
+/**
+ * Frees the candidates found by complete_word.
+ *
+ * Return value: void
+ */
+void free_completions(struct completions* c)
+{
+  size_t i;
+
+  for(i = 0; i < c->count; i++) {
+    free(c->items[i]);
+  }
+  free(c->items);
+  memset(c, 0, sizeof(*c));
+}
+
+/**
+ * qsort comparison of two strings.
+ *
+ * Return value: <0, 0 or >0 like strcmp
+ */
+static int compare_names(const void* a, const void* b)
+{
+  return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/**
+ * Reads the executable names of one PATH directory.
+ * Only entries whose type is not already known from
+ * the directory listing cost a stat.
+ *
+ * Return value: void
+ */
+static void scan_dir(struct path_dir* d)
+{
+  DIR* dir = opendir(d->path);
+  struct dirent* entry;
+  size_t cap = 0;
+
+  d->names = NULL;
+  d->count = 0;
+  if(!dir) return;
+
+  while((entry = readdir(dir))) {
+    struct stat st;
+
+    if(entry->d_name[0] == '.' || entry->d_type == DT_DIR) continue;
+    if(entry->d_type != DT_REG &&
+       (fstatat(dirfd(dir), entry->d_name, &st, 0) == -1 ||
+	!S_ISREG(st.st_mode))) {
+      continue;
+    }
+    if(faccessat(dirfd(dir), entry->d_name, X_OK, AT_EACCESS) == -1) continue;
+
+    if(d->count == cap) {
+      cap = cap ? cap * 2 : 256;
+      d->names = realloc(d->names, sizeof(char*) * cap);
+    }
+    d->names[d->count++] = strdup(entry->d_name);
+  }
+  closedir(dir);
+}
+
+/**
+ * Frees the names of one directory.
+ *
+ * Return value: void
+ */
+static void free_names(char** names, size_t count)
+{
+  size_t i;
+
+  for(i = 0; i < count; i++) {
+    free(names[i]);
+  }
+  free(names);
+}
+
+/**
+ * Rescans the directories marked changed and swaps in
+ * a new index built from every directory's names.
+ * Readers only ever see a complete index.
+ *
+ * Return value: void
+ */
+static void rebuild_index()
+{
+  struct path_dir* fresh = calloc(num_dirs, sizeof(struct path_dir));
+  char** merged;
+  size_t i, j, total = 0, unique = 0;
+
+  // the old lists stay in place for readers until the swap
+  for(i = 0; i < num_dirs; i++) {
+    fresh[i] = dirs[i];
+    if(dirs[i].changed) scan_dir(&fresh[i]);
+    fresh[i].changed = 0;
+    total += fresh[i].count;
+  }
+
+  merged = malloc(sizeof(char*) * (total ? total : 1));
+  for(i = 0; i < num_dirs; i++) {
+    for(j = 0; j < fresh[i].count; j++) {
+      merged[unique++] = fresh[i].names[j];
+    }
+  }
+  qsort(merged, unique, sizeof(char*), compare_names);
+  for(i = j = 0; i < unique; i++) {
+    if(j == 0 || strcmp(merged[j - 1], merged[i]) != 0) merged[j++] = merged[i];
+  }
+  unique = j;
+
+  pthread_mutex_lock(&index_lock);
+  free(index_names);
+  index_names = merged;
+  index_count = unique;
+  for(i = 0; i < num_dirs; i++) {
+    if(dirs[i].changed) free_names(dirs[i].names, dirs[i].count);
+  }
+  free(dirs);
+  dirs = fresh;
+  index_built = 1;
+  pthread_cond_broadcast(&index_ready);
+  pthread_mutex_unlock(&index_lock);
+}
+
+/**
+ * Body of the index thread. Builds the index, then
+ * waits for changes to the PATH directories; events
+ * arriving within SETTLE_MS of each other are handled
+ * with one rebuild.
+ *
+ * arg:
+ *    the PATH value, which the thread frees
+ *
+ * Return value: NULL
+ */
+static void* index_thread(void* arg)
+{
+  char* path = arg;
+  char* save = NULL;
+  char* part;
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  int fd = inotify_init1(IN_CLOEXEC);
+  size_t i;
+
+  for(part = strtok_r(path, ":", &save); part;
+      part = strtok_r(NULL, ":", &save)) {
+    dirs = realloc(dirs, sizeof(struct path_dir) * (num_dirs + 1));
+    dirs[num_dirs].path = strdup(part);
+    dirs[num_dirs].wd = fd == -1 ? -1
+      : inotify_add_watch(fd, part, WATCH_EVENTS);
+    dirs[num_dirs].names = NULL;
+    dirs[num_dirs].count = 0;
+    dirs[num_dirs].changed = 1;
+    num_dirs++;
+  }
+  free(path);
+  rebuild_index();
+  if(fd == -1) return NULL;
+
+  while(1) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int changes = 0;
+
+    // block for the first event, then gather the rest of the burst
+    while(poll(&pfd, 1, changes ? SETTLE_MS : -1) > 0) {
+      ssize_t n = read(fd, events, sizeof(events));
+      char* p;
+
+      if(n <= 0) break;
+      for(p = events; p < events + n;
+	  p += sizeof(struct inotify_event) + ((struct inotify_event*) p)->len) {
+	struct inotify_event* ev = (struct inotify_event*) p;
+	for(i = 0; i < num_dirs; i++) {
+	  if(dirs[i].wd == ev->wd) dirs[i].changed = changes = 1;
+	}
+      }
+    }
+    if(changes) rebuild_index();
+  }
+  return NULL;
+}
+
+/**
+ * Starts the thread that indexes the executables in
+ * the PATH directories and watches them for changes.
+ *
+ * Return value: void
+ */
+void complete_start()
+{
+  const char* path = getenv("PATH");
+  pthread_t thread;
+  char* copy;
+
+  if(index_started || !path) return;
+  if(!(copy = strdup(path))) return;
+
+  index_started = 1;
+  if(pthread_create(&thread, NULL, index_thread, copy) != 0) {
+    free(copy);
+    index_started = 0;
+    return;
+  }
+  pthread_detach(thread);
+}
+
+/**
+ * Adds the built-ins and indexed executables that
+ * start with prefix.
+ *
+ * Return value: void
+ */
+static void complete_command(const char* prefix, size_t len,
+			     struct completions* out)
+{
+  const char* name;
+  size_t lo = 0, hi, i;
+
+  for(i = 0; (name = built_in_name(i)); i++) {
+    if(strncmp(name, prefix, len) == 0) add_completion(out, name);
+  }
+
+  if(!index_started) return;
+  pthread_mutex_lock(&index_lock);
+  while(!index_built) {
+    pthread_cond_wait(&index_ready, &index_lock);
+  }
+
+  // first name not sorting before the prefix
+  hi = index_count;
+  while(lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if(strncmp(index_names[mid], prefix, len) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  for(i = lo; i < index_count && strncmp(index_names[i], prefix, len) == 0;
+      i++) {
+    add_completion(out, index_names[i]);
+  }
+  pthread_mutex_unlock(&index_lock);
+}
+
+/**
+ * Adds the file names that complete word, which may
+ * hold a directory part.
+ *
+ * Return value: void
+ */
+static void complete_path(const char* word, size_t len,
+			  struct completions* out)
+{
+  const char* slash = memrchr(word, '/', len);
+  size_t dir_len = slash ? (size_t) (slash - word) + 1 : 0;
+  const char* base = word + dir_len;
+  size_t base_len = len - dir_len;
+  char* dir_path = dir_len ? strndup(word, dir_len) : strdup(".");
+  DIR* dir = opendir(dir_path);
+  struct dirent* entry;
+
+  free(dir_path);
+  if(!dir) return;
+
+  while((entry = readdir(dir))) {
+    struct stat st;
+    char* item;
+    int is_dir;
+
+    if(strncmp(entry->d_name, base, base_len) != 0) continue;
+    // hidden names and . and .. only when asked for
+    if(entry->d_name[0] == '.' && base_len == 0) continue;
+    if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+
+    is_dir = entry->d_type == DT_DIR;
+    if(entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+      is_dir = fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 &&
+	S_ISDIR(st.st_mode);
+    }
+    if(asprintf(&item, "%.*s%s%s", (int) dir_len, word, entry->d_name,
+		is_dir ? "/" : "") == -1) {
+      continue;
+    }
+    add_completion(out, item);
+    free(item);
+  }
+  closedir(dir);
+}
+
+/**
+ * Finds the completions of the word between start and
+ * end of line. The word is a command name when it is
+ * the first word of a command and holds no '/'.
+ *
+ * Return value: number of candidates
+ */
+size_t complete_word(const char* line, size_t start, size_t end,
+		     struct completions* out)
+{
+  const char* word = line + start;
+  size_t len = end - start;
+  size_t i = start;
+  size_t j, unique = 0;
+
+  memset(out, 0, sizeof(*out));
+
+  // the command word follows the start of the line or an operator
+  while(i > 0 && (line[i - 1] == ' ' || line[i - 1] == '\t')) i--;
+  if((i == 0 || strchr("|;&(", line[i - 1])) && !memchr(word, '/', len)) {
+    complete_command(word, len, out);
+  }
+  else {
+    complete_path(word, len, out);
+  }
+
+  // built-ins may also exist in PATH
+  qsort(out->items, out->count, sizeof(char*), compare_names);
+  for(j = 0; j < out->count; j++) {
+    if(unique && strcmp(out->items[unique - 1], out->items[j]) == 0) {
+      free(out->items[j]);
+    }
+    else {
+      out->items[unique++] = out->items[j];
+    }
+  }
+  out->count = unique;
+  return unique;
+}
@@ -0,0 +1,61 @@
+/**
+ * This is the header class for complete.c
+ *
+ * These methods find the completions of a word on the
+ * command line: built-ins and executables from PATH
+ * for the command word, file names everywhere else.
+ * Executables come from an index built once in the
+ * background and kept current with inotify, so PATH
+ * is never scanned while the user is typing.
+ */
+
+#ifndef COMPLETE_H
+# define COMPLETE_H
+
+#include <stddef.h>
+
+/**
+ * Candidates for one word. Every item replaces the
+ * whole word; directories end with a '/'.
+ */
+struct completions {
+  char** items;
+  size_t count;
+  size_t cap;
+};
+
+/**
+ * Starts the thread that indexes the executables in
+ * the PATH directories and watches them for changes.
+ *
+ * Return value: void
+ */
+void complete_start();
+
+/**
+ * Finds the completions of the word between start and
+ * end of line. The word is a command name when it is
+ * the first word of a command and holds no '/'.
+ *
+ * line:
+ *     the whole command line
+ * start:
+ *      offset of the first character of the word
+ * end:
+ *    offset just past the word
+ * out:
+ *    filled in with the sorted candidates
+ *
+ * Return value: number of candidates
+ */
+size_t complete_word(const char* line, size_t start, size_t end,
+		     struct completions* out);
+
+/**
+ * Frees the candidates found by complete_word.
+ *
+ * Return value: void
+ */
+void free_completions(struct completions* c);
+
+#endif
@@ -0,0 +1,383 @@
+/**
+ * This C file contains the table of coprocesses. The
+ * shell keeps the write end of a pipe to each one's
+ * input and the read end of a pipe from its output,
+ * moved up to fd COPROC_MIN_FD or above so they stay
+ * out of the way of redirections like 3>file. Both
+ * are close-on-exec, and forked children that run
+ * shell code close them too, so only commands that
+ * name the coprocess in a redirection get a copy.
+ *
+ * Each coprocess is watched through a pidfd. The
+ * process itself is tracked and reaped in jobs.c with
+ * the background jobs; the table only notices that it
+ * is gone, the next time the table is used.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "coproc.h"
+#include "jobs.h"
+#include "redirect.h"
+
+// lowest descriptor the shell keeps a coprocess pipe at
+#define COPROC_MIN_FD 10
+
+#define COPROC_USAGE "usage: coproc NAME command [args] | coproc -c NAME\n"
+
+struct coproc {
+  char* name;
+  pid_t pid;
+  // readable once the process has exited, -1 if unavailable
+  int pidfd;
+  // the shell writes its input here, -1 once closed
+  int to_fd;
+  // and reads its output here
+  int from_fd;
+  int exited;
+};
+
+// only the shell's main thread runs coproc and resolves
+// redirections, so the table needs no lock
+static struct coproc* coprocs = NULL;
+static int num_coprocs = 0;
+static int cap_coprocs = 0;
+
+/**
+ * Marks coprocesses that have exited and closes their
+ * input, which nothing reads any more.
+ *
+ * Return value: void
+ */
+static void check_coprocs()
+{
+  struct pollfd pfd = { -1, POLLIN, 0 };
+  int i;
+
+  for(i = 0; i < num_coprocs; i++) {
+    struct coproc* co = &coprocs[i];
+
+    if(co->exited) continue;
+    if(co->pidfd != -1) {
+      pfd.fd = co->pidfd;
+      co->exited = poll(&pfd, 1, 0) == 1;
+    }
+    else {
+      co->exited = kill(co->pid, 0) == -1;
+    }
+    if(co->exited && co->to_fd != -1) {
+      close(co->to_fd);
+      co->to_fd = -1;
+    }
+  }
+}
+
+/**
+ * Looks a coprocess up by name.
+ *
+ * Return value: the coprocess, NULL if there is none
+ */
+static struct coproc* find_coproc(const char* name)
+{
+  int i;
+
+  for(i = 0; i < num_coprocs; i++) {
+    if(strcmp(coprocs[i].name, name) == 0) return &coprocs[i];
+  }
+  return NULL;
+}
+
+/**
+ * Closes everything the shell holds for a coprocess
+ * and takes it out of the table.
+ *
+ * Return value: void
+ */
+static void drop_coproc(struct coproc* co)
+{
+  if(co->to_fd != -1) close(co->to_fd);
+  close(co->from_fd);
+  if(co->pidfd != -1) close(co->pidfd);
+  free(co->name);
+  *co = coprocs[--num_coprocs];
+}
+
+/**
+ * Determines whether a word can name a coprocess:
+ * a letter or '_' followed by letters, digits or '_'.
+ *
+ * Return value: 1 if true, 0 otherwise
+ */
+static int is_name(const char* word)
+{
+  if(!isalpha((unsigned char) *word) && *word != '_') return 0;
+  for(word++; *word; word++) {
+    if(!isalnum((unsigned char) *word) && *word != '_') return 0;
+  }
+  return 1;
+}
+
+/**
+ * Moves a descriptor up to COPROC_MIN_FD or above,
+ * keeping it close-on-exec.
+ *
+ * Return value: the new descriptor, -1 on error
+ */
+static int move_up(int fd)
+{
+  int high = fcntl(fd, F_DUPFD_CLOEXEC, COPROC_MIN_FD);
+
+  close(fd);
+  return high;
+}
+
+/**
+ * Starts a program as a coprocess and adds it to the
+ * table.
+ *
+ * Return value: 0 on success, 1 on error
+ */
+static int start_coproc(const char* name, char** argv, struct builtin_io* io)
+{
+  struct command cmd;
+  struct redirect err;
+  struct coproc co;
+  // 0 read, 1 write
+  int to[2], from[2], status;
+
+  if(pipe2(to, O_CLOEXEC) == -1) {
+    fprintf(io->err, "coproc: %s\n", strerror(errno));
+    return 1;
+  }
+  if(pipe2(from, O_CLOEXEC) == -1) {
+    fprintf(io->err, "coproc: %s\n", strerror(errno));
+    close(to[0]);
+    close(to[1]);
+    return 1;
+  }
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.argv = argv;
+  // errors of the coprocess go where those of coproc went
+  if(io->err_fd != STDERR_FILENO) {
+    err.kind = REDIRECT_DUP;
+    err.fd = STDERR_FILENO;
+    err.src_fd = io->err_fd;
+    err.flags = 0;
+    err.path = NULL;
+    cmd.redirects = &err;
+    cmd.num_redirects = 1;
+  }
+
+  fflush(io->out);
+  status = spawn_command(&cmd, to[0], from[1], -1, &co.pid);
+  close(to[0]);
+  close(from[1]);
+  if(status != 0) {
+    fprintf(io->err, "Error: Could not execute command %s: %s\n", argv[0],
+	    strerror(status));
+    close(to[1]);
+    close(from[0]);
+    return 1;
+  }
+  track_child(co.pid);
+
+  co.name = strdup(name);
+  co.pidfd = syscall(SYS_pidfd_open, co.pid, 0);
+  co.to_fd = move_up(to[1]);
+  co.from_fd = move_up(from[0]);
+  co.exited = 0;
+
+  if(num_coprocs == cap_coprocs) {
+    cap_coprocs = cap_coprocs ? cap_coprocs * 2 : 4;
+    coprocs = realloc(coprocs, sizeof(struct coproc) * cap_coprocs);
+    if(!coprocs) {
+      fprintf(stderr, "Error: Out of memory while tracking coprocesses\n");
+      exit(1);
+    }
+  }
+  coprocs[num_coprocs++] = co;
+  return 0;
+}
+
+/**
+ * The coproc built-in.
+ *
+ * Return value: 0 on success, 1 on error, 2 on a usage error
+ */
+int coproc_command(char** parsed_input, struct builtin_io* io)
+{
+  struct coproc* co;
+  int i;
+
+  check_coprocs();
+
+  if(!parsed_input[1]) {
+    for(i = 0; i < num_coprocs; i++) {
+      co = &coprocs[i];
+      fprintf(io->out, "%s: pid %d, output on fd %d", co->name, co->pid,
+	      co->from_fd);
+      if(co->to_fd != -1) fprintf(io->out, ", input on fd %d", co->to_fd);
+      fputs(co->exited ? ", done\n" : "\n", io->out);
+    }
+    return 0;
+  }
+
+  if(strcmp(parsed_input[1], "-c") == 0) {
+    if(!parsed_input[2] || parsed_input[3]) {
+      fputs(COPROC_USAGE, io->err);
+      return 2;
+    }
+    if(!(co = find_coproc(parsed_input[2]))) {
+      fprintf(io->err, "coproc: %s: no such coprocess\n", parsed_input[2]);
+      return 1;
+    }
+    // a coprocess that is done is forgotten, output and all
+    if(co->exited) drop_coproc(co);
+    else if(co->to_fd != -1) {
+      close(co->to_fd);
+      co->to_fd = -1;
+    }
+    return 0;
+  }
+
+  if(!parsed_input[2] || !is_name(parsed_input[1])) {
+    fputs(COPROC_USAGE, io->err);
+    return 2;
+  }
+  if((co = find_coproc(parsed_input[1]))) {
+    if(!co->exited) {
+      fprintf(io->err, "coproc: %s is still running\n", parsed_input[1]);
+      return 1;
+    }
+    drop_coproc(co);
+  }
+  return start_coproc(parsed_input[1], parsed_input + 2, io);
+}
+
+/**
+ * Adds a copy of fd 1 onto fd 2 right after
+ * redirection i of cmd.
+ *
+ * Return value: void
+ */
+static void insert_stderr_dup(struct command* cmd, int i)
+{
+  struct redirect* r;
+
+  cmd->redirects = realloc(cmd->redirects,
+			   sizeof(struct redirect) * (cmd->num_redirects + 1));
+  r = &cmd->redirects[i + 1];
+  memmove(r + 1, r, sizeof(struct redirect) * (cmd->num_redirects - i - 1));
+  cmd->num_redirects++;
+
+  r->kind = REDIRECT_DUP;
+  r->fd = STDERR_FILENO;
+  r->src_fd = STDOUT_FILENO;
+  r->flags = 0;
+  r->path = NULL;
+}
+
+/**
+ * Fills in the shell's descriptors for the coprocess
+ * redirections of a pipeline.
+ *
+ * p:
+ *  the parsed pipeline, changed in place
+ *
+ * Return value: 0 on success, -1 after printing an error
+ */
+int resolve_coprocs(struct pipeline* p)
+{
+  struct coproc* co;
+  int checked = 0, i, j, fd;
+
+  for(i = 0; i < p->num_commands; i++) {
+    struct command* cmd = &p->commands[i];
+
+    for(j = 0; j < cmd->num_redirects; j++) {
+      struct redirect* r = &cmd->redirects[j];
+
+      if(r->kind != REDIRECT_COPROC) continue;
+      if(!checked) {
+	check_coprocs();
+	checked = 1;
+      }
+
+      if((co = find_coproc(r->path))) {
+	fd = r->flags == O_RDONLY ? co->from_fd : co->to_fd;
+	if(fd == -1) {
+	  fprintf(stderr, "Error: coprocess %s no longer reads its input\n",
+		  r->path);
+	  return -1;
+	}
+	r->src_fd = fd;
+	r->flags = 0;
+	free(r->path);
+	r->path = NULL;
+      }
+      else if(r->flags & O_CREAT) {
+	// >&file, the older spelling of &>file
+	r->kind = REDIRECT_OPEN;
+	insert_stderr_dup(cmd, j);
+	j++;
+      }
+      else {
+	fprintf(stderr, "Error: %s: no such coprocess\n", r->path);
+	return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+ * Closes a coprocess descriptor in a child, unless a
+ * redirection of the child's command put its own
+ * descriptor there.
+ *
+ * Return value: void
+ */
+static void close_in_child(int fd, const struct command* cmd)
+{
+  int i;
+
+  if(fd == -1) return;
+  for(i = 0; cmd && i < cmd->num_redirects; i++) {
+    if(cmd->redirects[i].fd == fd) return;
+  }
+  close(fd);
+}
+
+/**
+ * Closes every coprocess descriptor and empties the
+ * table, in a forked child that runs shell code.
+ *
+ * cmd:
+ *    command the child runs, NULL if none
+ *
+ * Return value: void
+ */
+void coproc_close_all(const struct command* cmd)
+{
+  int i;
+
+  for(i = 0; i < num_coprocs; i++) {
+    close_in_child(coprocs[i].to_fd, cmd);
+    close_in_child(coprocs[i].from_fd, cmd);
+    close_in_child(coprocs[i].pidfd, cmd);
+    free(coprocs[i].name);
+  }
+  num_coprocs = 0;
+}
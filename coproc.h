@@ -0,0 +1,71 @@
+/**
+ * This is the header class for coproc.c
+ *
+ * These methods keep the shell's table of coprocesses:
+ * programs started once with a pipe to their input
+ * and a pipe from their output, both held open by the
+ * shell so later commands can talk to the same warm
+ * process through redirections such as >&name and
+ * <&name.
+ */
+
+#ifndef COPROC_H
+# define COPROC_H
+
+#include "command.h"
+
+/**
+ * The coproc built-in.
+ *
+ *   coproc NAME command [args]   starts command as coprocess NAME
+ *   coproc -c NAME               closes the input of NAME
+ *   coproc                       lists the coprocesses
+ *
+ * The command runs from PATH like a background job
+ * and is reaped like one. Once it has exited its
+ * input is closed; its output stays open until it is
+ * read to the end and NAME is closed or reused.
+ *
+ * parsed_input:
+ *             the command and arguments entered in by the user
+ * io:
+ *   where the built-in reads and writes
+ *
+ * Return value: 0 on success, 1 on error, 2 on a usage error
+ */
+int coproc_command(char** parsed_input, struct builtin_io* io);
+
+/**
+ * Turns the coprocess redirections of a pipeline into
+ * copies of the shell's descriptors for them: >&name
+ * and N>&name write to the input of coprocess name,
+ * <&name and N<&name read its output. When no
+ * coprocess has the name, >&name is the older
+ * spelling of &>name and opens a file.
+ *
+ * p:
+ *  the parsed pipeline, changed in place
+ *
+ * Return value: 0 on success, -1 after printing an error
+ */
+int resolve_coprocs(struct pipeline* p);
+
+/**
+ * Closes every coprocess descriptor and empties the
+ * table, in a forked child that runs shell code
+ * rather than a program. The pipes are only
+ * close-on-exec, so such a child would otherwise
+ * hold a coprocess's input open, and the coprocess
+ * would not see end of file when the shell closes
+ * its own end.
+ *
+ * cmd:
+ *    command the child runs, whose redirections are
+ *    already applied and whose target descriptors stay
+ *    open; NULL if none
+ *
+ * Return value: void
+ */
+void coproc_close_all(const struct command* cmd);
+
+#endif
@@ -0,0 +1,484 @@
+/**
+ * This C file contains the native implementation
+ * of the dir built-in command. Directory entries
+ * are read straight from the kernel in large
+ * getdents64 batches, sorted in-process and
+ * written out with one writev per call.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "dir.h"
+
+// size of the buffer handed to getdents64
+#define DENTS_BUF_SIZE (1 << 20)
+// below this many strings a bucket is insertion sorted
+#define RADIX_CUTOFF 32
+// reported when the listing or its output cannot grow
+#define DIR_OUT_OF_MEMORY "Error: Out of memory while listing directory\n"
+
+// layout of the records returned by getdents64
+struct linux_dirent64 {
+  unsigned long long d_ino;
+  long long d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+/**
+ * Entries of a single directory. All names are
+ * packed into one arena so reading 200k entries
+ * costs a handful of allocations instead of one
+ * per entry. Every name is preceded by its d_type
+ * byte so the type travels with the name when sorted.
+ */
+struct listing {
+  char* arena;
+  size_t arena_len;
+  size_t arena_cap;
+  size_t* offsets;
+  size_t count;
+  size_t cap;
+};
+
+/**
+ * Growable output buffer that is handed to writev
+ * once the whole listing has been formatted.
+ */
+struct out_buf {
+  char* data;
+  size_t len;
+  size_t cap;
+};
+
+/**
+ * Makes sure the output buffer can hold extra more bytes.
+ * On failure the buffer is left as it was.
+ *
+ * out:
+ *    output buffer to grow
+ * extra:
+ *      number of bytes about to be appended
+ *
+ * Return value: 0 on success, -1 if out of memory
+ */
+static int out_reserve(struct out_buf* out, size_t extra)
+{
+  size_t cap = out->cap;
+  char* data;
+
+  if(out->len + extra <= out->cap) return 0;
+
+  while(out->len + extra > cap) {
+    cap = cap ? cap * 2 : 65536;
+  }
+  if(!(data = realloc(out->data, cap))) return -1;
+  out->data = data;
+  out->cap = cap;
+  return 0;
+}
+
+/**
+ * Appends len bytes of s to the output buffer.
+ *
+ * Return value: 0 on success, -1 if out of memory
+ */
+static int out_append(struct out_buf* out, const char* s, size_t len)
+{
+  if(out_reserve(out, len) == -1) return -1;
+  memcpy(out->data + out->len, s, len);
+  out->len += len;
+  return 0;
+}
+
+/**
+ * Writes every iovec out to file descriptor fd,
+ * continuing after partial writes.
+ *
+ * Return value: 0 on success, -1 on error
+ */
+static int write_all(int fd, struct iovec* iov, int iovcnt)
+{
+  while(iovcnt > 0) {
+    ssize_t n = writev(fd, iov, iovcnt);
+    if(n < 0) return -1;
+
+    // skip over the iovecs that were fully written
+    while(iovcnt > 0 && (size_t) n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if(iovcnt > 0) {
+      iov->iov_base = (char*) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Adds a directory entry to the listing. On failure
+ * the listing keeps what it had, for the caller to
+ * free.
+ *
+ * Return value: 0 on success, -1 if out of memory
+ */
+static int listing_add(struct listing* l, const char* name, unsigned char type)
+{
+  size_t len = strlen(name) + 1;
+
+  if(l->count == l->cap) {
+    size_t cap = l->cap ? l->cap * 2 : 1024;
+    size_t* offsets = realloc(l->offsets, sizeof(size_t) * cap);
+
+    if(!offsets) return -1;
+    l->offsets = offsets;
+    l->cap = cap;
+  }
+  if(l->arena_len + len + 1 > l->arena_cap) {
+    size_t cap = l->arena_cap;
+    char* arena;
+
+    while(l->arena_len + len + 1 > cap) {
+      cap = cap ? cap * 2 : 65536;
+    }
+    if(!(arena = realloc(l->arena, cap))) return -1;
+    l->arena = arena;
+    l->arena_cap = cap;
+  }
+
+  l->arena[l->arena_len] = (char) type;
+  memcpy(l->arena + l->arena_len + 1, name, len);
+  l->offsets[l->count] = l->arena_len + 1;
+  l->arena_len += len + 1;
+  l->count++;
+  return 0;
+}
+
+/**
+ * Reads all entries of the directory open on fd
+ * using getdents64 with a large buffer.
+ *
+ * fd:
+ *   open directory file descriptor
+ * l:
+ *  listing to fill
+ * show_hidden:
+ *            1 if entries starting with '.' should be kept
+ *
+ * Return value: 0 on success, -1 on error with errno set,
+ *               ENOMEM when out of memory
+ */
+static int read_entries(int fd, struct listing* l, int show_hidden)
+{
+  char* buf = malloc(DENTS_BUF_SIZE);
+  long n;
+
+  if(!buf) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  while((n = syscall(SYS_getdents64, fd, buf, DENTS_BUF_SIZE)) > 0) {
+    long pos = 0;
+    while(pos < n) {
+      struct linux_dirent64* d = (struct linux_dirent64*) (buf + pos);
+      if((show_hidden || d->d_name[0] != '.') &&
+	 listing_add(l, d->d_name, d->d_type) == -1) {
+	free(buf);
+	errno = ENOMEM;
+	return -1;
+      }
+      pos += d->d_reclen;
+    }
+  }
+
+  free(buf);
+  return n < 0 ? -1 : 0;
+}
+
+/**
+ * Sorts strings by byte value starting at character
+ * depth using insertion sort. Used for small buckets.
+ *
+ * Return value: void
+ */
+static void insertion_sort(char** s, size_t n, size_t depth)
+{
+  size_t i, j;
+
+  for(i = 1; i < n; i++) {
+    char* key = s[i];
+    for(j = i; j > 0 && strcmp(s[j - 1] + depth, key + depth) > 0; j--) {
+      s[j] = s[j - 1];
+    }
+    s[j] = key;
+  }
+}
+
+/**
+ * MSD radix sort of strings by byte value. Strings
+ * that share the first depth characters are bucketed
+ * on the next byte and each bucket is sorted in turn.
+ *
+ * s:
+ *  strings to sort
+ * tmp:
+ *    scratch array with room for n pointers
+ * n:
+ *  number of strings
+ * depth:
+ *      number of leading characters all strings have in common
+ *
+ * Return value: void
+ */
+static void radix_sort(char** s, char** tmp, size_t n, size_t depth)
+{
+  size_t count[256] = {0};
+  size_t start[256];
+  size_t i;
+
+  if(n < RADIX_CUTOFF) {
+    insertion_sort(s, n, depth);
+    return;
+  }
+
+  for(i = 0; i < n; i++) {
+    count[(unsigned char) s[i][depth]]++;
+  }
+  start[0] = 0;
+  for(i = 1; i < 256; i++) {
+    start[i] = start[i - 1] + count[i - 1];
+  }
+  for(i = 0; i < n; i++) {
+    tmp[start[(unsigned char) s[i][depth]]++] = s[i];
+  }
+  memcpy(s, tmp, sizeof(char*) * n);
+
+  // bucket 0 holds strings that already ended, they are equal
+  for(i = 1; i < 256; i++) {
+    if(count[i] > 1) {
+      size_t first = start[i] - count[i];
+      radix_sort(s + first, tmp, count[i], depth + 1);
+    }
+  }
+}
+
+/**
+ * Converts a getdents64 d_type value into the
+ * single character shown by dir -l.
+ *
+ * Return value: the type character
+ */
+static char dtype_char(unsigned char type)
+{
+  switch(type) {
+  case DT_DIR: return 'd';
+  case DT_LNK: return 'l';
+  case DT_FIFO: return 'p';
+  case DT_SOCK: return 's';
+  case DT_CHR: return 'c';
+  case DT_BLK: return 'b';
+  case DT_REG: return '-';
+  default: return '?';
+  }
+}
+
+/**
+ * Converts a statx mode into the type character.
+ *
+ * Return value: the type character
+ */
+static char mode_char(mode_t mode)
+{
+  if(S_ISDIR(mode)) return 'd';
+  if(S_ISLNK(mode)) return 'l';
+  if(S_ISFIFO(mode)) return 'p';
+  if(S_ISSOCK(mode)) return 's';
+  if(S_ISCHR(mode)) return 'c';
+  if(S_ISBLK(mode)) return 'b';
+  return '-';
+}
+
+/**
+ * Reads, sorts and formats one directory into out.
+ *
+ * path:
+ *     directory to list
+ * out:
+ *    buffer receiving the formatted listing
+ * long_format:
+ *            1 if type and size should be shown
+ * sorted:
+ *       1 if entries should be sorted by name
+ * show_hidden:
+ *            1 if entries starting with '.' should be listed
+ * err:
+ *    stream for error messages
+ *
+ * Return value: 0 on success, -1 on error
+ */
+static int format_directory(const char* path, struct out_buf* out,
+			    int long_format, int sorted, int show_hidden,
+			    FILE* err)
+{
+  struct listing l;
+  char** names;
+  size_t i;
+  int fd;
+
+  memset(&l, 0, sizeof(l));
+
+  if((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+    fprintf(err, "dir: cannot open directory %s\n", path);
+    return -1;
+  }
+  if(read_entries(fd, &l, show_hidden) == -1) {
+    if(errno == ENOMEM) fprintf(err, DIR_OUT_OF_MEMORY);
+    else fprintf(err, "dir: error reading directory %s\n", path);
+    close(fd);
+    free(l.arena);
+    free(l.offsets);
+    return -1;
+  }
+
+  // the arena is complete now so pointers into it stay valid,
+  // the second half of names is scratch space for the sort
+  names = malloc(sizeof(char*) * (l.count ? l.count * 2 : 1));
+  if(!names) {
+    fprintf(err, DIR_OUT_OF_MEMORY);
+    close(fd);
+    free(l.arena);
+    free(l.offsets);
+    return -1;
+  }
+  for(i = 0; i < l.count; i++) {
+    names[i] = l.arena + l.offsets[i];
+  }
+  if(sorted) {
+    radix_sort(names, names + l.count, l.count, 0);
+  }
+
+  for(i = 0; i < l.count; i++) {
+    size_t len = strlen(names[i]);
+
+    if(long_format) {
+      // one statx per entry relative to the already open
+      // directory fd, so no path is rebuilt or re-resolved
+      struct statx stx;
+      char line[64];
+      char type;
+      long long size = 0;
+      int n;
+
+      if(statx(fd, names[i], AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+	       STATX_TYPE | STATX_SIZE, &stx) == 0) {
+	type = mode_char(stx.stx_mode);
+	size = (long long) stx.stx_size;
+      }
+      else {
+	// fall back on the type reported by getdents64
+	type = dtype_char((unsigned char) names[i][-1]);
+      }
+      n = snprintf(line, sizeof(line), "%c %12lld ", type, size);
+      if(out_append(out, line, n) == -1) break;
+    }
+
+    if(out_reserve(out, len + 1) == -1) break;
+    memcpy(out->data + out->len, names[i], len);
+    out->data[out->len + len] = '\n';
+    out->len += len + 1;
+  }
+
+  free(names);
+  free(l.arena);
+  free(l.offsets);
+  close(fd);
+  // the loop only stops early when the output cannot grow
+  if(i < l.count) {
+    fprintf(err, DIR_OUT_OF_MEMORY);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Lists the contents of one or more directories.
+ * Entries are read with getdents64, sorted with a
+ * radix sort and written out with a single writev.
+ *
+ * parsed_input:
+ *             the command and arguments entered in by the user
+ * io:
+ *   where the built-in reads and writes
+ *
+ * Return value: 0 on success, 1 if a directory could not be listed
+ */
+int list_directory(char** parsed_input, struct builtin_io* io)
+{
+  struct out_buf out;
+  struct iovec iov[1];
+  int long_format = 0, sorted = 1, show_hidden = 0;
+  int i, paths = 0, listed = 0, status = 0;
+
+  memset(&out, 0, sizeof(out));
+
+  for(i = 1; parsed_input[i]; i++) {
+    if(parsed_input[i][0] == '-' && parsed_input[i][1]) {
+      char* flag;
+      for(flag = parsed_input[i] + 1; *flag; flag++) {
+	if(*flag == 'l') long_format = 1;
+	else if(*flag == 'U') sorted = 0;
+	else if(*flag == 'a') show_hidden = 1;
+	else fprintf(io->err, "dir: unknown option -%c\n", *flag);
+      }
+    }
+    else {
+      paths++;
+    }
+  }
+
+  if(!paths) {
+    status |= format_directory(".", &out, long_format, sorted, show_hidden,
+			       io->err) == -1;
+  }
+  for(i = 1; parsed_input[i]; i++) {
+    if(parsed_input[i][0] == '-' && parsed_input[i][1]) continue;
+
+    // mimic ls and label each directory when more than one is listed
+    if(paths > 1 &&
+       ((listed++ && out_append(&out, "\n", 1) == -1) ||
+	out_append(&out, parsed_input[i], strlen(parsed_input[i])) == -1 ||
+	out_append(&out, ":\n", 2) == -1)) {
+      fprintf(io->err, DIR_OUT_OF_MEMORY);
+      status = 1;
+      break;
+    }
+    status |= format_directory(parsed_input[i], &out, long_format, sorted,
+			       show_hidden, io->err) == -1;
+  }
+
+  // anything still sitting in stdio has to go out first
+  fflush(io->out);
+  iov[0].iov_base = out.data;
+  iov[0].iov_len = out.len;
+  if(out.len && write_all(io->out_fd, iov, 1) == -1) {
+    fprintf(io->err, "dir: write error\n");
+    status = 1;
+  }
+  free(out.data);
+  return status;
+}
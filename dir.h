@@ -0,0 +1,32 @@
+/**
+ * This is the header class for dir.c
+ *
+ * These methods implement the dir built-in
+ * command without forking an external program.
+ */
+
+#ifndef DIR_H
+# define DIR_H
+
+#include "command.h"
+
+/**
+ * Lists the contents of one or more directories.
+ * Entries are read with getdents64, sorted with a
+ * radix sort and written out with a single writev.
+ *
+ * Supported flags:
+ *   -a  also list entries starting with '.'
+ *   -l  show the type and size of every entry (statx)
+ *   -U  do not sort, list entries in directory order
+ *
+ * parsed_input:
+ *             the command and arguments entered in by the user
+ * io:
+ *   where the built-in reads and writes
+ *
+ * Return value: 0 on success, 1 if a directory could not be listed
+ */
+int list_directory(char** parsed_input, struct builtin_io* io);
+
+#endif
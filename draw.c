@@ -6,12 +6,21 @@
  * to the screen for the user.
  */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "draw.h"
+#include "commands.h"
+#include "jobs.h"
 
 // various colors for use in print commands
 #define GREEN "\x1B[32m"
@@ -24,6 +33,27 @@
 #define WHITE  "\x1B[37m"
 #define RESET_COLOR "\033[0m"
 
+// prompt used when MYSHELL_PROMPT is not set
+#define DEFAULT_PROMPT RED "%d" RESET_COLOR "%b%t%s%j> "
+// how long a prompt waits for the branch before showing the last one
+#define SEGMENT_DEADLINE_MS 30
+// shortest command whose duration %t shows
+#define SHOW_DURATION_MS 1000
+
+// working directory shown by %d, NULL until read again after a cd
+static char* cached_cwd = NULL;
+static long last_duration_ms = 0;
+
+// the branch segment, computed on a thread of its own
+static pthread_mutex_t segment_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t segment_done;
+static int segment_started = 0;
+static unsigned long requested = 0;
+static unsigned long answered = 0;
+static char request_dir[PATH_MAX];
+static char branch_dir[PATH_MAX];
+static char branch[256];
+
 /**
  * Removes the first two characters from any string.
  *
@@ -73,25 +103,275 @@ void print_info(char* executable)
 }
 
 /**
- * Prints out the command line prompt 
- * to the user after every completed command.
+ * Reads the branch name from a git HEAD file, or the
+ * short commit id when the head is detached.
+ *
+ * Return value: 1 if found, 0 otherwise
+ */
+static int read_head(const char* head, char* out, size_t size)
+{
+  FILE* f = fopen(head, "re");
+  char line[256];
+  int found = 0;
+
+  if(!f) return 0;
+  if(fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\n")] = 0;
+    if(strncmp(line, "ref: refs/heads/", 16) == 0) {
+      snprintf(out, size, "%s", line + 16);
+    }
+    else {
+      snprintf(out, size, "%.7s", line);
+    }
+    found = 1;
+  }
+  fclose(f);
+  return found;
+}
+
+/**
+ * Finds the git branch of dir by looking for .git in
+ * dir and each of its parents. A .git file, as in a
+ * worktree or submodule, names the real directory.
  *
  * Return value: void
  */
-void prompt()
+static void find_branch(const char* dir, char* out, size_t size)
 {
-  char cwd[1024];
+  char path[PATH_MAX];
+  char git[PATH_MAX + 16];
+  char head[2 * PATH_MAX];
+  struct stat st;
+  char* slash;
 
-  if(!getcwd(cwd, sizeof(cwd))) {
-    fprintf(stderr, "size of array is not enough");
+  out[0] = 0;
+  snprintf(path, sizeof(path), "%s", dir);
+  while(1) {
+    snprintf(git, sizeof(git), "%s/.git", path);
+    if(stat(git, &st) == 0) {
+      FILE* f;
+      char line[PATH_MAX + 16];
+
+      if(S_ISDIR(st.st_mode)) {
+	snprintf(head, sizeof(head), "%s/HEAD", git);
+	read_head(head, out, size);
+	return;
+      }
+      if((f = fopen(git, "re"))) {
+	if(fgets(line, sizeof(line), f) &&
+	   strncmp(line, "gitdir: ", 8) == 0) {
+	  line[strcspn(line, "\n")] = 0;
+	  // the named directory may be relative to the .git file
+	  if(snprintf(head, sizeof(head), "%s%s%s/HEAD",
+		      line[8] == '/' ? "" : path, line[8] == '/' ? "" : "/",
+		      line + 8) < (int) sizeof(head)) {
+	    read_head(head, out, size);
+	  }
+	}
+	fclose(f);
+      }
+      return;
+    }
+    if(!(slash = strrchr(path, '/')) || path[1] == 0) return;
+    // the parent of /dir is /
+    if(slash == path) slash++;
+    *slash = 0;
+  }
+}
+
+/**
+ * Body of the segment thread. Answers one request at
+ * a time; a request made while it is busy is answered
+ * next, older ones are dropped.
+ *
+ * Return value: NULL
+ */
+static void* segment_thread(void* arg)
+{
+  char dir[PATH_MAX];
+  char found[sizeof(branch)];
+  unsigned long gen;
+
+  pthread_mutex_lock(&segment_lock);
+  while(1) {
+    while(answered == requested) {
+      pthread_cond_wait(&segment_done, &segment_lock);
+    }
+    gen = requested;
+    memcpy(dir, request_dir, sizeof(dir));
+    pthread_mutex_unlock(&segment_lock);
+
+    find_branch(dir, found, sizeof(found));
+
+    pthread_mutex_lock(&segment_lock);
+    memcpy(branch, found, sizeof(branch));
+    memcpy(branch_dir, dir, sizeof(branch_dir));
+    answered = gen;
+    pthread_cond_broadcast(&segment_done);
   }
-  else {
-    // prints out the command line prompt in red
-    printf(RED "%s" RESET_COLOR, cwd);
-    printf("> ");
+  return NULL;
+}
+
+/**
+ * Asks the segment thread for the branch of dir and
+ * waits for it until the deadline. When the answer
+ * is late the one from the previous prompt is used,
+ * if it was for the same directory, and the new one
+ * shows up on the next prompt.
+ *
+ * Return value: void
+ */
+static void branch_segment(const char* dir, char* out, size_t size)
+{
+  pthread_condattr_t attr;
+  pthread_t thread;
+  struct timespec deadline;
+  unsigned long gen;
+
+  out[0] = 0;
+  pthread_mutex_lock(&segment_lock);
+  if(!segment_started) {
+    // deadlines are measured on the monotonic clock
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&segment_done, &attr);
+    pthread_condattr_destroy(&attr);
+    if(pthread_create(&thread, NULL, segment_thread, NULL) != 0) {
+      pthread_mutex_unlock(&segment_lock);
+      return;
+    }
+    pthread_detach(thread);
+    segment_started = 1;
+  }
+
+  gen = ++requested;
+  snprintf(request_dir, sizeof(request_dir), "%s", dir);
+  pthread_cond_broadcast(&segment_done);
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_nsec += SEGMENT_DEADLINE_MS * 1000000L;
+  if(deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
   }
+  while(answered != gen &&
+	pthread_cond_timedwait(&segment_done, &segment_lock, &deadline)
+	!= ETIMEDOUT);
+
+  if(strcmp(branch_dir, dir) == 0) snprintf(out, size, "%s", branch);
+  pthread_mutex_unlock(&segment_lock);
+}
+
+/**
+ * Forgets the cached working directory. Called after
+ * the shell changes directory.
+ *
+ * Return value: void
+ */
+void prompt_directory_changed()
+{
+  free(cached_cwd);
+  cached_cwd = NULL;
 }
 
+/**
+ * Records how long the last command line took, for
+ * the %t segment.
+ *
+ * ms:
+ *   duration in milliseconds
+ *
+ * Return value: void
+ */
+void prompt_command_time(long ms)
+{
+  last_duration_ms = ms;
+}
+
+/**
+ * Builds the command line prompt shown to the
+ * user after every completed command, from
+ * MYSHELL_PROMPT or the default format. The
+ * segments are
+ *
+ *   %d  working directory
+ *   %b  " (branch)" inside a git repository
+ *   %t  " 2.5s" when the last command took a second or more
+ *   %s  " [N]" when the last command failed with status N
+ *   %j  " [N jobs]" while background jobs run
+ *   %%  a percent sign
+ *
+ * Return value: the prompt, valid until the next call
+ */
+const char* prompt_text()
+{
+  static char* text = NULL;
+  const char* format = getenv("MYSHELL_PROMPT");
+  const char* f;
+  size_t len;
+  FILE* out;
+
+  if(!format) format = DEFAULT_PROMPT;
+  if(!cached_cwd && !(cached_cwd = getcwd(NULL, 0))) {
+    fprintf(stderr, "size of array is not enough");
+    return "> ";
+  }
+
+  free(text);
+  text = NULL;
+  if(!(out = open_memstream(&text, &len))) return "> ";
 
+  for(f = format; *f; f++) {
+    char seg[sizeof(branch)];
+    int jobs;
 
+    if(*f != '%' || !f[1]) {
+      fputc(*f, out);
+      continue;
+    }
+    switch(*++f) {
+    case 'd':
+      fputs(cached_cwd, out);
+      break;
+    case 'b':
+      branch_segment(cached_cwd, seg, sizeof(seg));
+      if(seg[0]) fprintf(out, " (%s)", seg);
+      break;
+    case 't':
+      if(last_duration_ms >= SHOW_DURATION_MS) {
+	fprintf(out, " %ld.%lds", last_duration_ms / 1000,
+		last_duration_ms % 1000 / 100);
+      }
+      break;
+    case 's':
+      if(last_exit_status) fprintf(out, " [%d]", last_exit_status);
+      break;
+    case 'j':
+      if((jobs = running_children())) {
+	fprintf(out, " [%d job%s]", jobs, jobs == 1 ? "" : "s");
+      }
+      break;
+    default:
+      fputc(*f, out);
+    }
+  }
+  fclose(out);
+  return text;
+}
 
+/**
+ * Prints out the command line prompt 
+ * to the user after every completed command,
+ * in one write.
+ *
+ * Return value: void
+ */
+void prompt()
+{
+  const char* text = prompt_text();
+
+  fflush(stdout);
+  if(write(STDOUT_FILENO, text, strlen(text)) < 0) {
+    fprintf(stderr, "Error: Could not print the prompt\n");
+  }
+}
@@ -19,6 +19,36 @@
  */
 void prompt();
 
+/**
+ * Builds the command line prompt shown to the
+ * user after every completed command, from the
+ * segments in MYSHELL_PROMPT. The working directory
+ * is cached and the git branch is looked up on a
+ * background thread, so neither slows the prompt.
+ *
+ * Return value: the prompt, valid until the next call
+ */
+const char* prompt_text();
+
+/**
+ * Forgets the cached working directory. Called after
+ * the shell changes directory.
+ *
+ * Return value: void
+ */
+void prompt_directory_changed();
+
+/**
+ * Records how long the last command line took, for
+ * the %t segment.
+ *
+ * ms:
+ *   duration in milliseconds
+ *
+ * Return value: void
+ */
+void prompt_command_time(long ms);
+
 /**
  * Prints out some shell info to the user.
  *
@@ -0,0 +1,183 @@
+/**
+ * This C file contains a small LRU cache of open
+ * files used as >> redirection targets. Entries are
+ * keyed by absolute path and open flags, and checked
+ * against the path's current inode before reuse so
+ * a rotated or deleted log is opened afresh.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fdcache.h"
+#include "options.h"
+
+#define FDCACHE_MODE 00666
+
+struct fdcache_entry {
+  char* path;
+  int flags;
+  int fd;
+  dev_t dev;
+  ino_t ino;
+  unsigned long used;
+};
+
+static struct fdcache_entry* entries = NULL;
+static int num_entries = 0;
+static int script_depth = 0;
+static unsigned long use_clock = 0;
+// working directory the cached relative paths were resolved against
+static char* cache_cwd = NULL;
+
+/**
+ * Closes and removes the entry at index i.
+ *
+ * Return value: void
+ */
+static void drop_entry(int i)
+{
+  close(entries[i].fd);
+  free(entries[i].path);
+  entries[i] = entries[--num_entries];
+}
+
+/**
+ * Turns path into an absolute path using the
+ * working directory remembered for the cache.
+ *
+ * Return value: the absolute path, which the caller frees
+ */
+static char* absolute_path(const char* path)
+{
+  char* full;
+
+  if(path[0] == '/') return strdup(path);
+
+  if(!cache_cwd && !(cache_cwd = getcwd(NULL, 0))) return NULL;
+  full = malloc(strlen(cache_cwd) + strlen(path) + 2);
+  sprintf(full, "%s/%s", cache_cwd, path);
+  return full;
+}
+
+/**
+ * Returns a cached file descriptor for path opened
+ * with flags, opening and caching it on a miss.
+ *
+ * Return value: the cached fd, -1 if the caller should open
+ *               the file itself
+ */
+int fdcache_get(const char* path, int flags)
+{
+  struct fdcache_entry* e;
+  struct stat st;
+  char* full;
+  int i, fd, oldest;
+
+  // reads and truncating writes depend on a fresh open
+  if(!options.fdcache || !script_depth || !(flags & O_APPEND)) return -1;
+  // the cache is not locked; other threads open their own
+  if(gettid() != getpid()) return -1;
+  if(!(full = absolute_path(path))) return -1;
+
+  for(i = 0; i < num_entries; i++) {
+    e = &entries[i];
+    if(e->flags != flags || strcmp(e->path, full) != 0) continue;
+
+    if(stat(full, &st) == 0 && st.st_dev == e->dev && st.st_ino == e->ino) {
+      e->used = ++use_clock;
+      free(full);
+      return e->fd;
+    }
+    // the name now points at another file, or at none
+    drop_entry(i);
+    break;
+  }
+
+  if((fd = open(full, flags | O_CLOEXEC, FDCACHE_MODE)) == -1 ||
+     fstat(fd, &st) == -1) {
+    if(fd != -1) close(fd);
+    free(full);
+    return -1;
+  }
+
+  if(num_entries >= options.fdcache) {
+    oldest = 0;
+    for(i = 1; i < num_entries; i++) {
+      if(entries[i].used < entries[oldest].used) oldest = i;
+    }
+    drop_entry(oldest);
+  }
+  if(!entries) {
+    // sized for the largest allowed cache
+    entries = malloc(sizeof(struct fdcache_entry) * 64);
+  }
+
+  e = &entries[num_entries++];
+  e->path = full;
+  e->flags = flags;
+  e->fd = fd;
+  e->dev = st.st_dev;
+  e->ino = st.st_ino;
+  e->used = ++use_clock;
+  return fd;
+}
+
+/**
+ * Marks the start of a script run.
+ *
+ * Return value: void
+ */
+void fdcache_script_begin()
+{
+  script_depth++;
+}
+
+/**
+ * Marks the end of a script run and closes every
+ * cached file once the outermost script ends.
+ *
+ * Return value: void
+ */
+void fdcache_script_end()
+{
+  if(--script_depth == 0) fdcache_clear();
+}
+
+/**
+ * Closes every cached file.
+ *
+ * Return value: void
+ */
+void fdcache_clear()
+{
+  while(num_entries > 0) {
+    drop_entry(num_entries - 1);
+  }
+  free(cache_cwd);
+  cache_cwd = NULL;
+}
+
+/**
+ * Shrinks the cache to the size set in options.fdcache.
+ *
+ * Return value: void
+ */
+void fdcache_resize()
+{
+  int i, oldest;
+
+  while(num_entries > options.fdcache) {
+    oldest = 0;
+    for(i = 1; i < num_entries; i++) {
+      if(entries[i].used < entries[oldest].used) oldest = i;
+    }
+    drop_entry(oldest);
+  }
+}
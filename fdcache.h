@@ -0,0 +1,59 @@
+/**
+ * This is the header class for fdcache.c
+ *
+ * These methods keep the files that a script appends
+ * to with >> open between commands, so a script of
+ * thousands of "cmd >> log" lines opens log once.
+ * The cache is off unless "set fdcache=on" is used.
+ */
+
+#ifndef FDCACHE_H
+# define FDCACHE_H
+
+/**
+ * Returns a cached file descriptor for path opened
+ * with flags, opening and caching it on a miss. Only
+ * appending opens are cached, and only while a
+ * script is running with the cache enabled.
+ *
+ * path:
+ *     file name as written in the redirection
+ * flags:
+ *      open flags of the redirection
+ *
+ * Return value: the cached fd, -1 if the caller should open
+ *               the file itself
+ */
+int fdcache_get(const char* path, int flags);
+
+/**
+ * Marks the start of a script run.
+ *
+ * Return value: void
+ */
+void fdcache_script_begin();
+
+/**
+ * Marks the end of a script run and closes every
+ * cached file once the outermost script ends.
+ *
+ * Return value: void
+ */
+void fdcache_script_end();
+
+/**
+ * Closes every cached file. Called whenever cached
+ * paths may name different files, such as after cd.
+ *
+ * Return value: void
+ */
+void fdcache_clear();
+
+/**
+ * Shrinks the cache to the size set in options.fdcache.
+ *
+ * Return value: void
+ */
+void fdcache_resize();
+
+#endif
@@ -0,0 +1,410 @@
+/**
+ * This C file contains the cat, cp and wc -l
+ * built-ins.
+ *
+ * Copies try, in order, copy_file_range between two
+ * regular files, splice when one side is a pipe, and
+ * sendfile from a file to anything else. Each method
+ * works on the descriptors' own offsets, so when the
+ * kernel refuses one partway the next simply carries
+ * on. read and write are the last resort. wc -l maps
+ * regular files and counts new lines with the vector
+ * counter in scan.c.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include "files.h"
+#include "jobs.h"
+#include "redirect.h"
+#include "scan.h"
+
+// most bytes asked of one copy_file_range, splice or sendfile
+#define COPY_CHUNK (1 << 30)
+// buffer of the read and write fallback
+#define READ_BUFFER (256 * 1024)
+
+/**
+ * Ways of copying, tried in this order.
+ */
+enum copy_method {
+  COPY_RANGE,
+  COPY_SPLICE,
+  COPY_SENDFILE,
+  COPY_READ
+};
+
+/**
+ * Runs the program from PATH for options the
+ * built-in does not have, with every descriptor the
+ * built-in has: its input, output and error, and the
+ * others its redirections set up, so 2>&1 or 3<file
+ * reach the program too.
+ *
+ * Return value: exit status of the program
+ */
+static int run_external(char** parsed_input, struct builtin_io* io)
+{
+  int std_fds[3] = { io->in_fd, io->out_fd, io->err_fd };
+  pid_t pid;
+
+  fflush(io->out);
+  fflush(io->err);
+  if(spawn_with_io(parsed_input, std_fds, io, &pid) != 0) {
+    fprintf(io->err, "Error: Could not execute command %s\n", parsed_input[0]);
+    return 127;
+  }
+  return wait_child(pid);
+}
+
+/**
+ * Determines whether any argument is an option,
+ * that is starts with '-' and is not just "-".
+ *
+ * Return value: 1 if true, 0 otherwise
+ */
+static int has_option(char** args)
+{
+  for(; *args; args++) {
+    if((*args)[0] == '-' && (*args)[1]) return 1;
+  }
+  return 0;
+}
+
+/**
+ * Copies with read and write.
+ *
+ * Return value: 0 on success, -1 on error with errno set
+ */
+static int copy_read_write(int in_fd, int out_fd)
+{
+  char* buf = malloc(READ_BUFFER);
+  ssize_t n, done, w;
+
+  if(!buf) return -1;
+  while((n = read(in_fd, buf, READ_BUFFER)) != 0) {
+    if(n == -1) {
+      if(errno == EINTR) continue;
+      free(buf);
+      return -1;
+    }
+    for(done = 0; done < n; done += w) {
+      if((w = write(out_fd, buf + done, n - done)) == -1) {
+	if(errno == EINTR) {
+	  w = 0;
+	  continue;
+	}
+	free(buf);
+	return -1;
+      }
+    }
+  }
+  free(buf);
+  return 0;
+}
+
+/**
+ * Copies everything left in in_fd to out_fd, with the
+ * first method the kernel accepts for the pair.
+ *
+ * Return value: 0 on success, -1 on error with errno set
+ */
+static int copy_fd(int in_fd, int out_fd)
+{
+  struct stat in_st, out_st;
+  enum copy_method method = COPY_RANGE;
+  ssize_t n;
+
+  if(fstat(in_fd, &in_st) == -1 || fstat(out_fd, &out_st) == -1) return -1;
+
+  // files like those in /proc claim a size of 0 but are not empty
+  if(!S_ISREG(in_st.st_mode) || !S_ISREG(out_st.st_mode) ||
+     in_st.st_size == 0) {
+    method = COPY_SPLICE;
+  }
+  if(method == COPY_SPLICE &&
+     !S_ISFIFO(in_st.st_mode) && !S_ISFIFO(out_st.st_mode)) {
+    method = COPY_SENDFILE;
+  }
+
+  while(1) {
+    switch(method) {
+    case COPY_RANGE:
+      n = copy_file_range(in_fd, NULL, out_fd, NULL, COPY_CHUNK, 0);
+      break;
+    case COPY_SPLICE:
+      n = splice(in_fd, NULL, out_fd, NULL, COPY_CHUNK, SPLICE_F_MOVE);
+      break;
+    case COPY_SENDFILE:
+      n = sendfile(out_fd, in_fd, NULL, COPY_CHUNK);
+      break;
+    default:
+      return copy_read_write(in_fd, out_fd);
+    }
+
+    if(n == 0) return 0;
+    if(n > 0 || errno == EINTR) continue;
+    // the kernel does not do this for these descriptors
+    if(errno == EINVAL || errno == ENOSYS || errno == EXDEV ||
+       errno == EOPNOTSUPP || errno == EBADF) {
+      method++;
+      continue;
+    }
+    return -1;
+  }
+}
+
+/**
+ * Determines whether a copy would read the regular
+ * file it writes to, which would never reach the end.
+ *
+ * Return value: 1 if true, 0 otherwise
+ */
+static int same_file(int in_fd, int out_fd)
+{
+  struct stat in_st, out_st;
+
+  return fstat(in_fd, &in_st) == 0 && fstat(out_fd, &out_st) == 0 &&
+    S_ISREG(out_st.st_mode) && in_st.st_dev == out_st.st_dev &&
+    in_st.st_ino == out_st.st_ino;
+}
+
+/**
+ * Writes files, or the input when none are given, to
+ * the output. "-" names the input.
+ *
+ * Return value: 0 on success, 1 if a file could not be copied
+ */
+int cat_command(char** parsed_input, struct builtin_io* io)
+{
+  int i, fd, status = 0;
+
+  if(has_option(parsed_input + 1)) return run_external(parsed_input, io);
+
+  fflush(io->out);
+  if(!parsed_input[1] && same_file(io->in_fd, io->out_fd)) {
+    fprintf(io->err, "cat: -: input file is output file\n");
+    return 1;
+  }
+  if(!parsed_input[1] && copy_fd(io->in_fd, io->out_fd) == -1) {
+    if(errno != EPIPE) fprintf(io->err, "cat: %s\n", strerror(errno));
+    return 1;
+  }
+
+  for(i = 1; parsed_input[i]; i++) {
+    const char* path = parsed_input[i];
+
+    if(strcmp(path, "-") == 0) fd = io->in_fd;
+    else if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+      fprintf(io->err, "cat: %s: %s\n", path, strerror(errno));
+      status = 1;
+      continue;
+    }
+
+    if(same_file(fd, io->out_fd)) {
+      fprintf(io->err, "cat: %s: input file is output file\n", path);
+      status = 1;
+    }
+    else if(copy_fd(fd, io->out_fd) == -1) {
+      // the reader went away, nothing more can be written
+      if(errno == EPIPE) {
+	if(fd != io->in_fd) close(fd);
+	return 1;
+      }
+      fprintf(io->err, "cat: %s: %s\n", path, strerror(errno));
+      status = 1;
+    }
+    if(fd != io->in_fd) close(fd);
+  }
+  return status;
+}
+
+/**
+ * Copies one file to a path.
+ *
+ * Return value: 0 on success, 1 on error
+ */
+static int copy_file(const char* from, const char* to, struct builtin_io* io)
+{
+  struct stat src_st, dst_st;
+  int in, out, status = 0;
+
+  if((in = open(from, O_RDONLY | O_CLOEXEC)) == -1 ||
+     fstat(in, &src_st) == -1) {
+    fprintf(io->err, "cp: %s: %s\n", from, strerror(errno));
+    if(in != -1) close(in);
+    return 1;
+  }
+  if(S_ISDIR(src_st.st_mode)) {
+    fprintf(io->err, "cp: omitting directory %s\n", from);
+    close(in);
+    return 1;
+  }
+  // opening the target truncates it, which would empty the source
+  if(stat(to, &dst_st) == 0 && dst_st.st_dev == src_st.st_dev &&
+     dst_st.st_ino == src_st.st_ino) {
+    fprintf(io->err, "cp: %s and %s are the same file\n", from, to);
+    close(in);
+    return 1;
+  }
+  if((out = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		 src_st.st_mode & 07777)) == -1) {
+    fprintf(io->err, "cp: %s: %s\n", to, strerror(errno));
+    close(in);
+    return 1;
+  }
+
+  if(copy_fd(in, out) == -1) {
+    fprintf(io->err, "cp: %s: %s\n", to, strerror(errno));
+    status = 1;
+  }
+  close(in);
+  if(close(out) == -1 && !status) {
+    fprintf(io->err, "cp: %s: %s\n", to, strerror(errno));
+    status = 1;
+  }
+  return status;
+}
+
+/**
+ * Copies a file to another file, or files into a
+ * directory.
+ *
+ * Return value: 0 on success, 1 if a file could not be copied
+ */
+int cp_command(char** parsed_input, struct builtin_io* io)
+{
+  struct stat st;
+  char* target;
+  int argc = 0, i, status = 0;
+
+  if(has_option(parsed_input + 1)) return run_external(parsed_input, io);
+
+  while(parsed_input[argc]) argc++;
+  if(argc < 3) {
+    fprintf(io->err, "usage: cp <source>... <target>\n");
+    return 1;
+  }
+  target = parsed_input[argc - 1];
+
+  if(stat(target, &st) == -1 || !S_ISDIR(st.st_mode)) {
+    if(argc > 3) {
+      fprintf(io->err, "cp: %s is not a directory\n", target);
+      return 1;
+    }
+    return copy_file(parsed_input[1], target, io);
+  }
+
+  for(i = 1; i < argc - 1; i++) {
+    const char* base = strrchr(parsed_input[i], '/');
+    char* path;
+
+    base = base ? base + 1 : parsed_input[i];
+    if(asprintf(&path, "%s/%s", target, base) == -1) return 1;
+    status |= copy_file(parsed_input[i], path, io);
+    free(path);
+  }
+  return status;
+}
+
+/**
+ * Counts the new lines in everything left in fd.
+ * Regular files are mapped rather than read.
+ *
+ * Return value: the count, -1 on error with errno set
+ */
+static long long count_lines(int fd)
+{
+  struct stat st;
+  long long lines = 0;
+  char* buf;
+  ssize_t n;
+
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    off_t start = lseek(fd, 0, SEEK_CUR);
+
+    if(start != -1 && start < st.st_size) {
+      buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(buf != MAP_FAILED) {
+	madvise(buf, st.st_size, MADV_SEQUENTIAL);
+	lines = scan_count(buf + start, st.st_size - start, '\n');
+	munmap(buf, st.st_size);
+	lseek(fd, 0, SEEK_END);
+	return lines;
+      }
+    }
+  }
+
+  if(!(buf = malloc(READ_BUFFER))) return -1;
+  while((n = read(fd, buf, READ_BUFFER)) != 0) {
+    if(n == -1) {
+      if(errno == EINTR) continue;
+      free(buf);
+      return -1;
+    }
+    lines += scan_count(buf, n, '\n');
+  }
+  free(buf);
+  return lines;
+}
+
+/**
+ * Counts the lines of files, or of the input when
+ * none are given.
+ *
+ * Return value: 0 on success, 1 if a file could not be read
+ */
+int wc_command(char** parsed_input, struct builtin_io* io)
+{
+  long long lines, total = 0;
+  int i, fd, files = 0, status = 0;
+
+  // only -l is built in
+  if(!parsed_input[1] || strcmp(parsed_input[1], "-l") != 0 ||
+     has_option(parsed_input + 2)) {
+    return run_external(parsed_input, io);
+  }
+
+  if(!parsed_input[2]) {
+    if((lines = count_lines(io->in_fd)) == -1) {
+      fprintf(io->err, "wc: %s\n", strerror(errno));
+      return 1;
+    }
+    fprintf(io->out, "%lld\n", lines);
+    return 0;
+  }
+
+  for(i = 2; parsed_input[i]; i++) {
+    const char* path = parsed_input[i];
+
+    if(strcmp(path, "-") == 0) fd = io->in_fd;
+    else if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+      fprintf(io->err, "wc: %s: %s\n", path, strerror(errno));
+      status = 1;
+      continue;
+    }
+
+    if((lines = count_lines(fd)) == -1) {
+      fprintf(io->err, "wc: %s: %s\n", path, strerror(errno));
+      status = 1;
+    }
+    else {
+      fprintf(io->out, "%lld %s\n", lines, path);
+      total += lines;
+      files++;
+    }
+    if(fd != io->in_fd) close(fd);
+  }
+  if(files > 1) fprintf(io->out, "%lld total\n", total);
+  return status;
+}
@@ -0,0 +1,56 @@
+/**
+ * This is the header class for files.c
+ *
+ * These methods implement the cat, cp and wc -l
+ * built-ins. Data moves between descriptors inside
+ * the kernel where it can, so no process is started
+ * and the bytes never pass through the shell. Any
+ * option other than wc's -l runs the program from
+ * PATH instead.
+ */
+
+#ifndef FILES_H
+# define FILES_H
+
+#include "command.h"
+
+/**
+ * Writes files, or the input when none are given, to
+ * the output. "-" names the input.
+ *
+ * parsed_input:
+ *             the command and arguments entered in by the user
+ * io:
+ *   where the built-in reads and writes
+ *
+ * Return value: 0 on success, 1 if a file could not be copied
+ */
+int cat_command(char** parsed_input, struct builtin_io* io);
+
+/**
+ * Copies a file to another file, or files into a
+ * directory. The copy keeps the source's permissions.
+ *
+ * parsed_input:
+ *             the command and arguments entered in by the user
+ * io:
+ *   where the built-in reads and writes
+ *
+ * Return value: 0 on success, 1 if a file could not be copied
+ */
+int cp_command(char** parsed_input, struct builtin_io* io);
+
+/**
+ * Counts the lines of files, or of the input when
+ * none are given. Only -l is built in.
+ *
+ * parsed_input:
+ *             the command and arguments entered in by the user
+ * io:
+ *   where the built-in reads and writes
+ *
+ * Return value: 0 on success, 1 if a file could not be read
+ */
+int wc_command(char** parsed_input, struct builtin_io* io);
+
+#endif
@@ -0,0 +1,515 @@
+/**
+ * This C file contains the table of aliases and
+ * functions. Each definition keeps its body as the
+ * command list the parser made of it when it was
+ * defined; a call copies that list with the call's
+ * arguments bound in place of the PARAM_MARK bytes
+ * and runs the copy, so nothing is tokenized again.
+ *
+ * The table is a hash table with chained buckets. The
+ * background job scheduler looks names up from its
+ * own thread, so the table is locked, and the lock is
+ * taken around fork so a child can always use it.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "functions.h"
+#include "commands.h"
+#include "process.h"
+
+// deepest nesting of function calls, which ends runaway recursion
+#define MAX_CALL_DEPTH 256
+
+struct definition {
+  char* name;
+  // the body as it was given, for listing
+  char* text;
+  struct command_list* body;
+  int is_alias;
+  // calls in progress; a definition replaced during one
+  // is freed when the last call returns
+  int running;
+  int removed;
+  struct definition* next;
+};
+
+static pthread_mutex_t definitions_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct definition** buckets = NULL;
+static size_t num_buckets = 0;
+static size_t num_definitions = 0;
+static int call_depth = 0;
+
+/**
+ * FNV-1a hash of a name.
+ *
+ * Return value: the hash
+ */
+static size_t hash_name(const char* name)
+{
+  size_t h = 2166136261u;
+
+  for(; *name; name++) {
+    h = (h ^ (unsigned char) *name) * 16777619u;
+  }
+  return h;
+}
+
+/**
+ * Finds a definition. Called with definitions_lock held.
+ *
+ * Return value: the definition, NULL if name is not defined
+ */
+static struct definition* find_definition(const char* name)
+{
+  struct definition* d;
+
+  if(!num_buckets) return NULL;
+  for(d = buckets[hash_name(name) & (num_buckets - 1)]; d; d = d->next) {
+    if(strcmp(d->name, name) == 0) return d;
+  }
+  return NULL;
+}
+
+/**
+ * Frees a definition that is no longer in the table.
+ *
+ * Return value: void
+ */
+static void free_definition(struct definition* d)
+{
+  free(d->name);
+  free(d->text);
+  free_command_list(d->body);
+  free(d);
+}
+
+/**
+ * Takes a definition out of the table. Called with
+ * definitions_lock held.
+ *
+ * Return value: void
+ */
+static void remove_definition(struct definition* d)
+{
+  struct definition** link = &buckets[hash_name(d->name) & (num_buckets - 1)];
+
+  while(*link != d) link = &(*link)->next;
+  *link = d->next;
+  num_definitions--;
+
+  if(d->running) d->removed = 1;
+  else free_definition(d);
+}
+
+/**
+ * Puts a definition in the table, doubling the
+ * buckets once it is three quarters full. Called
+ * with definitions_lock held.
+ *
+ * Return value: void
+ */
+static void insert_definition(struct definition* d)
+{
+  size_t i, slot;
+
+  if(4 * (num_definitions + 1) > 3 * num_buckets) {
+    size_t grown = num_buckets ? num_buckets * 2 : 64;
+    struct definition** fresh = calloc(grown, sizeof(struct definition*));
+
+    for(i = 0; i < num_buckets; i++) {
+      while(buckets[i]) {
+	struct definition* moved = buckets[i];
+	buckets[i] = moved->next;
+	slot = hash_name(moved->name) & (grown - 1);
+	moved->next = fresh[slot];
+	fresh[slot] = moved;
+      }
+    }
+    free(buckets);
+    buckets = fresh;
+    num_buckets = grown;
+  }
+
+  slot = hash_name(d->name) & (num_buckets - 1);
+  d->next = buckets[slot];
+  buckets[slot] = d;
+  num_definitions++;
+}
+
+/**
+ * Takes definitions_lock before fork, so no child
+ * starts with the table half changed.
+ *
+ * Return value: void
+ */
+static void lock_definitions()
+{
+  pthread_mutex_lock(&definitions_lock);
+}
+
+/**
+ * Releases definitions_lock after fork.
+ *
+ * Return value: void
+ */
+static void unlock_definitions()
+{
+  pthread_mutex_unlock(&definitions_lock);
+}
+
+/**
+ * Parses a body and adds or replaces a definition.
+ *
+ * Return value: 0 on success, -1 on a syntax error in text
+ */
+static int define(const char* name, const char* text, int is_alias)
+{
+  static int fork_handlers = 0;
+  struct definition* d = calloc(1, sizeof(struct definition));
+  struct definition* old;
+
+  d->text = strdup(text);
+  if(!(d->body = parse_definition(d->text, !is_alias))) {
+    free(d->text);
+    free(d);
+    return -1;
+  }
+  d->name = strdup(name);
+  d->is_alias = is_alias;
+
+  if(!fork_handlers) {
+    pthread_atfork(lock_definitions, unlock_definitions, unlock_definitions);
+    fork_handlers = 1;
+  }
+
+  pthread_mutex_lock(&definitions_lock);
+  if((old = find_definition(name))) remove_definition(old);
+  insert_definition(d);
+  pthread_mutex_unlock(&definitions_lock);
+  return 0;
+}
+
+/**
+ * Defines or replaces a function.
+ *
+ * Return value: 0 on success, -1 on a syntax error in body
+ */
+int define_function(const char* name, char* body)
+{
+  return define(name, body, 0);
+}
+
+/**
+ * Determines whether name is a defined function or
+ * an alias that can be used right now.
+ *
+ * Return value: 1 if defined, 0 otherwise
+ */
+int is_definition(const char* name)
+{
+  struct definition* d;
+  int found;
+
+  if(!num_definitions) return 0;
+  pthread_mutex_lock(&definitions_lock);
+  d = find_definition(name);
+  found = d && !(d->is_alias && d->running);
+  pthread_mutex_unlock(&definitions_lock);
+  return found;
+}
+
+/**
+ * Appends a word to the argument vector of cmd,
+ * keeping the vector NULL terminated.
+ *
+ * Return value: void
+ */
+static void add_word(struct command* cmd, char* word)
+{
+  cmd->argv = realloc(cmd->argv, sizeof(char*) * (cmd->argc + 2));
+  cmd->argv[cmd->argc++] = word;
+  cmd->argv[cmd->argc] = NULL;
+}
+
+/**
+ * Makes a copy of word with its parameters replaced by
+ * the call's arguments. $@ and $* give the arguments
+ * joined by spaces.
+ *
+ * argv:
+ *     the function name followed by the arguments
+ * argc:
+ *     number of entries in argv
+ *
+ * Return value: the bound word, which the caller frees
+ */
+static char* bind_word(const char* word, char** argv, int argc)
+{
+  char* bound = NULL;
+  size_t len;
+  const char* mark;
+  FILE* out;
+  int i;
+
+  if(!(mark = strchr(word, PARAM_MARK))) return strdup(word);
+  if(!(out = open_memstream(&bound, &len))) return strdup("");
+
+  do {
+    fwrite(word, 1, mark - word, out);
+    if(mark[1] == '#') {
+      fprintf(out, "%d", argc - 1);
+    }
+    else if(mark[1] == '@' || mark[1] == '*') {
+      for(i = 1; i < argc; i++) {
+	fprintf(out, "%s%s", i > 1 ? " " : "", argv[i]);
+      }
+    }
+    else if(mark[1] - '0' < argc) {
+      fputs(argv[mark[1] - '0'], out);
+    }
+    word = mark + 2;
+  } while((mark = strchr(word, PARAM_MARK)));
+  fputs(word, out);
+  fclose(out);
+  return bound;
+}
+
+/**
+ * Copies one pipeline of a body with the call's
+ * arguments bound. A word that is only $@ becomes one
+ * word per argument. For an alias the arguments are
+ * appended to the last command instead.
+ *
+ * argv:
+ *     the name followed by the arguments
+ * append:
+ *       1 to append the arguments to the last command
+ *
+ * Return value: the copy, freed with free_bound_pipeline
+ */
+static struct pipeline* bind_pipeline(const struct pipeline* p, char** argv,
+				      int append)
+{
+  struct pipeline* copy = calloc(1, sizeof(struct pipeline));
+  int argc = 0;
+  int i, j, k;
+
+  while(argv[argc]) argc++;
+
+  copy->bg = p->bg;
+  copy->pipe_size = p->pipe_size;
+  copy->num_commands = p->num_commands;
+  copy->commands = calloc(p->num_commands, sizeof(struct command));
+  for(i = 0; i < p->num_commands; i++) {
+    const struct command* from = &p->commands[i];
+    struct command* to = &copy->commands[i];
+
+    for(j = 0; j < from->argc; j++) {
+      const char* word = from->argv[j];
+      if(word[0] == PARAM_MARK && word[1] == '@' && !word[2]) {
+	for(k = 1; k < argc; k++) add_word(to, strdup(argv[k]));
+      }
+      else {
+	add_word(to, bind_word(word, argv, argc));
+      }
+    }
+    if(append && i == p->num_commands - 1) {
+      for(k = 1; k < argc; k++) add_word(to, strdup(argv[k]));
+    }
+
+    to->num_redirects = from->num_redirects;
+    to->redirects = calloc(from->num_redirects + 1, sizeof(struct redirect));
+    for(j = 0; j < from->num_redirects; j++) {
+      to->redirects[j] = from->redirects[j];
+      if(from->redirects[j].path) {
+	to->redirects[j].path = bind_word(from->redirects[j].path, argv, argc);
+      }
+    }
+  }
+  return copy;
+}
+
+/**
+ * Frees a pipeline made by bind_pipeline.
+ *
+ * Return value: void
+ */
+static void free_bound_pipeline(struct pipeline* p)
+{
+  int i, j;
+
+  for(i = 0; i < p->num_commands; i++) {
+    struct command* cmd = &p->commands[i];
+    for(j = 0; j < cmd->argc; j++) {
+      free(cmd->argv[j]);
+    }
+    for(j = 0; j < cmd->num_redirects; j++) {
+      free(cmd->redirects[j].path);
+    }
+    free(cmd->argv);
+    free(cmd->redirects);
+  }
+  free(p->commands);
+  free(p);
+}
+
+/**
+ * Runs a function or alias in the current process.
+ *
+ * Return value: exit status of the last command run
+ */
+int run_definition(char** argv)
+{
+  struct definition* d;
+  int saved_exec = exec_in_place;
+  int i, last;
+
+  pthread_mutex_lock(&definitions_lock);
+  d = find_definition(argv[0]);
+  if(d && d->is_alias && d->running) d = NULL;
+  if(d) d->running++;
+  pthread_mutex_unlock(&definitions_lock);
+  if(!d) return 127;
+
+  if(call_depth == MAX_CALL_DEPTH) {
+    fprintf(stderr, "Error: %s: functions nested too deeply\n", argv[0]);
+    last_exit_status = 1;
+  }
+  else {
+    // the body goes on after each of its commands
+    exec_in_place = 0;
+    call_depth++;
+    last = d->body->num_pipelines - 1;
+    for(i = 0; i <= last; i++) {
+      struct pipeline* p = bind_pipeline(&d->body->pipelines[i], argv,
+					 d->is_alias && i == last);
+      execute_pipeline(p);
+      free_bound_pipeline(p);
+    }
+    call_depth--;
+    exec_in_place = saved_exec;
+  }
+
+  pthread_mutex_lock(&definitions_lock);
+  if(--d->running == 0 && d->removed) free_definition(d);
+  pthread_mutex_unlock(&definitions_lock);
+  return last_exit_status;
+}
+
+/**
+ * qsort comparison of two definitions by name.
+ *
+ * Return value: <0, 0 or >0 like strcmp
+ */
+static int compare_definitions(const void* a, const void* b)
+{
+  return strcmp((*(struct definition* const*) a)->name,
+		(*(struct definition* const*) b)->name);
+}
+
+/**
+ * Prints every alias as "alias name='value'", sorted
+ * by name. Called with definitions_lock held.
+ *
+ * Return value: void
+ */
+static void list_aliases(FILE* out)
+{
+  struct definition** all = malloc(sizeof(struct definition*) *
+				   (num_definitions + 1));
+  struct definition* d;
+  size_t i, n = 0;
+
+  for(i = 0; i < num_buckets; i++) {
+    for(d = buckets[i]; d; d = d->next) {
+      if(d->is_alias) all[n++] = d;
+    }
+  }
+  qsort(all, n, sizeof(struct definition*), compare_definitions);
+  for(i = 0; i < n; i++) {
+    fprintf(out, "alias %s='%s'\n", all[i]->name, all[i]->text);
+  }
+  free(all);
+}
+
+/**
+ * The alias built-in. Without arguments it lists
+ * the aliases, name=value defines one and a bare
+ * name shows it.
+ *
+ * Return value: 0 on success, 1 on error
+ */
+int alias_command(char** parsed_input, struct builtin_io* io)
+{
+  struct definition* d;
+  int i, status = 0;
+
+  if(!parsed_input[1]) {
+    pthread_mutex_lock(&definitions_lock);
+    list_aliases(io->out);
+    pthread_mutex_unlock(&definitions_lock);
+    return 0;
+  }
+
+  for(i = 1; parsed_input[i]; i++) {
+    char* eq = strchr(parsed_input[i], '=');
+
+    if(eq == parsed_input[i]) {
+      fprintf(io->err, "alias: %s: missing name\n", parsed_input[i]);
+      status = 1;
+    }
+    else if(eq) {
+      *eq = 0;
+      if(define(parsed_input[i], eq + 1, 1) == -1) status = 1;
+      *eq = '=';
+    }
+    else {
+      pthread_mutex_lock(&definitions_lock);
+      d = find_definition(parsed_input[i]);
+      if(d && d->is_alias) {
+	fprintf(io->out, "alias %s='%s'\n", d->name, d->text);
+      }
+      else {
+	fprintf(io->err, "alias: %s: not found\n", parsed_input[i]);
+	status = 1;
+      }
+      pthread_mutex_unlock(&definitions_lock);
+    }
+  }
+  return status;
+}
+
+/**
+ * The unalias built-in, which removes aliases.
+ *
+ * Return value: 0 on success, 1 if a name was not an alias
+ */
+int unalias_command(char** parsed_input, struct builtin_io* io)
+{
+  struct definition* d;
+  int i, status = 0;
+
+  if(!parsed_input[1]) {
+    fprintf(io->err, "usage: unalias name...\n");
+    return 1;
+  }
+
+  pthread_mutex_lock(&definitions_lock);
+  for(i = 1; parsed_input[i]; i++) {
+    if((d = find_definition(parsed_input[i])) && d->is_alias) {
+      remove_definition(d);
+    }
+    else {
+      fprintf(io->err, "unalias: %s: not found\n", parsed_input[i]);
+      status = 1;
+    }
+  }
+  pthread_mutex_unlock(&definitions_lock);
+  return status;
+}
@@ -0,0 +1,68 @@
+/**
+ * This is the header class for functions.c
+ *
+ * These methods keep the shell's aliases and
+ * functions. Bodies are parsed once when they are
+ * defined and kept as parsed commands, so a call
+ * only binds its arguments and runs them.
+ */
+
+#ifndef FUNCTIONS_H
+# define FUNCTIONS_H
+
+#include "command.h"
+
+/**
+ * Defines or replaces a function.
+ *
+ * name:
+ *     name of the function
+ * body:
+ *     the commands between { and }, parsed right away
+ *
+ * Return value: 0 on success, -1 on a syntax error in body
+ */
+int define_function(const char* name, char* body);
+
+/**
+ * Determines whether name is a defined function or
+ * an alias that can be used right now. An alias is
+ * not used again from within its own body, so
+ * alias ls='ls -F' runs the ls from PATH.
+ *
+ * name:
+ *     command name to look up
+ *
+ * Return value: 1 if defined, 0 otherwise
+ */
+int is_definition(const char* name);
+
+/**
+ * Runs a function or alias in the current process.
+ * A function sees its arguments as $1, $2 and so on;
+ * an alias gets them appended to its last command.
+ *
+ * argv:
+ *     the name followed by the arguments
+ *
+ * Return value: exit status of the last command run
+ */
+int run_definition(char** argv);
+
+/**
+ * The alias built-in. Without arguments it lists
+ * the aliases, name=value defines one and a bare
+ * name shows it.
+ *
+ * Return value: 0 on success, 1 on error
+ */
+int alias_command(char** parsed_input, struct builtin_io* io);
+
+/**
+ * The unalias built-in, which removes aliases.
+ *
+ * Return value: 0 on success, 1 if a name was not an alias
+ */
+int unalias_command(char** parsed_input, struct builtin_io* io);
+
+#endif
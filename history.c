@@ -0,0 +1,506 @@
+/**
+ * This C file contains the persistent command history.
+ * Lines are appended to one file under flock, and the
+ * file is read through a shared read-only mapping that
+ * grows with mremap when other sessions append to it,
+ * and is only touched under a shared lock, right after
+ * its size was checked.
+ *
+ * Reverse search keeps, for every block of entries, a
+ * bitmap of the trigrams found in them. A query only
+ * scans the blocks whose bitmap holds all of its own
+ * trigrams, so searching a million entries touches a
+ * few megabytes of bitmaps and a handful of entries.
+ * The entries already in the file at open are indexed
+ * by a thread in the background, later ones as they
+ * are searched.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "history.h"
+
+#define HISTORY_MODE 00600
+// file name used under HOME when MYSHELL_HISTFILE is not set
+#define HISTORY_FILE ".myshell_history"
+// entries sharing one trigram bitmap
+#define HISTORY_BLOCK 32
+// bits in the trigram bitmap of a block
+#define SIGNATURE_BITS 4096
+#define SIGNATURE_WORDS (SIGNATURE_BITS / 64)
+// a query's first trigrams are enough to rule out blocks
+#define MAX_QUERY_TRIGRAMS 16
+// bytes the background indexer reads at once
+#define HISTORY_READ_SIZE 65536
+
+static int history_fd = -1;
+static char* map = NULL;
+// bytes mapped, and the part of them that holds whole entries
+static size_t map_size = 0;
+static size_t map_len = 0;
+
+// the index: start of every entry and a bitmap per block
+static size_t* starts = NULL;
+static size_t num_starts = 0;
+static size_t starts_cap = 0;
+static uint64_t* signatures = NULL;
+static size_t signatures_cap = 0;
+static size_t indexed_end = 0;
+
+// indexes the file as it was at open, and owns the index until joined
+static pthread_t index_thread;
+static int index_thread_running = 0;
+
+// entries are handed out as copies, so no caller touches the mapping
+static char* entry_copy = NULL;
+static size_t entry_copy_cap = 0;
+
+/**
+ * Hashes the trigram at p to a bit of a block bitmap.
+ *
+ * Return value: the bit number
+ */
+static unsigned trigram_bit(const unsigned char* p)
+{
+  uint32_t t = p[0] | (p[1] << 8) | ((uint32_t) p[2] << 16);
+
+  return (t * 0x9E3779B1u) >> (32 - 12);
+}
+
+/**
+ * Waits for the background indexer, after which the
+ * index belongs to the calling thread again.
+ *
+ * Return value: void
+ */
+static void join_indexer()
+{
+  if(!index_thread_running) return;
+  pthread_join(index_thread, NULL);
+  index_thread_running = 0;
+}
+
+/**
+ * Forgets the index, used when the file was truncated.
+ *
+ * Return value: void
+ */
+static void reset_index()
+{
+  join_indexer();
+  num_starts = 0;
+  indexed_end = 0;
+}
+
+/**
+ * Takes a shared lock on the file and brings the
+ * mapping up to date with it. Writers only append
+ * whole lines, or truncate, under an exclusive
+ * lock, so while the shared lock is held the
+ * mapped part ends with a complete entry and no
+ * page of it can vanish under a reader.
+ *
+ * Return value: 0 if the lock is held, -1 without history
+ */
+static int lock_map()
+{
+  struct stat st;
+  size_t size;
+  char* last;
+
+  if(history_fd == -1) return -1;
+  flock(history_fd, LOCK_SH);
+  if(fstat(history_fd, &st) == -1) {
+    flock(history_fd, LOCK_UN);
+    return -1;
+  }
+  size = st.st_size;
+  if(size == map_size) return 0;
+
+  if(size < map_len) {
+    // another session truncated the file, start over
+    reset_index();
+    map_len = 0;
+  }
+
+  if(size == 0) {
+    if(map) munmap(map, map_size);
+    map = NULL;
+  }
+  else if(!map) {
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, history_fd, 0);
+  }
+  else {
+    map = mremap(map, map_size, size, MREMAP_MAYMOVE);
+  }
+  if(map == MAP_FAILED) {
+    map = NULL;
+    size = 0;
+  }
+  map_size = size;
+
+  // ignore a line a writer without the lock left half done
+  last = map ? memrchr(map, '\n', map_size) : NULL;
+  map_len = last ? (size_t) (last - map) + 1 : 0;
+  if(!index_thread_running && indexed_end > map_len) reset_index();
+  return 0;
+}
+
+/**
+ * Drops the lock lock_map took.
+ *
+ * Return value: void
+ */
+static void unlock_map()
+{
+  flock(history_fd, LOCK_UN);
+}
+
+/**
+ * Adds the entry from line up to the new line at end,
+ * starting at offset start of the file, to the index.
+ *
+ * Return value: 0 on success, -1 if out of memory
+ */
+static int index_entry(size_t start, const unsigned char* line,
+		       const unsigned char* end)
+{
+  size_t block = num_starts / HISTORY_BLOCK;
+  uint64_t* sig;
+
+  if(num_starts == starts_cap) {
+    size_t cap = starts_cap ? starts_cap * 2 : 4096;
+    size_t* grown = realloc(starts, sizeof(size_t) * cap);
+    if(!grown) return -1;
+    starts = grown;
+    starts_cap = cap;
+  }
+  if(block >= signatures_cap) {
+    size_t cap = signatures_cap ? signatures_cap * 2 : 256;
+    uint64_t* grown = realloc(signatures,
+			      sizeof(uint64_t) * SIGNATURE_WORDS * cap);
+    if(!grown) return -1;
+    signatures = grown;
+    signatures_cap = cap;
+  }
+  sig = signatures + block * SIGNATURE_WORDS;
+  if(num_starts % HISTORY_BLOCK == 0) {
+    memset(sig, 0, sizeof(uint64_t) * SIGNATURE_WORDS);
+  }
+
+  for(; line + 2 < end; line++) {
+    unsigned bit = trigram_bit(line);
+    sig[bit / 64] |= (uint64_t) 1 << (bit % 64);
+  }
+
+  starts[num_starts++] = start;
+  return 0;
+}
+
+/**
+ * Indexes the entries the file held when it was
+ * opened, so the first reverse search does not have
+ * to. The file is read with pread rather than through
+ * the mapping, which the shell may move meanwhile,
+ * and a read cut short by a truncation just ends the
+ * work early.
+ *
+ * arg:
+ *    offset just past the last entry to index
+ *
+ * Return value: NULL
+ */
+static void* index_in_background(void* arg)
+{
+  size_t end = (size_t) arg, cap = HISTORY_READ_SIZE, have = 0;
+  char* buf = malloc(cap);
+  char *p, *nl;
+  ssize_t n;
+
+  while(buf && indexed_end < end) {
+    // buf holds the file from indexed_end on
+    if(have == cap) {
+      char* grown = realloc(buf, cap * 2);
+      if(!grown) break;
+      buf = grown;
+      cap *= 2;
+    }
+    n = pread(history_fd, buf + have, cap - have, indexed_end + have);
+    if(n <= 0) break;
+    have += n;
+
+    p = buf;
+    while((nl = memchr(p, '\n', buf + have - p)) &&
+	  indexed_end + (nl - p) < end) {
+      if(index_entry(indexed_end, (unsigned char*) p,
+		     (unsigned char*) nl) == -1) {
+	have = 0;
+	end = indexed_end;
+	break;
+      }
+      indexed_end += nl - p + 1;
+      p = nl + 1;
+    }
+    if(have) {
+      have -= p - buf;
+      memmove(buf, p, have);
+    }
+  }
+  free(buf);
+  return NULL;
+}
+
+/**
+ * Opens the history file named by MYSHELL_HISTFILE,
+ * or ~/.myshell_history by default, and maps it. An
+ * empty MYSHELL_HISTFILE turns the history off.
+ *
+ * Return value: 0 on success, -1 if no history is kept
+ */
+int history_open()
+{
+  char path[4096];
+  const char* name = getenv("MYSHELL_HISTFILE");
+  const char* home = getenv("HOME");
+
+  if(history_fd != -1) return 0;
+
+  if(name) {
+    if(!*name) return -1;
+    snprintf(path, sizeof(path), "%s", name);
+  }
+  else {
+    if(!home) return -1;
+    snprintf(path, sizeof(path), "%s/%s", home, HISTORY_FILE);
+  }
+
+  history_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC,
+		    HISTORY_MODE);
+  if(history_fd == -1) return -1;
+  if(lock_map() == -1) return 0;
+  unlock_map();
+
+  if(map_len > 0 && pthread_create(&index_thread, NULL, index_in_background,
+				   (void*) map_len) == 0) {
+    index_thread_running = 1;
+  }
+  return 0;
+}
+
+/**
+ * Picks up entries appended by other sessions.
+ *
+ * Return value: offset just past the newest entry
+ */
+size_t history_end()
+{
+  size_t end;
+
+  if(lock_map() == -1) return 0;
+  end = map_len;
+  unlock_map();
+  return end;
+}
+
+/**
+ * Appends a line to the history file while holding an
+ * exclusive lock, so lines written by concurrent
+ * sessions never interleave. Empty lines and repeats
+ * of the newest entry are not stored.
+ *
+ * Return value: void
+ */
+void history_add(const char* line)
+{
+  struct history_entry newest;
+  struct iovec iov[2];
+  size_t len = strlen(line);
+
+  if(history_fd == -1 || len == 0 || memchr(line, '\n', len)) return;
+
+  if(history_before(history_end(), &newest) == 0 && newest.len == len &&
+     memcmp(newest.text, line, len) == 0) {
+    return;
+  }
+
+  iov[0].iov_base = (void*) line;
+  iov[0].iov_len = len;
+  iov[1].iov_base = "\n";
+  iov[1].iov_len = 1;
+
+  flock(history_fd, LOCK_EX);
+  if(writev(history_fd, iov, 2) != (ssize_t) len + 1) {
+    fprintf(stderr, "history: could not save the command line\n");
+  }
+  flock(history_fd, LOCK_UN);
+}
+
+/**
+ * Fills in the entry starting at offset start with a
+ * copy of its text, made while the mapping is locked.
+ *
+ * Return value: 0 on success, -1 if out of memory
+ */
+static int entry_at(size_t start, struct history_entry* entry)
+{
+  const char* end = memchr(map + start, '\n', map_len - start);
+  size_t len = end - (map + start);
+
+  if(len > entry_copy_cap) {
+    char* grown = realloc(entry_copy, len);
+    if(!grown) return -1;
+    entry_copy = grown;
+    entry_copy_cap = len;
+  }
+  memcpy(entry_copy, map + start, len);
+  entry->start = start;
+  entry->text = entry_copy;
+  entry->len = len;
+  return 0;
+}
+
+/**
+ * Finds the entry right before offset.
+ *
+ * Return value: 0 if found, -1 at the oldest entry
+ */
+int history_before(size_t offset, struct history_entry* entry)
+{
+  const char* prev;
+  int found = -1;
+
+  if(lock_map() == -1) return -1;
+  if(offset > map_len) offset = map_len;
+  if(offset > 0) {
+    // offset - 1 is the new line ending the entry we want
+    prev = offset > 1 ? memrchr(map, '\n', offset - 1) : NULL;
+    found = entry_at(prev ? (size_t) (prev - map) + 1 : 0, entry);
+  }
+  unlock_map();
+  return found;
+}
+
+/**
+ * Finds the entry right after the one starting at offset.
+ *
+ * Return value: 0 if found, -1 at the newest entry
+ */
+int history_after(size_t offset, struct history_entry* entry)
+{
+  const char* end;
+  size_t next;
+  int found = -1;
+
+  if(lock_map() == -1) return -1;
+  if(offset < map_len) {
+    end = memchr(map + offset, '\n', map_len - offset);
+    next = (size_t) (end - map) + 1;
+    if(next < map_len) found = entry_at(next, entry);
+  }
+  unlock_map();
+  return found;
+}
+
+/**
+ * Adds the entries appended since the last search to
+ * the index.
+ *
+ * Return value: 0 on success, -1 if out of memory
+ */
+static int extend_index()
+{
+  join_indexer();
+  while(indexed_end < map_len) {
+    const unsigned char* line = (const unsigned char*) map + indexed_end;
+    const unsigned char* end = memchr(line, '\n', map_len - indexed_end);
+
+    if(index_entry(indexed_end, line, end) == -1) return -1;
+    indexed_end = (size_t) ((const char*) end - map) + 1;
+  }
+  return 0;
+}
+
+/**
+ * Determines whether a block may hold an entry
+ * containing every trigram in bits.
+ *
+ * Return value: 1 if it may, 0 if it cannot
+ */
+static int block_may_match(size_t block, const unsigned* bits, int num_bits)
+{
+  const uint64_t* sig = signatures + block * SIGNATURE_WORDS;
+  int i;
+
+  for(i = 0; i < num_bits; i++) {
+    if(!(sig[bits[i] / 64] & ((uint64_t) 1 << (bits[i] % 64)))) return 0;
+  }
+  return 1;
+}
+
+/**
+ * Finds the newest entry starting before offset that
+ * contains query. Queries shorter than a trigram scan
+ * entries newest first without the index.
+ *
+ * Return value: 0 if found, -1 otherwise
+ */
+int history_search(const char* query, size_t len, size_t before,
+		   struct history_entry* entry)
+{
+  unsigned bits[MAX_QUERY_TRIGRAMS];
+  int num_bits = 0, found;
+  size_t lo = 0, hi, i;
+
+  if(len == 0 || lock_map() == -1) return -1;
+  if(extend_index() == -1) {
+    unlock_map();
+    return -1;
+  }
+
+  for(i = 0; i + 2 < len && num_bits < MAX_QUERY_TRIGRAMS; i++) {
+    bits[num_bits++] = trigram_bit((const unsigned char*) query + i);
+  }
+
+  // i becomes the number of entries starting before before
+  hi = num_starts;
+  while(lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if(starts[mid] < before) lo = mid + 1;
+    else hi = mid;
+  }
+  i = lo;
+
+  while(i > 0) {
+    size_t block = (i - 1) / HISTORY_BLOCK;
+    size_t first = block * HISTORY_BLOCK;
+
+    if(num_bits && !block_may_match(block, bits, num_bits)) {
+      i = first;
+      continue;
+    }
+    for(; i > first; i--) {
+      size_t start = starts[i - 1];
+      size_t end = i < num_starts ? starts[i] - 1 : map_len - 1;
+
+      if(memmem(map + start, end - start, query, len)) {
+	found = entry_at(start, entry);
+	unlock_map();
+	return found;
+      }
+    }
+  }
+  unlock_map();
+  return -1;
+}
@@ -0,0 +1,104 @@
+/**
+ * This is the header class for history.c
+ *
+ * These methods keep the persistent command history:
+ * one append-only file shared by every interactive
+ * session and read through mmap, so starting a shell
+ * never copies the history into memory. Reverse
+ * search uses a trigram index built in the background
+ * when the history is opened and extended as the file
+ * grows.
+ *
+ * Entries are named by the byte offset where they
+ * start in the file, which stays valid while other
+ * sessions append.
+ */
+
+#ifndef HISTORY_H
+# define HISTORY_H
+
+#include <stddef.h>
+
+/**
+ * One history entry. text is a copy of the entry
+ * and is only valid until the next call into this
+ * module; it is not NUL terminated.
+ */
+struct history_entry {
+  size_t start;
+  size_t len;
+  const char* text;
+};
+
+/**
+ * Opens the history file named by MYSHELL_HISTFILE,
+ * or ~/.myshell_history by default, and maps it. An
+ * empty MYSHELL_HISTFILE turns the history off.
+ *
+ * Return value: 0 on success, -1 if no history is kept
+ */
+int history_open();
+
+/**
+ * Appends a line to the history file while holding an
+ * exclusive lock, so lines written by concurrent
+ * sessions never interleave. Empty lines and repeats
+ * of the newest entry are not stored.
+ *
+ * line:
+ *     the command line, without a new line
+ *
+ * Return value: void
+ */
+void history_add(const char* line);
+
+/**
+ * Picks up entries appended by other sessions.
+ *
+ * Return value: offset just past the newest entry
+ */
+size_t history_end();
+
+/**
+ * Finds the entry right before offset.
+ *
+ * offset:
+ *       start of an entry, or history_end()
+ * entry:
+ *      filled in with the entry found
+ *
+ * Return value: 0 if found, -1 at the oldest entry
+ */
+int history_before(size_t offset, struct history_entry* entry);
+
+/**
+ * Finds the entry right after the one starting at offset.
+ *
+ * offset:
+ *       start of an entry
+ * entry:
+ *      filled in with the entry found
+ *
+ * Return value: 0 if found, -1 at the newest entry
+ */
+int history_after(size_t offset, struct history_entry* entry);
+
+/**
+ * Finds the newest entry starting before offset that
+ * contains query.
+ *
+ * query:
+ *      bytes to look for
+ * len:
+ *    length of query
+ * before:
+ *       only entries starting before this offset are searched
+ * entry:
+ *      filled in with the entry found
+ *
+ * Return value: 0 if found, -1 otherwise
+ */
+int history_search(const char* query, size_t len, size_t before,
+		   struct history_entry* entry);
+
+#endif
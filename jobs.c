@@ -0,0 +1,325 @@
+/**
+ * This C file contains the table of child processes
+ * the shell has started without waiting for them:
+ * background commands and the producers/consumers
+ * of process substitutions. It also waits for
+ * foreground jobs that run under a deadline.
+ *
+ * While the main thread waits for a foreground child
+ * it also starts the queued background jobs the
+ * scheduler lets through, so they never wait behind
+ * a long foreground command.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "jobs.h"
+#include "audit.h"
+#include "jobsched.h"
+#include "stats.h"
+
+// the background job scheduler runs on a thread of its own
+static pthread_mutex_t children_lock = PTHREAD_MUTEX_INITIALIZER;
+static pid_t* children = NULL;
+static int num_children = 0;
+static int cap_children = 0;
+
+/**
+ * Stops tracking a child, if it is tracked.
+ *
+ * Return value: void
+ */
+static void untrack_child(pid_t pid)
+{
+  int i;
+
+  pthread_mutex_lock(&children_lock);
+  for(i = 0; i < num_children; i++) {
+    if(children[i] == pid) {
+      children[i] = children[--num_children];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&children_lock);
+}
+
+/**
+ * Starts tracking a child process that runs
+ * while the shell moves on.
+ *
+ * pid:
+ *    process id of the child
+ *
+ * Return value: void
+ */
+void track_child(pid_t pid)
+{
+  pthread_mutex_lock(&children_lock);
+  if(num_children == cap_children) {
+    cap_children = cap_children ? cap_children * 2 : 16;
+    children = realloc(children, sizeof(pid_t) * cap_children);
+    if(!children) {
+      fprintf(stderr, "Error: Out of memory while tracking children\n");
+      exit(1);
+    }
+  }
+  children[num_children++] = pid;
+  pthread_mutex_unlock(&children_lock);
+}
+
+/**
+ * Blocks until a child has exited, without reaping
+ * it. On the shell's main thread the queued jobs that
+ * become ready meanwhile are started; elsewhere, and
+ * on kernels without pidfds, wait4 does the waiting.
+ *
+ * Return value: void
+ */
+void wait_exit(pid_t pid)
+{
+  struct pollfd fds[2];
+
+  if((fds[1].fd = jobsched_ready_fd()) == -1) return;
+  fds[1].events = POLLIN;
+  if((fds[0].fd = syscall(SYS_pidfd_open, pid, 0)) == -1) return;
+  fds[0].events = POLLIN;
+
+  while(1) {
+    if(poll(fds, 2, -1) == -1) {
+      if(errno == EINTR) continue;
+      break;
+    }
+    if(fds[0].revents) break;
+    if(fds[1].revents) jobsched_start_ready();
+  }
+  close(fds[0].fd);
+}
+
+/**
+ * Waits for a tracked child to exit and stops
+ * tracking it.
+ *
+ * pid:
+ *    process id of the child
+ *
+ * Return value: the child's exit status, see shell_status
+ */
+int wait_child(pid_t pid)
+{
+  struct rusage usage;
+  int status = 0;
+
+  wait_exit(pid);
+  while(wait4(pid, &status, 0, &usage) == -1 && errno == EINTR);
+
+  untrack_child(pid);
+  audit_exit(0, pid, shell_status(status));
+  stats_reaped(pid, shell_status(status), &usage);
+  return shell_status(status);
+}
+
+/**
+ * Reaps one child if it has exited, without blocking.
+ *
+ * pid:
+ *    process id of the child
+ *
+ * Return value: void
+ */
+void reap_child(pid_t pid)
+{
+  struct rusage usage;
+  int status;
+
+  if(wait4(pid, &status, WNOHANG, &usage) == pid) {
+    untrack_child(pid);
+    audit_exit(0, pid, shell_status(status));
+    stats_reaped(pid, shell_status(status), &usage);
+  }
+}
+
+/**
+ * Arms timer to fire once, ms milliseconds from now.
+ *
+ * Return value: void
+ */
+static void arm_timer(int timer, long ms)
+{
+  struct itimerspec when = { { 0, 0 }, { ms / 1000, (ms % 1000) * 1000000 } };
+
+  timerfd_settime(timer, 0, &when, NULL);
+}
+
+/**
+ * Waits for every process of a foreground job while
+ * a timerfd tracks its deadline; each child is
+ * watched through a pidfd, so the shell sleeps in one
+ * poll until a child exits or the timer fires. When
+ * the deadline passes the job's process group gets
+ * SIGTERM, and SIGKILL kill_after_ms later if any of
+ * it is still running.
+ *
+ * Return value: 1 if the deadline passed, 0 otherwise
+ */
+int wait_job(const pid_t* pids, int n, pid_t pgid, long timeout_ms,
+	     long kill_after_ms, int* statuses)
+{
+  struct pollfd* fds = calloc(n + 2, sizeof(struct pollfd));
+  int i, remaining = 0, signals_sent = 0;
+  int timer = -1;
+
+  for(i = 0; i < n; i++) {
+    statuses[i] = 0;
+    fds[i].fd = -1;
+    fds[i].events = POLLIN;
+    if(pids[i] <= 0) continue;
+
+    fds[i].fd = syscall(SYS_pidfd_open, pids[i], 0);
+    if(fds[i].fd == -1) {
+      // without pidfds (before Linux 5.3) fall back on a plain wait
+      statuses[i] = wait_child(pids[i]);
+      continue;
+    }
+    remaining++;
+  }
+
+  if(timeout_ms > 0 && remaining > 0) {
+    timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if(timer != -1) arm_timer(timer, timeout_ms);
+  }
+  fds[n].fd = timer;
+  fds[n].events = POLLIN;
+  // queued background jobs start while this one runs
+  fds[n + 1].fd = jobsched_ready_fd();
+  fds[n + 1].events = POLLIN;
+
+  while(remaining > 0) {
+    if(poll(fds, n + 2, -1) == -1) {
+      if(errno == EINTR) continue;
+      break;
+    }
+
+    for(i = 0; i < n; i++) {
+      if(fds[i].fd == -1 || !(fds[i].revents & POLLIN)) continue;
+      statuses[i] = wait_child(pids[i]);
+      close(fds[i].fd);
+      fds[i].fd = -1;
+      remaining--;
+    }
+
+    if(timer != -1 && (fds[n].revents & POLLIN)) {
+      unsigned long long expirations;
+
+      if(read(timer, &expirations, sizeof(expirations)) <= 0) continue;
+      if(signals_sent++ == 0) {
+	kill(-pgid, SIGTERM);
+	// a stopped process only acts on SIGTERM once continued
+	kill(-pgid, SIGCONT);
+	arm_timer(timer, kill_after_ms);
+      }
+      else {
+	kill(-pgid, SIGKILL);
+      }
+    }
+    if(fds[n + 1].revents & POLLIN) jobsched_start_ready();
+  }
+
+  // anything left here could not be polled, wait for it plainly
+  for(i = 0; i < n; i++) {
+    if(fds[i].fd == -1) continue;
+    statuses[i] = wait_child(pids[i]);
+    close(fds[i].fd);
+  }
+  if(timer != -1) close(timer);
+  free(fds);
+  return signals_sent > 0;
+}
+
+/**
+ * Makes a job's process group the foreground group
+ * of the shell's terminal, if the shell has one.
+ *
+ * Return value: 1 if the terminal was handed over, 0 otherwise
+ */
+int give_terminal(pid_t pgid)
+{
+  if(!isatty(STDIN_FILENO) || tcgetpgrp(STDIN_FILENO) != getpgrp()) return 0;
+  return tcsetpgrp(STDIN_FILENO, pgid) == 0;
+}
+
+/**
+ * Makes the shell the foreground group of its
+ * terminal again after give_terminal.
+ *
+ * Return value: void
+ */
+void take_terminal()
+{
+  sigset_t ttou, saved;
+
+  // a background group changing the foreground group gets SIGTTOU
+  sigemptyset(&ttou);
+  sigaddset(&ttou, SIGTTOU);
+  sigprocmask(SIG_BLOCK, &ttou, &saved);
+  tcsetpgrp(STDIN_FILENO, getpgrp());
+  sigprocmask(SIG_SETMASK, &saved, NULL);
+}
+
+/**
+ * Reaps every child that has exited, without blocking.
+ *
+ * Return value: void
+ */
+void reap_children()
+{
+  struct rusage usage;
+  pid_t pid;
+  int status;
+
+  while((pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+    untrack_child(pid);
+    audit_exit(0, pid, shell_status(status));
+    stats_reaped(pid, shell_status(status), &usage);
+  }
+}
+
+/**
+ * Returns the number of tracked children still running.
+ *
+ * Return value: number of children
+ */
+int running_children()
+{
+  int n;
+
+  pthread_mutex_lock(&children_lock);
+  n = num_children;
+  pthread_mutex_unlock(&children_lock);
+  return n;
+}
+
+/**
+ * Converts a status from waitpid into the shell
+ * convention: the exit code, or 128 + signal number
+ * for a child that was killed.
+ *
+ * Return value: the converted status
+ */
+int shell_status(int wait_status)
+{
+  if(WIFEXITED(wait_status)) return WEXITSTATUS(wait_status);
+  if(WIFSIGNALED(wait_status)) return 128 + WTERMSIG(wait_status);
+  return 0;
+}
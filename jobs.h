@@ -0,0 +1,130 @@
+/**
+ * This is the header class for jobs.c
+ *
+ * These methods keep track of the child processes
+ * the shell starts and does not wait for right away,
+ * so every one of them is reaped exactly once.
+ */
+
+#ifndef JOBS_H
+# define JOBS_H
+
+#include <sys/types.h>
+
+// exit status of a job stopped by its timeout
+#define TIMEOUT_STATUS 124
+
+/**
+ * Starts tracking a child process that runs
+ * while the shell moves on.
+ *
+ * pid:
+ *    process id of the child
+ *
+ * Return value: void
+ */
+void track_child(pid_t pid);
+
+/**
+ * Blocks until a child has exited, without reaping
+ * it. On the shell's main thread the queued jobs that
+ * become ready meanwhile are started.
+ *
+ * pid:
+ *    process id of the child
+ *
+ * Return value: void
+ */
+void wait_exit(pid_t pid);
+
+/**
+ * Waits for a tracked child to exit and stops
+ * tracking it.
+ *
+ * pid:
+ *    process id of the child
+ *
+ * Return value: the child's exit status, see shell_status
+ */
+int wait_child(pid_t pid);
+
+/**
+ * Reaps one child if it has exited, without blocking.
+ *
+ * pid:
+ *    process id of the child
+ *
+ * Return value: void
+ */
+void reap_child(pid_t pid);
+
+/**
+ * Waits for every process of a foreground job while
+ * a timerfd tracks its deadline; each child is
+ * watched through a pidfd, so the shell sleeps in one
+ * poll until a child exits or the timer fires. When
+ * the deadline passes the job's process group gets
+ * SIGTERM, and SIGKILL kill_after_ms later if any of
+ * it is still running.
+ *
+ * pids:
+ *     process ids of the job, entries <= 0 are skipped
+ * n:
+ *  number of entries in pids
+ * pgid:
+ *     process group of the job
+ * timeout_ms:
+ *           time the job may run, 0 for no limit
+ * kill_after_ms:
+ *              time between SIGTERM and SIGKILL
+ * statuses:
+ *         set to the exit status of every process, see shell_status
+ *
+ * Return value: 1 if the deadline passed, 0 otherwise
+ */
+int wait_job(const pid_t* pids, int n, pid_t pgid, long timeout_ms,
+	     long kill_after_ms, int* statuses);
+
+/**
+ * Makes a job's process group the foreground group
+ * of the shell's terminal, if the shell has one.
+ *
+ * pgid:
+ *     process group of the job
+ *
+ * Return value: 1 if the terminal was handed over, 0 otherwise
+ */
+int give_terminal(pid_t pgid);
+
+/**
+ * Makes the shell the foreground group of its
+ * terminal again after give_terminal.
+ *
+ * Return value: void
+ */
+void take_terminal();
+
+/**
+ * Reaps every child that has exited, without blocking.
+ *
+ * Return value: void
+ */
+void reap_children();
+
+/**
+ * Returns the number of tracked children still running.
+ *
+ * Return value: number of children
+ */
+int running_children();
+
+/**
+ * Converts a status from waitpid into the shell
+ * convention: the exit code, or 128 + signal number
+ * for a child that was killed.
+ *
+ * Return value: the converted status
+ */
+int shell_status(int wait_status);
+
+#endif
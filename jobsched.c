@@ -0,0 +1,629 @@
+/**
+ * This C file contains the background job scheduler.
+ * Once a limit is set, every background pipeline is
+ * copied into a priority queue and a scheduler thread
+ * lets jobs start while fewer than maxjobs run and
+ * the load average and pressure stall information are
+ * below their limits.
+ *
+ * The thread sleeps in poll on one pidfd per running
+ * process, an eventfd the shell writes to when a job is
+ * queued or a limit changes, and a timerfd that checks
+ * the load again while it holds jobs back.
+ *
+ * The thread only decides when a job may start. The
+ * job itself is started by the shell's main thread,
+ * which is the one that forks built-ins and writes to
+ * stdout: the thread moves the job to a ready list and
+ * signals a second eventfd, which the main thread
+ * polls while it waits at the prompt or for a
+ * foreground job, and checks between command lines.
+ * A job starts in the directory it was queued in:
+ * each of its processes enters it after the fork, so
+ * the shell stays where it is.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+#include "jobsched.h"
+#include "commands.h"
+#include "jobs.h"
+#include "options.h"
+
+// seconds between load checks while jobs are held back
+#define GATE_RECHECK_SEC 1
+
+struct queued_job {
+  struct pipeline* p;
+  char* cwd;
+  int priority;
+  unsigned long seq;
+};
+
+/**
+ * A running job: one pidfd per process still running,
+ * -1 once it has exited.
+ */
+struct running_job {
+  pid_t* pids;
+  int* pidfds;
+  int num_pids;
+  int alive;
+};
+
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_changed = PTHREAD_COND_INITIALIZER;
+static int scheduler_started = 0;
+static int wake_fd = -1;
+// signalled when jobs are ready for the main thread to start,
+// of the shell that made it rather than a forked child
+static int ready_fd = -1;
+static pid_t ready_owner = 0;
+
+// binary heap ordered by priority, then by submission order
+static struct queued_job* queue = NULL;
+static int queue_len = 0;
+static int queue_cap = 0;
+static unsigned long next_seq = 0;
+
+static struct running_job* running = NULL;
+static int num_running = 0;
+static int running_cap = 0;
+
+// jobs allowed to start, oldest first, that the main thread
+// has not started yet; starting also counts the one it is on
+static struct queued_job* ready = NULL;
+static int ready_len = 0;
+static int ready_cap = 0;
+static int starting = 0;
+
+/**
+ * Determines whether job a should start before job b.
+ *
+ * Return value: 1 if a goes first, 0 otherwise
+ */
+static int runs_before(const struct queued_job* a, const struct queued_job* b)
+{
+  if(a->priority != b->priority) return a->priority > b->priority;
+  return a->seq < b->seq;
+}
+
+/**
+ * Adds a job to the queue.
+ *
+ * Return value: void
+ */
+static void queue_push(struct queued_job job)
+{
+  int i = queue_len++;
+
+  if(queue_len > queue_cap) {
+    queue_cap = queue_cap ? queue_cap * 2 : 64;
+    queue = realloc(queue, sizeof(struct queued_job) * queue_cap);
+  }
+  while(i > 0 && runs_before(&job, &queue[(i - 1) / 2])) {
+    queue[i] = queue[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  queue[i] = job;
+}
+
+/**
+ * Removes the job that should start next.
+ *
+ * Return value: the job
+ */
+static struct queued_job queue_pop()
+{
+  struct queued_job top = queue[0];
+  struct queued_job last = queue[--queue_len];
+  int i = 0;
+
+  while(2 * i + 1 < queue_len) {
+    int child = 2 * i + 1;
+    if(child + 1 < queue_len && runs_before(&queue[child + 1], &queue[child])) {
+      child++;
+    }
+    if(!runs_before(&queue[child], &last)) break;
+    queue[i] = queue[child];
+    i = child;
+  }
+  if(queue_len > 0) queue[i] = last;
+  return top;
+}
+
+/**
+ * Copies a pipeline so it outlives the command line
+ * it was parsed from. The shell's descriptors a
+ * redirection copies from, of a here-document or a
+ * coprocess, are duplicated since the shell may
+ * close its own first.
+ *
+ * Return value: the copy
+ */
+static struct pipeline* copy_pipeline(const struct pipeline* p)
+{
+  struct pipeline* copy = calloc(1, sizeof(struct pipeline));
+  int i, j;
+
+  copy->bg = p->bg;
+  copy->pipe_size = p->pipe_size;
+  copy->num_commands = p->num_commands;
+  copy->commands = calloc(p->num_commands, sizeof(struct command));
+  for(i = 0; i < p->num_commands; i++) {
+    const struct command* from = &p->commands[i];
+    struct command* to = &copy->commands[i];
+
+    to->argc = from->argc;
+    to->argv = calloc(from->argc + 1, sizeof(char*));
+    for(j = 0; j < from->argc; j++) {
+      to->argv[j] = strdup(from->argv[j]);
+    }
+
+    to->num_redirects = from->num_redirects;
+    to->redirects = calloc(from->num_redirects + 1, sizeof(struct redirect));
+    for(j = 0; j < from->num_redirects; j++) {
+      to->redirects[j] = from->redirects[j];
+      if(from->redirects[j].path) {
+	to->redirects[j].path = strdup(from->redirects[j].path);
+      }
+      if(from->redirects[j].kind == REDIRECT_HEREDOC ||
+	 from->redirects[j].kind == REDIRECT_COPROC) {
+	to->redirects[j].src_fd = fcntl(from->redirects[j].src_fd,
+					F_DUPFD_CLOEXEC, 0);
+      }
+    }
+  }
+  return copy;
+}
+
+/**
+ * Frees a pipeline made by copy_pipeline.
+ *
+ * Return value: void
+ */
+static void free_pipeline(struct pipeline* p)
+{
+  int i, j;
+
+  for(i = 0; i < p->num_commands; i++) {
+    struct command* cmd = &p->commands[i];
+    for(j = 0; j < cmd->argc; j++) {
+      free(cmd->argv[j]);
+    }
+    for(j = 0; j < cmd->num_redirects; j++) {
+      free(cmd->redirects[j].path);
+      if(cmd->redirects[j].kind == REDIRECT_HEREDOC ||
+	 cmd->redirects[j].kind == REDIRECT_COPROC) {
+	close(cmd->redirects[j].src_fd);
+      }
+    }
+    free(cmd->argv);
+    free(cmd->redirects);
+  }
+  free(p->commands);
+  free(p);
+}
+
+/**
+ * Determines whether a pipeline names one of the
+ * shell's own descriptors through /dev/fd, as process
+ * substitutions do. Those are closed once the line is
+ * done, so such a job cannot wait in the queue.
+ *
+ * Return value: 1 if it does, 0 otherwise
+ */
+static int uses_shell_fds(const struct pipeline* p)
+{
+  int i, j;
+
+  for(i = 0; i < p->num_commands; i++) {
+    for(j = 0; j < p->commands[i].argc; j++) {
+      if(strncmp(p->commands[i].argv[j], "/dev/fd/", 8) == 0) return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Reads the 1-minute load average.
+ *
+ * Return value: the load average, 0 if it cannot be read
+ */
+static double load_average()
+{
+  FILE* f = fopen("/proc/loadavg", "re");
+  double load = 0;
+
+  if(!f) return 0;
+  if(fscanf(f, "%lf", &load) != 1) load = 0;
+  fclose(f);
+  return load;
+}
+
+/**
+ * Reads the "some avg10" stall percentage of one
+ * /proc/pressure file.
+ *
+ * Return value: the percentage, 0 without PSI support
+ */
+static double pressure(const char* path)
+{
+  FILE* f = fopen(path, "re");
+  double avg10 = 0;
+
+  if(!f) return 0;
+  if(fscanf(f, "some avg10=%lf", &avg10) != 1) avg10 = 0;
+  fclose(f);
+  return avg10;
+}
+
+/**
+ * Determines whether the machine has room for another
+ * job according to maxload and maxpressure.
+ *
+ * Return value: 1 if a job may start, 0 otherwise
+ */
+static int gate_open()
+{
+  if(options.maxload && load_average() >= options.maxload) return 0;
+  if(options.maxpressure &&
+     (pressure("/proc/pressure/cpu") >= options.maxpressure ||
+      pressure("/proc/pressure/memory") >= options.maxpressure)) {
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * Determines whether any limit is set.
+ *
+ * Return value: 1 if jobs go through the scheduler, 0 otherwise
+ */
+static int limits_set()
+{
+  return options.maxjobs || options.maxload || options.maxpressure;
+}
+
+/**
+ * Moves a job that may start to the ready list and
+ * tells the main thread. The job holds a slot from
+ * now on. Called with sched_lock held.
+ *
+ * Return value: void
+ */
+static void hand_over(struct queued_job job)
+{
+  unsigned long long one = 1;
+
+  if(ready_len == ready_cap) {
+    ready_cap = ready_cap ? ready_cap * 2 : 16;
+    ready = realloc(ready, sizeof(struct queued_job) * ready_cap);
+  }
+  ready[ready_len++] = job;
+  starting++;
+  if(write(ready_fd, &one, sizeof(one)) < 0) {
+    fprintf(stderr, "Error: Could not signal a ready job\n");
+  }
+  pthread_cond_broadcast(&queue_changed);
+}
+
+/**
+ * Decides which queued jobs may start while the limits
+ * allow it and hands them to the main thread. Called
+ * with sched_lock held.
+ *
+ * Return value: 1 if jobs are held back by the load, 0 otherwise
+ */
+static int start_jobs()
+{
+  while(queue_len > 0 &&
+	(!options.maxjobs || num_running + starting < options.maxjobs)) {
+    if(!gate_open()) return 1;
+    hand_over(queue_pop());
+  }
+  return 0;
+}
+
+/**
+ * Notes the processes of running jobs that exited and
+ * drops the jobs that are done. The main thread may
+ * have added jobs since the poll, so pidfds are
+ * looked up in fds rather than taken in order; the
+ * ones polled are still open, so their numbers are
+ * unique. Called with sched_lock held.
+ *
+ * fds:
+ *    the pollfds that were polled
+ * n:
+ *  number of pidfds among them
+ *
+ * Return value: void
+ */
+static void collect_exits(struct pollfd* fds, int n)
+{
+  int i, j, k;
+
+  for(i = 0; i < num_running; i++) {
+    struct running_job* r = &running[i];
+    for(j = 0; j < r->num_pids; j++) {
+      if(r->pidfds[j] == -1) continue;
+      for(k = 0; k < n && fds[k].fd != r->pidfds[j]; k++);
+      if(k < n && fds[k].revents) {
+	close(r->pidfds[j]);
+	r->pidfds[j] = -1;
+	reap_child(r->pids[j]);
+	r->alive--;
+      }
+    }
+  }
+
+  for(i = 0; i < num_running; ) {
+    if(running[i].alive == 0) {
+      free(running[i].pids);
+      free(running[i].pidfds);
+      running[i] = running[--num_running];
+    }
+    else {
+      i++;
+    }
+  }
+}
+
+/**
+ * Body of the scheduler thread.
+ *
+ * Return value: NULL
+ */
+static void* scheduler_thread(void* arg)
+{
+  int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  struct pollfd* fds = NULL;
+  int fds_cap = 0;
+
+  while(1) {
+    struct itimerspec recheck = { { 0, 0 }, { 0, 0 } };
+    int i, j, n = 0, held;
+
+    pthread_mutex_lock(&sched_lock);
+    held = start_jobs();
+
+    for(i = 0; i < num_running; i++) {
+      if(n + running[i].alive + 2 > fds_cap) {
+	fds_cap = (n + running[i].alive + 2) * 2;
+	fds = realloc(fds, sizeof(struct pollfd) * fds_cap);
+      }
+      for(j = 0; j < running[i].num_pids; j++) {
+	if(running[i].pidfds[j] == -1) continue;
+	fds[n].fd = running[i].pidfds[j];
+	fds[n++].events = POLLIN;
+      }
+    }
+    pthread_mutex_unlock(&sched_lock);
+
+    if(n + 2 > fds_cap) {
+      fds_cap = n + 2;
+      fds = realloc(fds, sizeof(struct pollfd) * fds_cap);
+    }
+    fds[n].fd = wake_fd;
+    fds[n].events = POLLIN;
+    fds[n + 1].fd = timer;
+    fds[n + 1].events = POLLIN;
+    recheck.it_value.tv_sec = held ? GATE_RECHECK_SEC : 0;
+    timerfd_settime(timer, 0, &recheck, NULL);
+
+    if(poll(fds, n + 2, -1) == -1) continue;
+
+    if(fds[n].revents) {
+      unsigned long long count;
+      if(read(wake_fd, &count, sizeof(count)) < 0) continue;
+    }
+    if(fds[n + 1].revents) {
+      unsigned long long count;
+      if(read(timer, &count, sizeof(count)) < 0) continue;
+    }
+
+    pthread_mutex_lock(&sched_lock);
+    collect_exits(fds, n);
+    pthread_mutex_unlock(&sched_lock);
+  }
+  return NULL;
+}
+
+/**
+ * Wakes the scheduler thread.
+ *
+ * Return value: void
+ */
+static void wake_scheduler()
+{
+  unsigned long long one = 1;
+
+  if(wake_fd != -1 && write(wake_fd, &one, sizeof(one)) < 0) {
+    fprintf(stderr, "Error: Could not wake the job scheduler\n");
+  }
+}
+
+/**
+ * Starts a job from the ready list on the main thread
+ * and hands its processes to the scheduler to watch.
+ *
+ * Return value: void
+ */
+static void start_job(struct queued_job* job)
+{
+  struct running_job r;
+  int i;
+
+  // the job's processes enter its directory, the shell stays put
+  for(i = 0; i < job->p->num_commands; i++) {
+    job->p->commands[i].cwd = job->cwd;
+  }
+
+  r.pids = calloc(job->p->num_commands, sizeof(pid_t));
+  r.pidfds = calloc(job->p->num_commands, sizeof(int));
+  r.num_pids = start_background(job->p, r.pids);
+  r.alive = 0;
+  for(i = 0; i < r.num_pids; i++) {
+    r.pidfds[i] = syscall(SYS_pidfd_open, r.pids[i], 0);
+    if(r.pidfds[i] != -1) r.alive++;
+  }
+  free_pipeline(job->p);
+  free(job->cwd);
+
+  pthread_mutex_lock(&sched_lock);
+  starting--;
+  // a job that cannot be watched does not hold a slot
+  if(r.alive == 0) {
+    free(r.pids);
+    free(r.pidfds);
+  }
+  else {
+    if(num_running == running_cap) {
+      running_cap = running_cap ? running_cap * 2 : 16;
+      running = realloc(running, sizeof(struct running_job) * running_cap);
+    }
+    running[num_running++] = r;
+  }
+  pthread_cond_broadcast(&queue_changed);
+  pthread_mutex_unlock(&sched_lock);
+  wake_scheduler();
+}
+
+/**
+ * Hands a background pipeline to the scheduler. The
+ * scheduler keeps its own copy, so p may be freed as
+ * soon as this returns.
+ *
+ * Return value: 0 if the scheduler took the job, -1 if no
+ *               limit is set and the caller should start it
+ */
+int jobsched_submit(struct pipeline* p, int priority)
+{
+  struct queued_job job;
+  pthread_t thread;
+
+  if(!limits_set() || uses_shell_fds(p)) return -1;
+
+  if(!scheduler_started) {
+    if(jobsched_ready_fd() == -1) return -1;
+    if((wake_fd = eventfd(0, EFD_CLOEXEC)) == -1) return -1;
+    if(pthread_create(&thread, NULL, scheduler_thread, NULL) != 0) {
+      close(wake_fd);
+      wake_fd = -1;
+      return -1;
+    }
+    pthread_detach(thread);
+    scheduler_started = 1;
+  }
+
+  if(!(job.cwd = getcwd(NULL, 0))) return -1;
+  job.p = copy_pipeline(p);
+  job.priority = priority;
+
+  pthread_mutex_lock(&sched_lock);
+  job.seq = next_seq++;
+  queue_push(job);
+  pthread_mutex_unlock(&sched_lock);
+  wake_scheduler();
+  return 0;
+}
+
+/**
+ * Determines whether the caller is the main thread of
+ * the shell, not another thread or a forked child.
+ *
+ * Return value: 1 if true, 0 otherwise
+ */
+static int on_main_thread()
+{
+  pid_t pid = getpid();
+
+  return gettid() == pid && (!ready_owner || ready_owner == pid);
+}
+
+/**
+ * Returns the descriptor that becomes readable when
+ * queued jobs are ready to start, creating it on the
+ * first call.
+ *
+ * Return value: the descriptor, -1 on error or when not
+ *               called on the main thread of the shell
+ */
+int jobsched_ready_fd()
+{
+  if(!on_main_thread()) return -1;
+  if(ready_fd == -1) {
+    ready_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    ready_owner = getpid();
+  }
+  return ready_fd;
+}
+
+/**
+ * Starts the jobs the scheduler has let through.
+ *
+ * Return value: void
+ */
+void jobsched_start_ready()
+{
+  unsigned long long count;
+  struct queued_job job;
+
+  if(ready_fd == -1 || !on_main_thread()) return;
+  // only clears the count, it may well be 0 already
+  if(read(ready_fd, &count, sizeof(count)) < 0) count = 0;
+
+  pthread_mutex_lock(&sched_lock);
+  while(ready_len > 0) {
+    job = ready[0];
+    memmove(ready, ready + 1, --ready_len * sizeof(struct queued_job));
+    pthread_mutex_unlock(&sched_lock);
+    start_job(&job);
+    pthread_mutex_lock(&sched_lock);
+  }
+  pthread_mutex_unlock(&sched_lock);
+}
+
+/**
+ * Waits until every queued job has been started,
+ * starting them as the scheduler lets them through.
+ *
+ * Return value: void
+ */
+void jobsched_drain()
+{
+  pthread_mutex_lock(&sched_lock);
+  while(queue_len > 0 || ready_len > 0) {
+    if(ready_len > 0) {
+      pthread_mutex_unlock(&sched_lock);
+      jobsched_start_ready();
+      pthread_mutex_lock(&sched_lock);
+    }
+    else {
+      pthread_cond_wait(&queue_changed, &sched_lock);
+    }
+  }
+  pthread_mutex_unlock(&sched_lock);
+}
+
+/**
+ * Tells the scheduler one of its limits changed.
+ *
+ * Return value: void
+ */
+void jobsched_changed()
+{
+  wake_scheduler();
+}
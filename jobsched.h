@@ -0,0 +1,68 @@
+/**
+ * This is the header class for jobsched.c
+ *
+ * These methods queue background jobs while the
+ * limits set with "set maxjobs", maxload and
+ * maxpressure hold them back. A scheduler thread
+ * decides when a job may start as running jobs exit,
+ * and the main thread starts it.
+ */
+
+#ifndef JOBSCHED_H
+# define JOBSCHED_H
+
+#include "command.h"
+
+/**
+ * Hands a background pipeline to the scheduler. The
+ * scheduler keeps its own copy, so p may be freed as
+ * soon as this returns. Jobs with a higher priority
+ * start first, equal priorities in the order given.
+ *
+ * p:
+ *  the parsed pipeline
+ * priority:
+ *         position in the queue, higher runs sooner
+ *
+ * Return value: 0 if the scheduler took the job, -1 if no
+ *               limit is set and the caller should start it
+ */
+int jobsched_submit(struct pipeline* p, int priority);
+
+/**
+ * Returns the descriptor that becomes readable when
+ * queued jobs are ready to start, for the main thread
+ * to poll while it waits for input or for a
+ * foreground job.
+ *
+ * Return value: the descriptor, -1 on error or when not
+ *               called on the main thread of the shell
+ */
+int jobsched_ready_fd();
+
+/**
+ * Starts the jobs the scheduler has let through. Only
+ * called from the main thread.
+ *
+ * Return value: void
+ */
+void jobsched_start_ready();
+
+/**
+ * Waits until every queued job has been started,
+ * starting them as the scheduler lets them through.
+ * Used before a script exits, so its queued jobs
+ * are not lost.
+ *
+ * Return value: void
+ */
+void jobsched_drain();
+
+/**
+ * Tells the scheduler one of its limits changed.
+ *
+ * Return value: void
+ */
+void jobsched_changed();
+
+#endif
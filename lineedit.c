@@ -0,0 +1,652 @@
+/**
+ * This C file contains the interactive line editor.
+ * The terminal is put in raw mode for the duration of
+ * one line and every change redraws the line with a
+ * single write, scrolling it sideways when it is wider
+ * than the terminal.
+ *
+ * Keys:
+ *   Left/Right, Ctrl-B/Ctrl-F    move by one character
+ *   Home/End, Ctrl-A/Ctrl-E      move to the start/end
+ *   Up/Down, Ctrl-P/Ctrl-N       recall older/newer history entries
+ *   Ctrl-R                       incremental reverse history search
+ *   Tab                          complete a command or file name, a
+ *                                second Tab lists the candidates
+ *   Backspace, Delete, Ctrl-D    delete a character
+ *   Ctrl-U, Ctrl-K, Ctrl-W       delete to the start/end, the word before
+ *   Ctrl-L                       clear the screen
+ *   Ctrl-C                       discard the line
+ *   Ctrl-D on an empty line      end of input
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "lineedit.h"
+#include "complete.h"
+#include "history.h"
+
+#define KEY_BACKSPACE 127
+#define KEY_ESCAPE 27
+
+// keys sent as escape sequences, numbered past any byte
+enum {
+  KEY_UP = 256,
+  KEY_DOWN,
+  KEY_LEFT,
+  KEY_RIGHT,
+  KEY_HOME,
+  KEY_END,
+  KEY_DELETE
+};
+
+#define SEARCH_PROMPT "(reverse-i-search)`%.*s': "
+#define FAILED_SEARCH_PROMPT "(failed reverse-i-search)`%.*s': "
+// longest reverse search query
+#define MAX_QUERY 256
+// most candidates a second Tab lists
+#define MAX_LISTED 200
+// characters that end a word and are escaped when completed
+#define WORD_BREAKS " \t|;&<>()'\"\\"
+
+/**
+ * The line being edited. hist_pos is the start of
+ * the history entry shown, or hist_end while the
+ * user is on the new line, which saved then holds.
+ */
+struct line_state {
+  const char* prompt;
+  char* buf;
+  size_t size;
+  size_t len;
+  size_t pos;
+  size_t cols;
+  size_t hist_pos;
+  size_t hist_end;
+  char* saved;
+};
+
+/**
+ * Writes all of len bytes of s to stdout.
+ *
+ * Return value: void
+ */
+static void write_out(const char* s, size_t len)
+{
+  while(len > 0) {
+    ssize_t n = write(STDOUT_FILENO, s, len);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) return;
+    s += n;
+    len -= n;
+  }
+}
+
+/**
+ * Counts the terminal columns taken by n bytes of s,
+ * skipping color codes and UTF-8 continuation bytes.
+ *
+ * Return value: number of columns
+ */
+static size_t display_width(const char* s, size_t n)
+{
+  size_t i, cols = 0;
+
+  for(i = 0; i < n; i++) {
+    if(s[i] == KEY_ESCAPE && i + 1 < n && s[i + 1] == '[') {
+      for(i += 2; i < n && !(s[i] >= '@' && s[i] <= '~'); i++);
+      continue;
+    }
+    if(((unsigned char) s[i] & 0xc0) != 0x80) cols++;
+  }
+  return cols;
+}
+
+/**
+ * Redraws the prompt and line and puts the cursor
+ * back at ls->pos, all in one write.
+ *
+ * ls:
+ *   the line being edited
+ * prompt:
+ *       prompt to show, ls->prompt or the search prompt
+ *
+ * Return value: void
+ */
+static void refresh_line(struct line_state* ls, const char* prompt)
+{
+  size_t prompt_cols = display_width(prompt, strlen(prompt));
+  size_t from = 0, to = ls->len;
+  char* out;
+  size_t out_len;
+  FILE* stream = open_memstream(&out, &out_len);
+
+  if(!stream) return;
+
+  // scroll so the cursor stays on screen
+  while(from < ls->pos &&
+	prompt_cols + display_width(ls->buf + from, ls->pos - from) >= ls->cols) {
+    from++;
+  }
+  while(to > ls->pos &&
+	prompt_cols + display_width(ls->buf + from, to - from) >= ls->cols) {
+    to--;
+  }
+
+  fprintf(stream, "\r%s%.*s\033[0K\r", prompt, (int) (to - from),
+	  ls->buf + from);
+  if(prompt_cols + display_width(ls->buf + from, ls->pos - from) > 0) {
+    fprintf(stream, "\033[%zuC",
+	    prompt_cols + display_width(ls->buf + from, ls->pos - from));
+  }
+  fclose(stream);
+  write_out(out, out_len);
+  free(out);
+}
+
+// descriptor watched while waiting for a key, see edit_line_watch
+static int watch_fd = -1;
+static void (*watch_ready)() = NULL;
+
+/**
+ * Reads one key, decoding the escape sequences sent
+ * by arrow and editing keys. While no key comes the
+ * watched descriptor is served.
+ *
+ * Return value: the key, -1 at end of input
+ */
+static int read_key()
+{
+  unsigned char c, seq[3];
+
+  while(1) {
+    struct pollfd fds[2] = { { STDIN_FILENO, POLLIN, 0 },
+			     { watch_fd, POLLIN, 0 } };
+    ssize_t n;
+
+    if(watch_fd != -1 && (poll(fds, 2, -1) == -1 || !fds[0].revents)) {
+      if(fds[1].revents) watch_ready();
+      continue;
+    }
+    n = read(STDIN_FILENO, &c, 1);
+    if(n == 1) break;
+    if(n < 0 && errno == EINTR) continue;
+    return -1;
+  }
+  if(c != KEY_ESCAPE) return c;
+
+  if(read(STDIN_FILENO, seq, 1) != 1) return KEY_ESCAPE;
+  if(read(STDIN_FILENO, seq + 1, 1) != 1) return KEY_ESCAPE;
+
+  if(seq[0] == '[' && seq[1] >= '0' && seq[1] <= '9') {
+    if(read(STDIN_FILENO, seq + 2, 1) != 1 || seq[2] != '~') return KEY_ESCAPE;
+    switch(seq[1]) {
+    case '1': case '7': return KEY_HOME;
+    case '3': return KEY_DELETE;
+    case '4': case '8': return KEY_END;
+    }
+    return KEY_ESCAPE;
+  }
+  if(seq[0] == '[' || seq[0] == 'O') {
+    switch(seq[1]) {
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return KEY_RIGHT;
+    case 'D': return KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+    }
+  }
+  return KEY_ESCAPE;
+}
+
+/**
+ * Replaces the whole line with len bytes of text.
+ *
+ * Return value: void
+ */
+static void set_line(struct line_state* ls, const char* text, size_t len)
+{
+  if(len > ls->size - 1) len = ls->size - 1;
+  memcpy(ls->buf, text, len);
+  ls->buf[len] = 0;
+  ls->len = ls->pos = len;
+}
+
+/**
+ * Inserts byte c at the cursor.
+ *
+ * Return value: void
+ */
+static void insert_char(struct line_state* ls, char c)
+{
+  if(ls->len + 1 >= ls->size) return;
+
+  memmove(ls->buf + ls->pos + 1, ls->buf + ls->pos, ls->len - ls->pos);
+  ls->buf[ls->pos++] = c;
+  ls->buf[++ls->len] = 0;
+}
+
+/**
+ * Deletes the bytes between from and to.
+ *
+ * Return value: void
+ */
+static void delete_range(struct line_state* ls, size_t from, size_t to)
+{
+  memmove(ls->buf + from, ls->buf + to, ls->len - to);
+  ls->len -= to - from;
+  ls->buf[ls->len] = 0;
+  if(ls->pos > to) ls->pos -= to - from;
+  else if(ls->pos > from) ls->pos = from;
+}
+
+/**
+ * Finds where the character before offset starts.
+ *
+ * Return value: offset of the previous character
+ */
+static size_t prev_char(struct line_state* ls, size_t offset)
+{
+  if(offset == 0) return 0;
+  offset--;
+  while(offset > 0 && ((unsigned char) ls->buf[offset] & 0xc0) == 0x80) {
+    offset--;
+  }
+  return offset;
+}
+
+/**
+ * Finds where the character after the one at offset starts.
+ *
+ * Return value: offset of the next character
+ */
+static size_t next_char(struct line_state* ls, size_t offset)
+{
+  if(offset >= ls->len) return ls->len;
+  offset++;
+  while(offset < ls->len && ((unsigned char) ls->buf[offset] & 0xc0) == 0x80) {
+    offset++;
+  }
+  return offset;
+}
+
+/**
+ * Shows the history entry before (up) or after the
+ * current one, coming back to the line being typed
+ * after the newest entry.
+ *
+ * Return value: void
+ */
+static void history_move(struct line_state* ls, int up)
+{
+  struct history_entry entry;
+
+  if(up) {
+    if(history_before(ls->hist_pos, &entry) == -1) return;
+    if(ls->hist_pos == ls->hist_end) {
+      free(ls->saved);
+      ls->saved = strndup(ls->buf, ls->len);
+    }
+  }
+  else {
+    if(ls->hist_pos == ls->hist_end) return;
+    if(history_after(ls->hist_pos, &entry) == -1 ||
+       entry.start >= ls->hist_end) {
+      const char* saved = ls->saved ? ls->saved : "";
+      ls->hist_pos = ls->hist_end;
+      set_line(ls, saved, strlen(saved));
+      return;
+    }
+  }
+  ls->hist_pos = entry.start;
+  set_line(ls, entry.text, entry.len);
+}
+
+/**
+ * Prints the candidates in columns below the line.
+ * The caller redraws the line afterwards.
+ *
+ * Return value: void
+ */
+static void list_completions(struct line_state* ls, struct completions* c)
+{
+  size_t i, width = 0, per_row;
+  FILE* stream;
+  char* out;
+  size_t out_len;
+
+  if(!(stream = open_memstream(&out, &out_len))) return;
+  for(i = 0; i < c->count && i < MAX_LISTED; i++) {
+    if(strlen(c->items[i]) + 2 > width) width = strlen(c->items[i]) + 2;
+  }
+  per_row = width < ls->cols ? ls->cols / width : 1;
+
+  fputs("\r\n", stream);
+  for(i = 0; i < c->count && i < MAX_LISTED; i++) {
+    fprintf(stream, "%-*s", (int) width, c->items[i]);
+    if((i + 1) % per_row == 0) fputs("\r\n", stream);
+  }
+  if(i % per_row != 0) fputs("\r\n", stream);
+  if(c->count > MAX_LISTED) {
+    fprintf(stream, "... and %zu more\r\n", c->count - MAX_LISTED);
+  }
+  fclose(stream);
+  write_out(out, out_len);
+  free(out);
+}
+
+/**
+ * Completes the word before the cursor. The word is
+ * extended as far as all candidates agree; a single
+ * candidate is followed by a space unless it is a
+ * directory. When nothing can be added, a repeated
+ * Tab lists the candidates.
+ *
+ * ls:
+ *   the line being edited
+ * repeated:
+ *         1 if the previous key was Tab too
+ *
+ * Return value: void
+ */
+static void complete_line(struct line_state* ls, int repeated)
+{
+  struct completions c;
+  char* scratch = malloc(ls->pos + 1);
+  size_t start = ls->pos, len, common, i;
+
+  if(!scratch) return;
+
+  // backslash-escaped breaks belong to the word
+  while(start > 0 && (!strchr(WORD_BREAKS, ls->buf[start - 1]) ||
+		      (start > 1 && ls->buf[start - 2] == '\\'))) {
+    start--;
+  }
+
+  // the candidates are matched against the unescaped word
+  memcpy(scratch, ls->buf, start);
+  for(i = start, len = start; i < ls->pos; i++) {
+    if(ls->buf[i] == '\\' && i + 1 < ls->pos) i++;
+    scratch[len++] = ls->buf[i];
+  }
+  scratch[len] = 0;
+
+  if(complete_word(scratch, start, len, &c) == 0) {
+    write_out("\a", 1);
+  }
+  else {
+    common = strlen(c.items[0]);
+    for(i = 1; i < c.count; i++) {
+      size_t j = 0;
+      while(j < common && c.items[i][j] == c.items[0][j]) j++;
+      common = j;
+    }
+
+    if(common > len - start || c.count == 1) {
+      delete_range(ls, start, ls->pos);
+      for(i = 0; i < common; i++) {
+	if(strchr(WORD_BREAKS, c.items[0][i])) insert_char(ls, '\\');
+	insert_char(ls, c.items[0][i]);
+      }
+      if(c.count == 1 && c.items[0][common - 1] != '/') insert_char(ls, ' ');
+    }
+    else if(repeated) {
+      list_completions(ls, &c);
+    }
+  }
+  free_completions(&c);
+  free(scratch);
+}
+
+/**
+ * Incremental reverse search. Every key typed extends
+ * the query and shows the newest entry holding it,
+ * Ctrl-R moves on to older matches.
+ *
+ * ls:
+ *   the line being edited, set to the match on return
+ *
+ * Return value: '\r' to run the match, 0 if the search was
+ *               cancelled, or the key that ended the search,
+ *               which the caller still has to handle
+ */
+static int reverse_search(struct line_state* ls)
+{
+  char query[MAX_QUERY];
+  char prompt[MAX_QUERY + 64];
+  char* original = strndup(ls->buf, ls->len);
+  size_t original_pos = ls->pos, qlen = 0;
+  struct history_entry match;
+  int found = 0, failed = 0, key;
+
+  match.start = ls->hist_end;
+  while(1) {
+    snprintf(prompt, sizeof(prompt),
+	     failed ? FAILED_SEARCH_PROMPT : SEARCH_PROMPT, (int) qlen, query);
+    refresh_line(ls, prompt);
+
+    key = read_key();
+    if(key == CTRL('r') || key == KEY_BACKSPACE || key == CTRL('h') ||
+       (key >= 32 && key < KEY_BACKSPACE) || (key >= 128 && key < 256)) {
+      size_t before;
+
+      if(key == CTRL('r')) {
+	// older than the current match
+	before = found ? match.start : ls->hist_end;
+      }
+      else if(key == KEY_BACKSPACE || key == CTRL('h')) {
+	// a shorter query searches again from the newest entry
+	if(qlen > 0) qlen--;
+	before = ls->hist_end;
+      }
+      else if(qlen < MAX_QUERY) {
+	// the current match may still hold the longer query
+	query[qlen++] = key;
+	before = found ? match.start + 1 : ls->hist_end;
+      }
+      else {
+	continue;
+      }
+
+      failed = 0;
+      if(qlen == 0) {
+	found = 0;
+      }
+      else if(history_search(query, qlen, before, &match) == 0) {
+	const char* hit = memmem(match.text, match.len, query, qlen);
+	set_line(ls, match.text, match.len);
+	if((size_t) (hit - match.text) < ls->len) ls->pos = hit - match.text;
+	ls->hist_pos = match.start;
+	found = 1;
+      }
+      else {
+	failed = 1;
+      }
+    }
+    else if(key == CTRL('g') || key == CTRL('c')) {
+      set_line(ls, original, strlen(original));
+      ls->pos = original_pos;
+      ls->hist_pos = ls->hist_end;
+      key = 0;
+      break;
+    }
+    else {
+      break;
+    }
+  }
+
+  free(original);
+  refresh_line(ls, ls->prompt);
+  return key == '\n' ? '\r' : key;
+}
+
+/**
+ * Reads a line through the raw-mode editor.
+ *
+ * Return value: length of the line, -1 at end of input
+ */
+static int edit_raw(struct line_state* ls)
+{
+  int key, last_key = 0;
+
+  refresh_line(ls, ls->prompt);
+  while(1) {
+    key = read_key();
+    if(key == CTRL('r')) key = reverse_search(ls);
+
+    switch(key) {
+    case '\t':
+      complete_line(ls, last_key == '\t');
+      break;
+    case 0:
+      break;
+    case -1:
+      return ls->len ? (int) ls->len : -1;
+    case '\r':
+    case '\n':
+      return ls->len;
+    case CTRL('c'):
+      write_out("^C", 2);
+      set_line(ls, "", 0);
+      return 0;
+    case CTRL('d'):
+      if(ls->len == 0) return -1;
+      // fall through
+    case KEY_DELETE:
+      delete_range(ls, ls->pos, next_char(ls, ls->pos));
+      break;
+    case KEY_BACKSPACE:
+    case CTRL('h'):
+      delete_range(ls, prev_char(ls, ls->pos), ls->pos);
+      break;
+    case KEY_LEFT:
+    case CTRL('b'):
+      ls->pos = prev_char(ls, ls->pos);
+      break;
+    case KEY_RIGHT:
+    case CTRL('f'):
+      ls->pos = next_char(ls, ls->pos);
+      break;
+    case KEY_HOME:
+    case CTRL('a'):
+      ls->pos = 0;
+      break;
+    case KEY_END:
+    case CTRL('e'):
+      ls->pos = ls->len;
+      break;
+    case KEY_UP:
+    case CTRL('p'):
+      history_move(ls, 1);
+      break;
+    case KEY_DOWN:
+    case CTRL('n'):
+      history_move(ls, 0);
+      break;
+    case CTRL('u'):
+      delete_range(ls, 0, ls->pos);
+      break;
+    case CTRL('k'):
+      delete_range(ls, ls->pos, ls->len);
+      break;
+    case CTRL('w'): {
+      size_t from = ls->pos;
+      while(from > 0 && ls->buf[from - 1] == ' ') from--;
+      while(from > 0 && ls->buf[from - 1] != ' ') from--;
+      delete_range(ls, from, ls->pos);
+      break;
+    }
+    case CTRL('l'):
+      write_out("\033[H\033[2J", 7);
+      break;
+    default:
+      if((key >= 32 && key < KEY_BACKSPACE) || (key >= 128 && key < 256)) {
+	insert_char(ls, key);
+      }
+      break;
+    }
+    last_key = key;
+    refresh_line(ls, ls->prompt);
+  }
+}
+
+/**
+ * Sets a descriptor to watch while waiting for the
+ * user to type.
+ *
+ * fd:
+ *   the descriptor, -1 to watch none
+ * ready:
+ *      called on the main thread whenever fd is readable
+ *
+ * Return value: void
+ */
+void edit_line_watch(int fd, void (*ready)())
+{
+  watch_fd = fd;
+  watch_ready = ready;
+}
+
+/**
+ * Shows prompt and lets the user edit one line. When
+ * stdin or stdout is not a terminal the line is read
+ * with fgets instead.
+ *
+ * prompt:
+ *       text shown before the line, may hold color codes
+ * buf:
+ *    variable to store the line in, without a new line
+ * size:
+ *     size of buf
+ *
+ * Return value: length of the line, -1 at end of input
+ */
+int edit_line(const char* prompt, char* buf, size_t size)
+{
+  struct termios saved, raw;
+  struct winsize ws;
+  struct line_state ls;
+  int len;
+
+  fflush(stdout);
+  if(!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) ||
+     tcgetattr(STDIN_FILENO, &saved) == -1) {
+    fputs(prompt, stdout);
+    fflush(stdout);
+    if(!fgets(buf, size, stdin)) return -1;
+    buf[strcspn(buf, "\n")] = 0;
+    return strlen(buf);
+  }
+
+  memset(&ls, 0, sizeof(ls));
+  ls.prompt = prompt;
+  ls.buf = buf;
+  ls.size = size;
+  ls.cols = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col ? ws.ws_col
+								    : 80;
+  ls.hist_end = ls.hist_pos = history_end();
+  buf[0] = 0;
+
+  raw = saved;
+  raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+  raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+  len = edit_raw(&ls);
+
+  tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+  write_out("\r\n", 2);
+  free(ls.saved);
+  return len;
+}
@@ -0,0 +1,44 @@
+/**
+ * This is the header class for lineedit.c
+ *
+ * These methods read a command line from the terminal
+ * in raw mode, with cursor movement, history recall
+ * and incremental reverse search (Ctrl-R).
+ */
+
+#ifndef LINEEDIT_H
+# define LINEEDIT_H
+
+#include <stddef.h>
+
+/**
+ * Shows prompt and lets the user edit one line. When
+ * stdin or stdout is not a terminal the line is read
+ * with fgets instead.
+ *
+ * prompt:
+ *       text shown before the line, may hold color codes
+ * buf:
+ *    variable to store the line in, without a new line
+ * size:
+ *     size of buf
+ *
+ * Return value: length of the line, -1 at end of input
+ */
+int edit_line(const char* prompt, char* buf, size_t size);
+
+/**
+ * Sets a descriptor to watch while waiting for the
+ * user to type, so work the main thread must do is
+ * not held up until the next key.
+ *
+ * fd:
+ *   the descriptor, -1 to watch none
+ * ready:
+ *      called whenever fd is readable
+ *
+ * Return value: void
+ */
+void edit_line_watch(int fd, void (*ready)());
+
+#endif
@@ -0,0 +1,218 @@
+/**
+ * This C file contains the meter built-in. Data moves
+ * from the input to the output with splice, so it
+ * stays in the kernel when either side is a pipe, and
+ * with read and write when neither is.
+ *
+ * Before each move both sides are polled without
+ * waiting. A side that is not ready counts as a stall,
+ * and the time until it becomes ready is added to
+ * that side's total.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "meter.h"
+#include "stats.h"
+
+// most bytes moved at once
+#define METER_CHUNK (1 << 20)
+// time between progress lines on a terminal
+#define REPORT_MS 1000
+
+/**
+ * How often one side was not ready, and for how long.
+ */
+struct meter_side {
+  long stalls;
+  long long waited_ns;
+};
+
+/**
+ * State of one meter.
+ */
+struct meter {
+  const char* label;
+  struct builtin_io* io;
+  int progress;
+  long long start_ns;
+  long long next_report_ns;
+  long long bytes;
+  struct meter_side in;
+  struct meter_side out;
+};
+
+/**
+ * Formats a number of bytes with a binary unit.
+ *
+ * Return value: void
+ */
+static void format_size(double bytes, char* out, size_t size)
+{
+  const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+  int u = 0;
+
+  while(bytes >= 1024 && u < 4) {
+    bytes /= 1024;
+    u++;
+  }
+  snprintf(out, size, "%.1f %s", bytes, units[u]);
+}
+
+/**
+ * Prints the progress line, or the final report when
+ * done is set.
+ *
+ * Return value: void
+ */
+static void report(struct meter* m, int done)
+{
+  double secs = (now_ns() - m->start_ns) / 1e9;
+  char total[32], rate[32];
+
+  format_size(m->bytes, total, sizeof(total));
+  format_size(secs > 0 ? m->bytes / secs : 0, rate, sizeof(rate));
+
+  if(!done) {
+    fprintf(m->io->err, "\rmeter%s%s: %s, %s/s\033[0K", m->label[0] ? " " : "",
+	    m->label, total, rate);
+    return;
+  }
+  fprintf(m->io->err, "%smeter%s%s: %s in %.2f s, %s/s; input stalled %ld "
+	  "times for %.2f s, output stalled %ld times for %.2f s\n",
+	  m->progress ? "\r\033[0K" : "", m->label[0] ? " " : "", m->label,
+	  total, secs, rate, m->in.stalls, m->in.waited_ns / 1e9,
+	  m->out.stalls, m->out.waited_ns / 1e9);
+}
+
+/**
+ * Waits until fd is ready, counting a stall when it
+ * is not ready right away. The progress line is kept
+ * up to date while waiting.
+ *
+ * Return value: 0 when ready, -1 on error
+ */
+static int wait_ready(struct meter* m, int fd, short events,
+		      struct meter_side* side)
+{
+  struct pollfd pfd = { fd, events, 0 };
+  long long began = 0;
+  int timeout = 0, n;
+
+  while(1) {
+    if((n = poll(&pfd, 1, timeout)) == -1) {
+      if(errno == EINTR) continue;
+      return -1;
+    }
+    // a hang up or error shows up in the next move
+    if(n > 0) break;
+
+    if(!began) {
+      began = now_ns();
+      side->stalls++;
+    }
+    if(m->progress && now_ns() >= m->next_report_ns) {
+      report(m, 0);
+      m->next_report_ns = now_ns() + REPORT_MS * 1000000LL;
+    }
+    timeout = m->progress ? REPORT_MS : -1;
+  }
+  if(began) side->waited_ns += now_ns() - began;
+  return 0;
+}
+
+/**
+ * Moves one chunk with read and write.
+ *
+ * Return value: bytes moved, 0 at end of input, -1 on error
+ */
+static ssize_t relay(struct meter* m, int in_fd, int out_fd, char* buf)
+{
+  ssize_t n, done, w;
+
+  while((n = read(in_fd, buf, METER_CHUNK)) == -1 && errno == EINTR);
+  for(done = 0; n > 0 && done < n; done += w) {
+    if(wait_ready(m, out_fd, POLLOUT, &m->out) == -1) return -1;
+    if((w = write(out_fd, buf + done, n - done)) == -1) {
+      if(errno != EINTR && errno != EAGAIN) return -1;
+      w = 0;
+    }
+  }
+  return n;
+}
+
+/**
+ * Copies the input to the output and reports the
+ * throughput on stderr.
+ *
+ * Return value: 0 on success, 1 on a read or write error
+ */
+int meter_command(char** parsed_input, struct builtin_io* io)
+{
+  struct meter m;
+  char* buf = NULL;
+  int use_splice = 1, status = 0;
+  ssize_t n;
+
+  memset(&m, 0, sizeof(m));
+  m.label = parsed_input[1] ? parsed_input[1] : "";
+  m.io = io;
+  m.progress = isatty(io->err_fd);
+  m.start_ns = now_ns();
+  m.next_report_ns = m.start_ns + REPORT_MS * 1000000LL;
+  fflush(io->out);
+
+  while(1) {
+    if(wait_ready(&m, io->in_fd, POLLIN, &m.in) == -1) {
+      status = 1;
+      break;
+    }
+
+    if(use_splice) {
+      if(wait_ready(&m, io->out_fd, POLLOUT, &m.out) == -1) {
+	status = 1;
+	break;
+      }
+      n = splice(io->in_fd, NULL, io->out_fd, NULL, METER_CHUNK,
+		 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if(n == -1 && errno == EINVAL) {
+	// neither side is a pipe
+	use_splice = 0;
+	if(!(buf = malloc(METER_CHUNK))) {
+	  status = 1;
+	  break;
+	}
+	continue;
+      }
+    }
+    else {
+      n = relay(&m, io->in_fd, io->out_fd, buf);
+    }
+
+    if(n == 0) break;
+    if(n == -1) {
+      if(errno == EAGAIN || errno == EINTR) continue;
+      // a reader that went away ends the stream quietly
+      if(errno != EPIPE) fprintf(io->err, "meter: %s\n", strerror(errno));
+      status = 1;
+      break;
+    }
+    m.bytes += n;
+    if(m.progress && now_ns() >= m.next_report_ns) {
+      report(&m, 0);
+      m.next_report_ns = now_ns() + REPORT_MS * 1000000LL;
+    }
+  }
+
+  report(&m, 1);
+  free(buf);
+  return status;
+}
@@ -0,0 +1,33 @@
+/**
+ * This is the header class for meter.c
+ *
+ * These methods implement the meter built-in, a
+ * pipeline stage that passes its input on unchanged
+ * and reports how fast the data went through it and
+ * how often it had to wait for either side.
+ */
+
+#ifndef METER_H
+# define METER_H
+
+#include "command.h"
+
+/**
+ * Copies the input to the output with splice and
+ * prints the throughput on stderr: every second while
+ * stderr is a terminal, and once at the end. Waits
+ * for input mean the stages before the meter are the
+ * bottleneck, waits for output the stages after it.
+ *
+ *   cmd1 | meter [label] | cmd2
+ *
+ * parsed_input:
+ *             the command and arguments entered in by the user
+ * io:
+ *   where the built-in reads and writes
+ *
+ * Return value: 0 on success, 1 on a read or write error
+ */
+int meter_command(char** parsed_input, struct builtin_io* io);
+
+#endif
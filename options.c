@@ -0,0 +1,149 @@
+/**
+ * This C file contains the table of shell options
+ * and the set built-in that lists and changes them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "options.h"
+#include "fdcache.h"
+#include "jobsched.h"
+
+// number of files kept open by "set fdcache=on"
+#define FDCACHE_DEFAULT_SIZE 16
+// seconds a job may run after "set timeout=on"
+#define TIMEOUT_DEFAULT 60
+// pressure percentage used by "set maxpressure=on"
+#define MAXPRESSURE_DEFAULT 20
+// on_value standing for the number of online CPUs
+#define ON_NPROC -1
+
+struct shell_options options = { 0 };
+
+/**
+ * Describes one option: where its value lives, its
+ * allowed range, the value "on" stands for (ON_NPROC
+ * for the number of CPUs), and a hook run after it
+ * changes.
+ */
+struct option {
+  const char* name;
+  int* value;
+  int min;
+  int max;
+  int on_value;
+  void (*changed)();
+  const char* summary;
+};
+
+static const struct option option_table[] = {
+  { "fdcache", &options.fdcache, 0, 64, FDCACHE_DEFAULT_SIZE, fdcache_resize,
+    "keep up to N files opened by >> open for the rest of a script" },
+  { "timeout", &options.timeout, 0, 86400, TIMEOUT_DEFAULT, NULL,
+    "stop foreground jobs still running after N seconds, status 124" },
+  { "maxjobs", &options.maxjobs, 0, 4096, ON_NPROC, jobsched_changed,
+    "run at most N background jobs at once and queue the rest" },
+  { "maxload", &options.maxload, 0, 4096, ON_NPROC, jobsched_changed,
+    "hold queued jobs while the 1-minute load average is N or more" },
+  { "maxpressure", &options.maxpressure, 0, 100, MAXPRESSURE_DEFAULT,
+    jobsched_changed,
+    "hold queued jobs while CPU or memory pressure (PSI) is N% or more" },
+  { "pipesize", &options.pipesize, 0, PIPESIZE_MAX, PIPESIZE_MAX, NULL,
+    "give pipeline pipes N KiB of buffer, up to fs.pipe-max-size" },
+  { "auditsync", &options.auditsync, 0, 60000, 1, NULL,
+    "fdatasync the audit log at most every N ms; 0 syncs every batch" },
+};
+
+#define NUM_OPTIONS (sizeof(option_table) / sizeof(option_table[0]))
+
+/**
+ * Parses an option value: on, off or a number.
+ *
+ * Return value: 0 on success, -1 if text is not a valid value
+ */
+static int parse_value(const struct option* opt, const char* text, int* value)
+{
+  char* end;
+  long n;
+
+  if(strcmp(text, "on") == 0) {
+    *value = opt->on_value == ON_NPROC ? (int) sysconf(_SC_NPROCESSORS_ONLN)
+				       : opt->on_value;
+    return 0;
+  }
+  if(strcmp(text, "off") == 0) {
+    *value = 0;
+    return 0;
+  }
+
+  n = strtol(text, &end, 10);
+  if(*text == 0 || *end != 0 || n < opt->min || n > opt->max) return -1;
+  *value = (int) n;
+  return 0;
+}
+
+/**
+ * The set built-in. Without arguments it lists every
+ * option; otherwise each argument of the form
+ * name=value changes one option.
+ *
+ * parsed_input:
+ *             the command and arguments entered in by the user
+ * io:
+ *   where the built-in reads and writes
+ *
+ * Return value: 0 on success, 1 if an option could not be set
+ */
+int set_options(char** parsed_input, struct builtin_io* io)
+{
+  size_t i, width = 0;
+  int arg, status = 0;
+
+  if(!parsed_input[1]) {
+    // the name column fits the longest name
+    for(i = 0; i < NUM_OPTIONS; i++) {
+      if(strlen(option_table[i].name) > width) {
+	width = strlen(option_table[i].name);
+      }
+    }
+    for(i = 0; i < NUM_OPTIONS; i++) {
+      fprintf(io->out, "%-*s %-6d %s\n", (int) width, option_table[i].name,
+	      *option_table[i].value, option_table[i].summary);
+    }
+    return 0;
+  }
+
+  for(arg = 1; parsed_input[arg]; arg++) {
+    char* name = parsed_input[arg];
+    char* eq = strchr(name, '=');
+    size_t len = eq ? (size_t) (eq - name) : strlen(name);
+    const struct option* opt = NULL;
+    int value;
+
+    for(i = 0; i < NUM_OPTIONS; i++) {
+      if(strlen(option_table[i].name) == len &&
+	 strncmp(option_table[i].name, name, len) == 0) {
+	opt = &option_table[i];
+	break;
+      }
+    }
+    if(!opt) {
+      fprintf(io->err, "set: unknown option %.*s\n", (int) len, name);
+      status = 1;
+      continue;
+    }
+    if(!eq || parse_value(opt, eq + 1, &value) == -1) {
+      fprintf(io->err, "set: %s needs on, off or a number from %d to %d\n",
+	      opt->name, opt->min, opt->max);
+      status = 1;
+      continue;
+    }
+
+    *opt->value = value;
+    if(opt->changed) opt->changed();
+  }
+  return status;
+}
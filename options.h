@@ -0,0 +1,55 @@
+/**
+ * This is the header class for options.c
+ *
+ * These are the shell's run-time settings, changed
+ * with the set built-in: "set name=value".
+ */
+
+#ifndef OPTIONS_H
+# define OPTIONS_H
+
+#include "command.h"
+
+// largest pipesize in KiB; more than fs.pipe-max-size allows,
+// so "set pipesize=on" gets whatever the system limit is
+#define PIPESIZE_MAX 1048576
+
+/**
+ * Current values of the shell options. A value of
+ * 0 always means the feature is off.
+ */
+struct shell_options {
+  // open-file cache size for >> targets during scripts, 0 = off
+  int fdcache;
+  // seconds a foreground job may run before it is stopped, 0 = no limit
+  int timeout;
+  // background jobs allowed to run at once, 0 = no limit
+  int maxjobs;
+  // 1-minute load average at which queued jobs stop starting, 0 = off
+  int maxload;
+  // PSI avg10 percentage (cpu or memory) that holds queued jobs, 0 = off
+  int maxpressure;
+  // capacity of pipeline pipes in KiB, 0 = kernel default
+  int pipesize;
+  // most milliseconds between fdatasyncs of the audit log, 0 = never
+  int auditsync;
+};
+
+extern struct shell_options options;
+
+/**
+ * The set built-in. Without arguments it lists every
+ * option; otherwise each argument of the form
+ * name=value (value may be on, off or a number)
+ * changes one option.
+ *
+ * parsed_input:
+ *             the command and arguments entered in by the user
+ * io:
+ *   where the built-in reads and writes
+ *
+ * Return value: 0 on success, 1 if an option could not be set
+ */
+int set_options(char** parsed_input, struct builtin_io* io);
+
+#endif
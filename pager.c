@@ -0,0 +1,106 @@
+/**
+ * This C file contains a small in-process pager
+ * modelled after more. It reads keys from the
+ * terminal in non-canonical mode through termios,
+ * so showing the manual costs no child processes.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+#include "pager.h"
+
+#define PAGER_PROMPT "\x1B[7m--More--\x1B[0m"
+#define PAGER_CLEAR_PROMPT "\r        \r"
+
+/**
+ * Writes len bytes of text to standard output,
+ * continuing after partial writes.
+ *
+ * Return value: void
+ */
+static void write_out(int fd, const char* text, size_t len)
+{
+  while(len > 0) {
+    ssize_t n = write(fd, text, len);
+    if(n <= 0) return;
+    text += n;
+    len -= n;
+  }
+}
+
+/**
+ * Finds the end of the next count lines of text.
+ *
+ * Return value: pointer just past the last newline, or end
+ */
+static const char* skip_lines(const char* text, const char* end, int count)
+{
+  while(count > 0 && text < end) {
+    const char* nl = memchr(text, '\n', end - text);
+    if(!nl) return end;
+    text = nl + 1;
+    count--;
+  }
+  return text;
+}
+
+/**
+ * Shows text one screen at a time when standard
+ * output is a terminal, or writes it out in one
+ * piece otherwise.
+ *
+ * text:
+ *     text to show
+ * len:
+ *    number of bytes in text
+ * in_fd:
+ *      terminal to read keys from
+ * out_fd:
+ *       file descriptor to show the text on
+ *
+ * Return value: void
+ */
+void page_text(const char* text, size_t len, int in_fd, int out_fd)
+{
+  const char* end = text + len;
+  const char* next;
+  struct termios saved, raw;
+  struct winsize ws;
+  int rows = 24;
+  char key;
+
+  if(!isatty(out_fd) || !isatty(in_fd) || tcgetattr(in_fd, &saved) == -1) {
+    write_out(out_fd, text, len);
+    return;
+  }
+  if(ioctl(out_fd, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 1) {
+    rows = ws.ws_row;
+  }
+
+  // read single keys without echo while paging
+  raw = saved;
+  raw.c_lflag &= ~(ICANON | ECHO);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  tcsetattr(in_fd, TCSANOW, &raw);
+
+  next = skip_lines(text, end, rows - 1);
+  write_out(out_fd, text, next - text);
+  text = next;
+
+  while(text < end) {
+    write_out(out_fd, PAGER_PROMPT, strlen(PAGER_PROMPT));
+    if(read(in_fd, &key, 1) != 1) key = 'q';
+    write_out(out_fd, PAGER_CLEAR_PROMPT, strlen(PAGER_CLEAR_PROMPT));
+
+    if(key == 'q' || key == 'Q') break;
+    next = skip_lines(text, end, (key == '\n' || key == '\r') ? 1 : rows - 1);
+    write_out(out_fd, text, next - text);
+    text = next;
+  }
+
+  tcsetattr(in_fd, TCSANOW, &saved);
+}
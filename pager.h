@@ -0,0 +1,34 @@
+/**
+ * This is the header class for pager.c
+ *
+ * These methods are for showing long output,
+ * like the user manual, one screen at a time
+ * without starting an external pager.
+ */
+
+#ifndef PAGER_H
+# define PAGER_H
+
+#include <stddef.h>
+
+/**
+ * Shows text one screen at a time when standard
+ * output is a terminal, or writes it out in one
+ * piece otherwise.
+ *
+ * Keys: SPACE next page, ENTER next line, q quit.
+ *
+ * text:
+ *     text to show
+ * len:
+ *    number of bytes in text
+ * in_fd:
+ *      terminal to read keys from
+ * out_fd:
+ *       file descriptor to show the text on
+ *
+ * Return value: void
+ */
+void page_text(const char* text, size_t len, int in_fd, int out_fd);
+
+#endif
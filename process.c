@@ -5,17 +5,49 @@
  * and processing user input.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 
 #include "process.h"
 #include "commands.h"
+#include "coproc.h"
 #include "draw.h"
+#include "jobs.h"
+#include "command.h"
+#include "fdcache.h"
+#include "functions.h"
+#include "history.h"
+#include "jobsched.h"
+#include "lineedit.h"
+#include "scan.h"
+#include "stats.h"
+
+// bodies up to this size fit in a pipe without blocking the writer
+#define HEREDOC_PIPE_MAX 4096
+// most process substitutions a single line can hold
+#define MAXSUBST 16
+
+// stream the current command line came from, here-document bodies
+// are read from the lines that follow it
+static FILE* command_stream = NULL;
+// set while a function body is parsed, see PARAM_MARK
+static int marking_params = 0;
+// set while a function or alias body is parsed, which is kept and
+// run later, so nothing on it may be opened or started now
+static int defining = 0;
+// line being parsed, which owns the substitutions started on it
+static struct command_list* parsing_list = NULL;
+// time spent reading here-document bodies and starting
+// substitutions while parsing, left out of the parse time
+static long long waiting_ns = 0;
 
 /**
  * Helper function for determining if input string
@@ -39,73 +71,37 @@ int has_character(char* input, char c)
 }
 
 /**
- * Helper function to determine whether command is
- * built-in, system, or invalid input.
+ * Reads commands one line at a time from stream
+ * and executes each of them until end of file.
+ * Lines may be of any length.
  *
- * command:
- *        command to check
- * 
- * Return value: 1 if built-in, 0 otherwise
- */
-int is_own_command(char* command)
-{
-  if(strcmp("clr", command) == 0 || strcmp("environ", command) == 0 ||
-     strcmp("pause", command) == 0 || strcmp("quit", command) == 0 ||
-     strcmp("cd", command) == 0 || strcmp("help", command) == 0) {
-    return 1;
-  }
-  else {
-    return 0;
-  }
-}
-
-/**
- * Helper function to remove leading whitespace.
- *
- * input:
- *      input to remove leading whitespace from
+ * stream:
+ *       open stream to read commands from
  *
  * Return value: void
  */
-void remove_leading_whitespace(char** input)
+void read_commands(FILE* stream)
 {
-  if(*input[0] == ' ') {
-    while(*input[0] == ' ') {
-      strsep(input, " ");
-    }
-  }
-}
+  FILE* saved_stream = command_stream;
+  char* line = NULL;
+  size_t cap = 0;
+  ssize_t len;
 
-/**
- * Takes input and parses it by spaces and inserts
- * each parsed input into the parsed char pointer array.
- *
- * input:
- *      input to parse spaces from
- * parsed:
- *       char pointer array to put parsed strings into
- * 
- * Return value: void
- */
-void parse_spaces(char* input, char** parsed)
-{ 
-  char* cp = input;
-  int i = 0;
-  while(has_character(cp, ' ')) {
-    parsed[i] = strsep(&cp, " ");
-    i++;
-    // if more than one space is used as a delimiter,
-    // remove until there is no more space
-    if(cp[0] == ' ') {
-      while(cp[0] == ' ') {
-	strsep(&cp, " ");
-      }
-    }
-    // edge case for last string in input with length > 0 and no more spaces
-    else if(strlen(cp) > 0 && !has_character(cp, ' ')) {
-      parsed[i] = cp;
-    }
+  command_stream = stream;
+  fdcache_script_begin();
+  while((len = getline(&line, &cap, stream)) != -1) {
+    if(len > 0 && line[len - 1] == '\n') line[--len] = 0; // remove newline
+    if(len == 0) continue;
+
+    parse_string(line);
+    // a script has no prompt to reap its background jobs at,
+    // and one that runs long would keep them all as zombies
+    reap_children();
+    jobsched_start_ready();
   }
+  free(line);
+  fdcache_script_end();
+  command_stream = saved_stream;
 }
 
 /**
@@ -114,16 +110,13 @@ void parse_spaces(char* input, char** parsed)
  *
  * filename:
  *         name of the text file to read from
- * commands: 
- *         array of character pointers to store commands in
  *
  * Return value: void
  */
-void read_input_from_file(char* filename, char** commands)
+void read_input_from_file(char* filename)
 {
   FILE* file;
   char* ext = strrchr(filename, '.');
-  char** parsed_input;
 
   // adds .txt extension if not present
   if(!ext) {
@@ -149,45 +142,39 @@ void read_input_from_file(char* filename, char** commands)
     free(parent);
   }
 
-  int i = 0;
-  commands[i] = malloc(sizeof(char) * 100);
-  parsed_input = malloc(sizeof(char*) * 100);
-  while(fgets(commands[i], 1000, file) != NULL) {
-    commands[i][strcspn(commands[i], "\n")] = 0; // remove newline
-    
-    parse_string(commands[i]);
-    free(commands[i]);
-    i++;
-    if(i > 100) {
-      printf("Too many lines of commands.\n");
-      break;
-    }
-    commands[i] = malloc(sizeof(char) * 100);
-  }
+  read_commands(file);
 
   printf("\n");
-  if(i < 100) free(commands[i]);
-  free(parsed_input);
   fclose(file);
 }
 
 /**
  * Consumes whatever input the user gives
- * through the command line.
+ * through the command line. The line is read
+ * through the line editor, and kept in the
+ * history when it is not empty.
  *
+ * prompt:
+ *       prompt to show before the line
  * input:
  *      variable to store input given by user
  * char_count:
  *           maximum length of user input program can take
  *
- * Return value: 1 if input length is greater than 0, 0 otherwise
+ * Return value: 1 if input length is greater than 0, 0 otherwise,
+ *               -1 at end of input
  */
-int take_user_input(char* input, int char_count)
+int take_user_input(const char* prompt, char* input, int char_count)
 {
-  fgets(input, char_count, stdin); // copies user input into variable with newline
+  int len;
+
+  command_stream = stdin;
+  if((len = edit_line(prompt, input, char_count)) == -1) {
+    return -1;
+  }
 
-  input[strcspn(input, "\n")] = 0; // remove newline from input
-  if(strlen(input) != 0) {
+  if(len != 0) {
+    history_add(input);
     return 1;
   }
   else {
@@ -196,356 +183,944 @@ int take_user_input(char* input, int char_count)
 }
 
 /**
- * Helper method that goes through each 
- * char pointer in arr and memsets it back
- * to an empty state.
+ * Helper function for determining if a character
+ * separates words on a command line.
+ *
+ * Return value: 1 if true, 0 otherwise
+ */
+int is_blank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n';
+}
+
+/**
+ * Helper function for determining if a character
+ * ends a word because it starts an operator.
+ *
+ * Return value: 1 if true, 0 otherwise
+ */
+int is_operator(char c)
+{
+  return c == '|' || c == ';' || c == '&' || c == '<' || c == '>';
+}
+
+/**
+ * Helper function for determining if a process
+ * substitution, <( or >(, starts at c.
+ *
+ * Return value: 1 if true, 0 otherwise
+ */
+static int starts_substitution(const char* c)
+{
+  return (c[0] == '<' || c[0] == '>') && c[1] == '(';
+}
+
+/**
+ * Helper function for determining if a redirection
+ * starts at c, which is an operator made of '<' or
+ * '>' after an optional descriptor number. Like in
+ * other shells, 2>(cmd) is a word instead.
+ *
+ * Return value: 1 if true, 0 otherwise
+ */
+static int starts_redirect(const char* c)
+{
+  c += strspn(c, "0123456789");
+  return (*c == '<' || *c == '>') && !starts_substitution(c);
+}
+
+/**
+ * Makes room for need bytes in a word being built.
  *
- * arr:
- *    char pointer array to have its contents emptied
- * 
  * Return value: void
  */
-void double_init(char** arr)
+static void reserve_word(char** word, size_t* cap, size_t need)
+{
+  if(need <= *cap) return;
+  *cap = need > *cap * 2 ? need : *cap * 2;
+  *word = realloc(*word, *cap);
+}
+
+/**
+ * Copies a '$' of a function body into word, as a
+ * PARAM_MARK when it names a positional parameter.
+ * word has room for two more characters.
+ *
+ * Return value: position after what was copied
+ */
+static char* read_param(char* c, char* word, size_t* len)
 {
-  int i = 0;
-  while(arr[i]) {
-    memset(arr[i], '\0', sizeof(char) * strlen(arr[i]));
-    i++;
+  if(c[1] && strchr("0123456789#@*", c[1])) {
+    word[(*len)++] = PARAM_MARK;
+    word[(*len)++] = c[1];
+    return c + 2;
   }
+  word[(*len)++] = *c;
+  return c + 1;
 }
 
 /**
- * Processes the string by telling whether 
- * it is a built-in command or can be executed
- * by the system. If there is semi-colon detected,
- * the function loops until all semi-colon - separated 
- * commands have been executed.
+ * Finds the parenthesis that closes the one at open,
+ * skipping over nested pairs and quoted text.
  *
- * parsed_input:
- *             parsed input given by user
- * has_semi:
- *         1 if a semi-colon has been detected, 0 otherwise
- * bg: 
- *   1 if should be executed as a background process, 0 otherwise
+ * Return value: pointer to the closing ')', NULL if missing
  */
-void process_string(char** parsed_input, int has_semi, int bg)
+char* matching_paren(char* open)
 {
+  int depth = 0;
+  char* c;
+
+  for(c = open; *c; c++) {
+    if(*c == '\\' && c[1]) {
+      c++;
+    }
+    else if(*c == '\'') {
+      if(!(c = strchr(c + 1, '\''))) return NULL;
+    }
+    else if(*c == '"') {
+      for(c++; *c && *c != '"'; c++) {
+	if(*c == '\\' && c[1]) c++;
+      }
+      if(!*c) return NULL;
+    }
+    else if(*c == '(') depth++;
+    else if(*c == ')' && --depth == 0) return c;
+  }
+  return NULL;
+}
+
+/**
+ * Starts the command of one process substitution,
+ * connected to the shell through a pipe. For <(cmd)
+ * the command writes into the pipe, for >(cmd) it
+ * reads from it.
+ *
+ * command:
+ *        command line to run in the substitution
+ * is_input:
+ *         1 for <(cmd), 0 for >(cmd)
+ * list:
+ *     line whose earlier substitutions' pipe ends the child closes
+ * pid:
+ *    set to the process id of the started child
+ *
+ * Return value: the shell's end of the pipe, -1 on error
+ */
+int start_substitution(char* command, int is_input,
+		       struct command_list* list, pid_t* pid)
+{
+  int fds[2];
+  int i;
+
+  if(pipe2(fds, O_CLOEXEC) == -1) {
+    printf("Error: Pipe could not be initialized\n");
+    return -1;
+  }
+
+  fflush(stdout);
+  if((*pid = fork()) < 0) {
+    printf("Error: Could not fork\n");
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+
+  if(*pid == 0) {
+    // another substitution's pipe end would keep that
+    // pipe open and hold back its end of file
+    for(i = 0; i < list->num_substitutions; i++) {
+      close(list->substitutions[i].fd);
+    }
+    coproc_close_all(NULL);
+    dup2(fds[is_input ? 1 : 0], is_input ? STDOUT_FILENO : STDIN_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+
+    exec_in_place = !strpbrk(command, ";|&");
+    parse_string(command);
+    fflush(stdout);
+    _exit(last_exit_status);
+  }
+
+  close(fds[is_input ? 1 : 0]);
+  return fds[is_input ? 0 : 1];
+}
+
+/**
+ * Starts the process substitution, <(cmd) or >(cmd),
+ * at c, running concurrently with the line, and adds
+ * the /dev/fd/N path naming the shell's end of its
+ * pipe to the word being built.
+ *
+ * Return value: position after the ')', NULL on error
+ */
+static char* read_substitution(char* c, char** word, size_t* cap,
+			       size_t* len)
+{
+  struct command_list* list = parsing_list;
+  struct substitution* s;
+  char* close_paren;
   char* command;
-  char** semi_cmds;
-  int i, j;
-
-  i = 0, j = 0;
-  
-  command = parsed_input[0];
-  // if there is a semi-colon present in parsed_input
-  // then this loop executes each command when as soon
-  // as a semi-colon is detected
-  if(has_semi) {
-    semi_cmds = malloc(sizeof(char*) * 100);
-    while(parsed_input[i]) {
-      semi_cmds[j] = parsed_input[i];
-      if(has_character(parsed_input[i], ';')) {
-	semi_cmds[j][strcspn(semi_cmds[j], ";")] = 0;
-	if(is_own_command(semi_cmds[0])) {
-	  execute_built_in_command(semi_cmds);
+  char path[32];
+  long long start;
+  int n;
+
+  if(defining || !list) {
+    fprintf(stderr, "Error: Here-documents and process substitutions "
+	    "cannot be used in a function or alias\n");
+    return NULL;
+  }
+  if(!(close_paren = matching_paren(c + 1))) {
+    fprintf(stderr, "Error: Missing ')' in process substitution\n");
+    return NULL;
+  }
+  if(list->num_substitutions == MAXSUBST) {
+    fprintf(stderr, "Error: Too many process substitutions\n");
+    return NULL;
+  }
+  list->substitutions = realloc(list->substitutions, sizeof(struct substitution)
+				* (list->num_substitutions + 1));
+  s = &list->substitutions[list->num_substitutions];
+
+  start = now_ns();
+  command = strndup(c + 2, close_paren - c - 2);
+  s->fd = start_substitution(command, *c == '<', list, &s->pid);
+  free(command);
+  waiting_ns += now_ns() - start;
+  if(s->fd == -1) return NULL;
+  list->num_substitutions++;
+
+  n = snprintf(path, sizeof(path), "/dev/fd/%d", s->fd);
+  reserve_word(word, cap, *len + n + 3);
+  memcpy(*word + *len, path, n);
+  *len += n;
+  return close_paren + 1;
+}
+
+/**
+ * Reads one word starting at *cursor and moves the
+ * cursor past it. Single quotes keep everything up
+ * to the closing quote, double quotes do the same,
+ * and a backslash keeps the next character as is.
+ * An unquoted <(cmd) or >(cmd) is started as a
+ * process substitution and replaced with the path
+ * of its pipe. In a function body, parameters such
+ * as $1 are marked. Runs of plain characters are
+ * found with the line's masks and copied whole.
+ *
+ * cursor:
+ *       position in the command line, advanced past the word
+ * scan:
+ *     masks of the command line
+ *
+ * Return value: the word, which the caller frees, NULL on error
+ */
+char* read_word(char** cursor, const struct scan_index* scan)
+{
+  const unsigned dollar = marking_params ? SCAN_BIT(SCAN_DOLLAR) : 0;
+  const unsigned stops = SCAN_BIT(SCAN_BLANK) | SCAN_OPERATORS |
+    SCAN_BIT(SCAN_SQUOTE) | SCAN_BIT(SCAN_DQUOTE) | SCAN_BIT(SCAN_BACKSLASH) |
+    dollar;
+  const char* line = scan->text;
+  char* c = *cursor;
+  char* word = NULL;
+  size_t len = 0, cap = 0;
+
+  while(1) {
+    char* run = (char*) line + scan_next(scan, c - line, stops);
+
+    // room for the run, two more characters and the terminator
+    reserve_word(&word, &cap, len + (run - c) + 3);
+    memcpy(word + len, c, run - c);
+    len += run - c;
+    c = run;
+
+    if(*c == '\'' || *c == '"') {
+      char quote = *c++;
+      unsigned inside = quote == '"'
+	? SCAN_BIT(SCAN_DQUOTE) | SCAN_BIT(SCAN_BACKSLASH) | dollar
+	: SCAN_BIT(SCAN_SQUOTE);
+
+      while(1) {
+	run = (char*) line + scan_next(scan, c - line, inside);
+	reserve_word(&word, &cap, len + (run - c) + 3);
+	memcpy(word + len, c, run - c);
+	len += run - c;
+	c = run;
+
+	if(!*c) {
+	  fprintf(stderr, "Error: Unterminated quote\n");
+	  free(word);
+	  return NULL;
 	}
-	else {
-	  execute_unix_command(semi_cmds, bg);
+	if(*c == quote) break;
+	if(*c == '$') {
+	  c = read_param(c, word, &len);
+	  continue;
 	}
-	double_init(semi_cmds);
-	j = -1;
+	// a backslash inside double quotes
+	if(c[1] == '"' || c[1] == '\\') c++;
+	word[len++] = *c++;
+      }
+      c++;
+    }
+    else if(*c == '$') {
+      c = read_param(c, word, &len);
+    }
+    else if(*c == '\\' && c[1]) {
+      word[len++] = c[1];
+      c += 2;
+    }
+    else if(*c == '\\') {
+      word[len++] = *c++;
+    }
+    else if(starts_substitution(c)) {
+      if(!(c = read_substitution(c, &word, &cap, &len))) {
+	free(word);
+	return NULL;
       }
-      j++;
-      i++;
     }
-    free(semi_cmds);
+    else {
+      break;
+    }
   }
-  else if(is_own_command(command)) {
-    execute_built_in_command(parsed_input);
+
+  word[len] = 0;
+  *cursor = c;
+  return word;
+}
+
+/**
+ * Adds a word to the argument vector of cmd,
+ * keeping the vector NULL terminated.
+ *
+ * Return value: void
+ */
+void add_argument(struct command* cmd, char* word)
+{
+  cmd->argv = realloc(cmd->argv, sizeof(char*) * (cmd->argc + 2));
+  cmd->argv[cmd->argc++] = word;
+  cmd->argv[cmd->argc] = NULL;
+}
+
+/**
+ * Adds a redirection action to cmd.
+ *
+ * Return value: void
+ */
+void add_redirect(struct command* cmd, enum redirect_kind kind, int fd,
+		  int src_fd, int flags, char* path)
+{
+  struct redirect* r;
+
+  cmd->redirects = realloc(cmd->redirects,
+			   sizeof(struct redirect) * (cmd->num_redirects + 1));
+  r = &cmd->redirects[cmd->num_redirects++];
+  r->kind = kind;
+  r->fd = fd;
+  r->src_fd = src_fd;
+  r->flags = flags;
+  r->path = path;
+}
+
+/**
+ * Reads the body of a here-document from the lines
+ * following the current command, up to a line that
+ * consists of only the delimiter.
+ *
+ * delimiter:
+ *          word that ends the body
+ * strip_tabs:
+ *           1 for <<- which removes leading tabs from every line
+ * len:
+ *    set to the length of the body
+ *
+ * Return value: the body, which the caller frees, NULL on error
+ */
+char* read_heredoc_body(char* delimiter, int strip_tabs, size_t* len)
+{
+  char* body = NULL;
+  char* line = NULL;
+  size_t cap = 0;
+  ssize_t n;
+  FILE* out;
+
+  if(!command_stream) {
+    fprintf(stderr, "Error: here-document needs more input lines\n");
+    return NULL;
   }
-  else {
-    execute_unix_command(parsed_input, bg);
+  if(!(out = open_memstream(&body, len))) return NULL;
+
+  while(1) {
+    char* text;
+
+    if(command_stream == stdin && isatty(STDIN_FILENO)) {
+      printf("> ");
+      fflush(stdout);
+    }
+    if((n = getline(&line, &cap, command_stream)) == -1) {
+      fprintf(stderr, "Warning: here-document ended by end of file, "
+	      "wanted '%s'\n", delimiter);
+      break;
+    }
+    if(n > 0 && line[n - 1] == '\n') line[--n] = 0;
+
+    text = line;
+    if(strip_tabs) {
+      while(*text == '\t') text++;
+    }
+    if(strcmp(text, delimiter) == 0) break;
+
+    fputs(text, out);
+    fputc('\n', out);
   }
+
+  free(line);
+  fclose(out);
+  return body;
 }
 
 /**
- * Helper function for determining if 
- * input string contains a i/o redirect symbol.
+ * Turns a here-document or here-string body into a
+ * file descriptor positioned at its start. Small bodies
+ * go into a pipe, larger ones into an anonymous memfd,
+ * so nothing is ever written to the filesystem.
  *
- * input:
- *      input string to check
- * 
- * Return value: 1 if true, 0 otherwise
+ * body:
+ *     text to serve as input
+ * len:
+ *    length of the body
+ *
+ * Return value: readable file descriptor, -1 on error
  */
-int has_redirect(char* input)
+int heredoc_fd(const char* body, size_t len)
 {
-  return (strchr(input, '>') || strchr(input, '<'));
+  int fds[2];
+  int fd;
+
+  if(len <= HEREDOC_PIPE_MAX) {
+    if(pipe2(fds, O_CLOEXEC) == -1) return -1;
+    if(len > 0 && write(fds[1], body, len) != (ssize_t) len) {
+      close(fds[0]);
+      close(fds[1]);
+      return -1;
+    }
+    close(fds[1]);
+    return fds[0];
+  }
+
+  if((fd = memfd_create("heredoc", MFD_CLOEXEC)) == -1) return -1;
+  while(len > 0) {
+    ssize_t n = write(fd, body, len);
+    if(n <= 0) {
+      close(fd);
+      return -1;
+    }
+    body += n;
+    len -= n;
+  }
+  lseek(fd, 0, SEEK_SET);
+  return fd;
 }
 
 /**
- * Parses input string containing pipe redirection.
- * Splits the input into two commands, parses both, and
- * calls a method for executing commands by piping.
+ * Parses a here-document (<<WORD or <<-WORD) or a
+ * here-string (<<< word) starting at *cursor. The
+ * body is placed in a pipe or memfd which the
+ * command gets as fd, the word may be quoted.
  *
- * input:
- *      input string to parse by pipes
- * bg:
- *   1 if commands should be run in background, 0 otherwise
+ * cursor:
+ *       position of the "<<", advanced past the word
+ * fd:
+ *   descriptor the body is read from
+ * cmd:
+ *    command the redirection belongs to
+ * scan:
+ *     masks of the command line
  *
- * Return value: void
+ * Return value: 0 on success, -1 on error
  */
-void parse_pipe(char* input, int bg)
+static int parse_heredoc(char** cursor, int fd, struct command* cmd,
+			 const struct scan_index* scan)
 {
-  char** commands;
-  char** parsed_pipe1;
-  char** parsed_pipe2;
-
-  commands = malloc(sizeof(char*) * 5);
-  parsed_pipe1 = malloc(sizeof(char*) * 10);
-  parsed_pipe2 = malloc(sizeof(char*) * 10);
-  
-  commands[0] = strsep(&input, "|");
-  commands[1] = input;
-  
-  remove_leading_whitespace(&commands[1]);
-  
-  if(has_character(commands[0], ' ')) {
-    parse_spaces(commands[0], parsed_pipe1);
+  char* c = *cursor + 2;
+  const char* op = "<<";
+  char* word;
+  char* body;
+  size_t len;
+  int strip_tabs = 0, here_string = 0;
+  int body_fd;
+
+  if(*c == '<') {
+    here_string = 1;
+    op = "<<<";
+    c++;
   }
-  else {
-    parsed_pipe1[0] = commands[0];
+  else if(*c == '-') {
+    strip_tabs = 1;
+    op = "<<-";
+    c++;
+  }
+  if(defining) {
+    fprintf(stderr, "Error: Here-documents and process substitutions "
+	    "cannot be used in a function or alias\n");
+    return -1;
+  }
+
+  while(is_blank(*c)) c++;
+  if(!*c || is_operator(*c)) {
+    fprintf(stderr, "Error: Missing word after %s\n", op);
+    return -1;
   }
-  if(has_character(commands[1], ' ')) {
-    parse_spaces(commands[1], parsed_pipe2);
+  if(!(word = read_word(&c, scan))) return -1;
+  *cursor = c;
+
+  if(here_string) {
+    len = strlen(word);
+    body = malloc(len + 2);
+    memcpy(body, word, len);
+    body[len++] = '\n';
+    body[len] = 0;
   }
   else {
-    parsed_pipe2[0] = commands[1];
-  }
-  
-  execute_pipe(parsed_pipe1, parsed_pipe2, bg);
-  
-  free(parsed_pipe1);
-  free(parsed_pipe2);
-  free(commands);
+    long long start = now_ns();
+
+    body = read_heredoc_body(word, strip_tabs, &len);
+    waiting_ns += now_ns() - start;
+  }
+  free(word);
+  if(!body) return -1;
+
+  body_fd = heredoc_fd(body, len);
+  free(body);
+  if(body_fd == -1) {
+    fprintf(stderr, "Error: Unable to create here-document\n");
+    return -1;
+  }
+  add_redirect(cmd, REDIRECT_HEREDOC, fd, body_fd, 0, NULL);
+  return 0;
 }
 
 /**
- * Parses input string that contains i/o redirection
- * symbols, same as for piping. This method can parse, 
- * process, and send out for execution strings that contain
- * '>', '<', ">>", or a combination of one input and one output.
+ * Parses one redirection operator and its target
+ * starting at *cursor and adds the matching actions
+ * to cmd. Understands
  *
- * input:
- *      input string to check
- * bg:
- *   1 if process should be run in the background, 0 otherwise
+ *   [N]<  [N]>  [N]>|  [N]>>  [N]<>  [N]>&M  [N]<&M  [N]>&-
+ *   &>file  &>>file  >&file  [N]<<WORD  [N]<<-WORD  [N]<<< word
  *
- * Return value: void
+ * where N defaults to 0 for input and 1 for output.
+ *
+ * cursor:
+ *       position of the operator, advanced past its target
+ * cmd:
+ *    command the redirection belongs to
+ * scan:
+ *     masks of the command line
  *
- * PS - sorry for the length :)
- * I know, it's heinous
+ * Return value: 0 on success, -1 on a syntax error
  */
-void parse_redirect(char* input, int bg)
+int parse_redirect(char** cursor, struct command* cmd,
+		   const struct scan_index* scan)
 {
-  int in = 0, is_in = 0;
-  int out = 0, is_out = 0;
-  int d_out = 0, is_d_out = 0;
-  
-  char* cmd;
-  char* input_file_name;
-  char* output_file_name;
-
-  // determines what i/o redirect characters
-  // the input string has
-  if(has_character(input, '<')) in = 1;
-  
-  if(has_character(input, '>')) {
-    if(strstr(input, ">>")) {
-      d_out = 1;
-    }
-    else {
-      out = 1;
-    }
-  }
+  char* c = *cursor;
+  int fd = -1;
+  int both = 0, dup = 0;
+  int flags = 0;
+  char* target;
 
-  // sets the command and filename for input
-  // with only one redirect character
-  if(in && (!out && !d_out)) {
-    cmd = strsep(&input, "<");
-    input_file_name = input;
-  }
-  if(out && !in) {
-    cmd = strsep(&input, ">");
-    output_file_name = input;
+  if(*c >= '0' && *c <= '9') {
+    fd = strtol(c, &c, 10);
   }
-  if(d_out && !in) {
-    cmd = strsep(&input, ">>");
-    output_file_name = input;
+  if(c[0] == '<' && c[1] == '<') {
+    *cursor = c;
+    return parse_heredoc(cursor, fd == -1 ? STDIN_FILENO : fd, cmd, scan);
   }
 
-  // if there is both an input redirect symbol
-  // and one for output, loop till first redirect
-  // character is found and determine what it is
-  // to make splitting up/parsing the line easier
-  int i = 0;
-  if(in && out && !d_out) {
-    while(input[i]) {
-      if(input[i] == '<') {
-	is_in = 1;
-	break;
-      }
-      else if(input[i] == '>') {
-	is_out = 1;
-	break;
-      }
-      i++;
+  if(c[0] == '&' && c[1] == '>') {
+    both = 1;
+    c += 2;
+    flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if(*c == '>') {
+      flags = O_WRONLY | O_CREAT | O_APPEND;
+      c++;
     }
-
-    if(is_in) {
-      cmd = strsep(&input, "<");
-      input_file_name = strsep(&input, ">");
-      output_file_name = input;
+  }
+  else if(c[0] == '>') {
+    if(fd == -1) fd = STDOUT_FILENO;
+    flags = O_WRONLY | O_CREAT | O_TRUNC;
+    c++;
+    if(*c == '>') {
+      flags = O_WRONLY | O_CREAT | O_APPEND;
+      c++;
+    }
+    else if(*c == '&') {
+      dup = 1;
+      c++;
     }
-    else if(is_out) {
-      cmd = strsep(&input, ">");
-      output_file_name = strsep(&input, "<");
-      input_file_name = input;
+    else if(*c == '|') {
+      c++;
     }
   }
-  if(in && d_out && !out) {
-    while(input[i]) {
-      if(input[i] == '<') {
-	is_in = 1;
-	break;
-      }
-      else if(strcmp(input, ">>") == 0) {
-	is_d_out = 1;
-	break;
-      }
-      i++;
+  else {
+    if(fd == -1) fd = STDIN_FILENO;
+    flags = O_RDONLY;
+    c++;
+    if(*c == '>') {
+      flags = O_RDWR | O_CREAT;
+      c++;
     }
+    else if(*c == '&') {
+      dup = 1;
+      c++;
+    }
+  }
 
-    if(is_in) {
-      cmd = strsep(&input, "<");
-      input_file_name = strsep(&input, ">>");
-      output_file_name = input;
+  while(is_blank(*c)) c++;
+  // the target may be a process substitution, as in < <(cmd)
+  if(!*c || (is_operator(*c) && !starts_substitution(c)) ||
+     !(target = read_word(&c, scan))) {
+    fprintf(stderr, "Error: Missing file name after redirection\n");
+    return -1;
+  }
+  *cursor = c;
+
+  if(dup) {
+    char* end;
+    long src;
+
+    if(strcmp(target, "-") == 0) {
+      add_redirect(cmd, REDIRECT_CLOSE, fd, -1, 0, NULL);
+      free(target);
+      return 0;
     }
-    else if(is_d_out) {
-      cmd = strsep(&input, ">>");
-      output_file_name = strsep(&input, "<");
-      input_file_name = input;
+    src = strtol(target, &end, 10);
+    if(*end == 0 && end != target) {
+      add_redirect(cmd, REDIRECT_DUP, fd, (int) src, 0, NULL);
+      free(target);
+      return 0;
     }
+    // a coprocess name, looked up when the command runs; only
+    // >&word can still turn out to be the older spelling of &>file
+    if(flags == O_RDONLY || fd != STDOUT_FILENO) flags &= O_ACCMODE;
+    add_redirect(cmd, REDIRECT_COPROC, fd, -1, flags, target);
+    return 0;
   }
 
-  int out_fd, in_fd;
-  int saved_stdout, saved_stdin;
+  if(both) {
+    add_redirect(cmd, REDIRECT_OPEN, STDOUT_FILENO, -1, flags, target);
+    add_redirect(cmd, REDIRECT_DUP, STDERR_FILENO, STDOUT_FILENO, 0, NULL);
+  }
+  else {
+    add_redirect(cmd, REDIRECT_OPEN, fd, -1, flags, target);
+  }
+  return 0;
+}
 
-  // creates/opens file for output redirection - truncates if exists
-  if(out && !in) {
-    remove_leading_whitespace(&output_file_name);
-    saved_stdout = dup(STDOUT_FILENO);
-    
-    if((out_fd = creat(output_file_name, 00666 )) == -1) {
-      fprintf(stderr, "Error: Unable to create/open file\n");
-      return;
+/**
+ * Frees a command list and everything it owns.
+ *
+ * Return value: void
+ */
+void free_command_list(struct command_list* list)
+{
+  int i, j, k;
+
+  if(!list) return;
+
+  for(i = 0; i < list->num_pipelines; i++) {
+    struct pipeline* p = &list->pipelines[i];
+    for(j = 0; j < p->num_commands; j++) {
+      struct command* cmd = &p->commands[j];
+      for(k = 0; k < cmd->argc; k++) {
+	free(cmd->argv[k]);
+      }
+      for(k = 0; k < cmd->num_redirects; k++) {
+	free(cmd->redirects[k].path);
+	if(cmd->redirects[k].kind == REDIRECT_HEREDOC) {
+	  close(cmd->redirects[k].src_fd);
+	}
+      }
+      free(cmd->argv);
+      free(cmd->redirects);
     }
-    
-    dup2(out_fd, STDOUT_FILENO);
-    close(out_fd);
+    free(p->commands);
   }
-  // creates/opens file for input redirection
-  else if(in && (!out && !d_out)) {
-    remove_leading_whitespace(&input_file_name);
-    saved_stdin = dup(STDIN_FILENO);
-    
-    if((in_fd = open(input_file_name, O_RDONLY)) == -1) {
-      fprintf(stderr, "Error: Unable to create/open file\n");
-      return;
+  free(list->pipelines);
+  free(list->substitutions);
+  free(list);
+}
+
+/**
+ * Starts a new, empty command at the end of pipeline p.
+ *
+ * Return value: the new command
+ */
+struct command* new_command(struct pipeline* p)
+{
+  p->commands = realloc(p->commands, sizeof(struct command) *
+			(p->num_commands + 1));
+  memset(&p->commands[p->num_commands], 0, sizeof(struct command));
+  return &p->commands[p->num_commands++];
+}
+
+/**
+ * Starts a new, empty pipeline at the end of list.
+ *
+ * Return value: the new pipeline
+ */
+struct pipeline* new_pipeline(struct command_list* list)
+{
+  list->pipelines = realloc(list->pipelines, sizeof(struct pipeline) *
+			    (list->num_pipelines + 1));
+  memset(&list->pipelines[list->num_pipelines], 0, sizeof(struct pipeline));
+  return &list->pipelines[list->num_pipelines++];
+}
+
+/**
+ * Helper function for determining if a command
+ * has neither arguments nor redirections.
+ *
+ * Return value: 1 if true, 0 otherwise
+ */
+int is_empty_command(struct command* cmd)
+{
+  return cmd->argc == 0 && cmd->num_redirects == 0;
+}
+
+/**
+ * Closes the shell's ends of the process substitutions
+ * of a line. Their children are waited for after a
+ * foreground line and tracked like background jobs
+ * otherwise.
+ *
+ * list:
+ *     the line, which no longer holds substitutions after this
+ * bg:
+ *   1 if the line sent a command to the background
+ *
+ * Return value: void
+ */
+static void end_substitutions(struct command_list* list, int bg)
+{
+  int i;
+
+  for(i = 0; i < list->num_substitutions; i++) {
+    close(list->substitutions[i].fd);
+  }
+  for(i = 0; i < list->num_substitutions; i++) {
+    if(bg) {
+      track_child(list->substitutions[i].pid);
     }
-    
-    dup2(in_fd, STDIN_FILENO);
-    close(in_fd);
-  }
-  // creates/opens file for output redirection - appends if exists
-  else if(d_out && !in) {
-    remove2(output_file_name);
-    remove_leading_whitespace(&output_file_name);
-    saved_stdout = dup(STDOUT_FILENO);
-    
-    if((out_fd = open(output_file_name, O_WRONLY | O_CREAT | O_APPEND,
-		      00666 )) == -1) {
-      fprintf(stderr, "Error: Unable to create/open file\n");
-      return;
+    else {
+      wait_child(list->substitutions[i].pid);
     }
-    
-    dup2(out_fd, STDOUT_FILENO);
-    close(out_fd);
   }
+  list->num_substitutions = 0;
+}
 
-  // creates/opens file for both input and output redirection
-  if(in && (out || d_out)) {
-    remove_leading_whitespace(&input_file_name);
-    if(has_character(input_file_name, ' ')) {
-      input_file_name[strcspn(input_file_name, " ")] = 0;
-    }
-    saved_stdin = dup(STDIN_FILENO);
-    
-    if((in_fd = open(input_file_name, O_RDONLY)) == -1) {
-      fprintf(stderr, "Error: Unable to create/open file\n");
-      return;
+/**
+ * Splits a command line into pipelines separated by
+ * ';' or '&', pipelines into commands separated by
+ * '|', and commands into words and redirections.
+ *
+ * Return value: 0 on success, -1 on a syntax error
+ */
+static int split_line(struct command_list* list, char* input,
+		      const struct scan_index* scan)
+{
+  struct pipeline* p = NULL;
+  struct command* cmd = NULL;
+  char* c = input;
+
+  while(1) {
+    while(is_blank(*c)) c++;
+
+    if(!p) {
+      if(!*c) break;
+      p = new_pipeline(list);
+      cmd = new_command(p);
     }
-    
-    dup2(in_fd, STDIN_FILENO);
-    close(in_fd);
-
-    // create/open file for output redirection - truncates
-    if(out && !d_out) {
-      remove_leading_whitespace(&output_file_name);
-      if(has_character(output_file_name, ' ')) {
-	output_file_name[strcspn(output_file_name, " ")] = 0;
+
+    if(!*c || *c == ';' || (*c == '&' && c[1] != '>')) {
+      if(is_empty_command(cmd)) {
+	// an empty line between two separators is ignored
+	if(p->num_commands > 1) {
+	  fprintf(stderr, "Error: Missing command after '|'\n");
+	  return -1;
+	}
+	list->num_pipelines--;
+	free(p->commands);
       }
-      saved_stdout = dup(STDOUT_FILENO);
-      
-      if((out_fd = creat(output_file_name, 00666 )) == -1) {
-	fprintf(stderr, "Error: Unable to create/open file\n");
-	return;
+      else {
+	p->bg = (*c == '&');
       }
-      
-      dup2(out_fd, STDOUT_FILENO);
-      close(out_fd);
+      p = NULL;
+      if(!*c) break;
+      c++;
     }
-
-    // craete/open file for output redirection - appends
-    if(d_out && !out) {
-      remove2(output_file_name);
-      remove_leading_whitespace(&output_file_name);
-      if(has_character(output_file_name, ' ')) {
-	output_file_name[strcspn(output_file_name, " ")] = 0;
+    else if(*c == '|') {
+      if(is_empty_command(cmd)) {
+	fprintf(stderr, "Error: Missing command before '|'\n");
+	return -1;
       }
-      saved_stdout = dup(STDOUT_FILENO);
-      
-      if((out_fd = open(output_file_name, O_WRONLY | O_CREAT | O_APPEND,
-			00666 )) == -1) {
-	fprintf(stderr, "Error: Unable to create/open file\n");
-	return;
+      // |& sends stderr down the pipe as well
+      if(c[1] == '&') {
+	add_redirect(cmd, REDIRECT_DUP, STDERR_FILENO, STDOUT_FILENO, 0, NULL);
+	c++;
       }
-      
-      dup2(out_fd, STDOUT_FILENO);
-      close(out_fd);
+      cmd = new_command(p);
+      c++;
+    }
+    else if(*c == '&' || starts_redirect(c)) {
+      if(parse_redirect(&c, cmd, scan) == -1) return -1;
+    }
+    else {
+      char* word = read_word(&c, scan);
+      if(!word) return -1;
+      add_argument(cmd, word);
     }
   }
-  
-  parse_string(cmd);
 
-  // return stdout and stdin to its normal state
-  if(out || d_out) {
-    dup2(saved_stdout, STDOUT_FILENO);
-    close(saved_stdout);
+  return 0;
+}
+
+/**
+ * Parses a command line into a command list. Process
+ * substitutions on it are started as they are read.
+ *
+ * input:
+ *      command line to parse, left unchanged
+ * scan:
+ *     masks of input
+ *
+ * Return value: the parsed line, which the caller frees
+ *               with free_command_list, NULL on a syntax error
+ */
+struct command_list* parse_command_list(char* input,
+					const struct scan_index* scan)
+{
+  struct command_list* list = calloc(1, sizeof(struct command_list));
+  struct command_list* saved = parsing_list;
+  int err;
+
+  parsing_list = list;
+  err = split_line(list, input, scan);
+  parsing_list = saved;
+
+  if(err == -1) {
+    end_substitutions(list, 0);
+    free_command_list(list);
+    return NULL;
   }
-  if(in) {
-    dup2(saved_stdin, STDIN_FILENO);
-    close(saved_stdin);
+  return list;
+}
+
+/**
+ * Parses the body of a function or alias once, so
+ * running it later needs no tokenizing.
+ * Here-documents are read and process substitutions
+ * started as a line is parsed, so a body cannot hold
+ * either.
+ *
+ * Return value: the parsed body, which the caller frees
+ *               with free_command_list, NULL on a syntax error
+ */
+struct command_list* parse_definition(char* text, int params)
+{
+  struct command_list* list;
+  struct scan_index scan;
+
+  scan_line(&scan, text, strlen(text));
+  marking_params = params;
+  defining = 1;
+  list = parse_command_list(text, &scan);
+  defining = 0;
+  marking_params = 0;
+  scan_free(&scan);
+  return list;
+}
+
+/**
+ * Determines whether a trimmed body line ends with
+ * the '}' that closes a function.
+ *
+ * Return value: 1 if true, 0 otherwise
+ */
+static int ends_function(const char* text, size_t len)
+{
+  return len > 0 && text[len - 1] == '}' &&
+    (len == 1 || is_blank(text[len - 2]) || text[len - 2] == ';');
+}
+
+/**
+ * Defines a function when input starts with
+ * "name() {". The body runs to the matching '}',
+ * either on the same line or on a line of its own
+ * further down, and its lines are joined with ';'.
+ *
+ * input:
+ *      command line to check
+ *
+ * Return value: 1 if input was a definition, 0 otherwise
+ */
+static int parse_function(char* input)
+{
+  char* c = input;
+  char* name;
+  char* body = NULL;
+  char* line = NULL;
+  size_t name_len, body_len, cap = 0;
+  ssize_t n;
+  FILE* out;
+  int closed;
+
+  while(is_blank(*c)) c++;
+  name = c;
+  if(!(*c == '_' || (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z'))) {
+    return 0;
+  }
+  c += strspn(c, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+	      "0123456789_-");
+  name_len = c - name;
+  while(is_blank(*c)) c++;
+  if(c[0] != '(' || c[1] != ')') return 0;
+  for(c += 2; is_blank(*c); c++);
+  if(*c != '{') return 0;
+  c++;
+
+  if(!(out = open_memstream(&body, &body_len))) return 1;
+  while(1) {
+    size_t len = strlen(c);
+
+    while(len > 0 && is_blank(c[len - 1])) len--;
+    closed = ends_function(c, len);
+    fwrite(c, 1, closed ? len - 1 : len, out);
+    fputc(';', out);
+    if(closed) break;
+
+    if(!command_stream) break;
+    if(command_stream == stdin && isatty(STDIN_FILENO)) {
+      printf("> ");
+      fflush(stdout);
+    }
+    if((n = getline(&line, &cap, command_stream)) == -1) break;
+    c = line;
+  }
+  free(line);
+  fclose(out);
+
+  if(!closed) {
+    fprintf(stderr, "Error: Missing '}' after function %.*s\n",
+	    (int) name_len, name);
+    last_exit_status = 2;
   }
+  else {
+    name[name_len] = 0;
+    last_exit_status = define_function(name, body) == 0 ? 0 : 2;
+  }
+  free(body);
+  return 1;
 }
 
 /**
@@ -560,34 +1135,32 @@ void parse_redirect(char* input, int bg)
  */
 void parse_string(char* input)
 {
-  char** parsed_input;
-  int semi = 0;
+  struct command_list* list;
+  struct scan_index scan;
+  long long start, waited = waiting_ns;
   int bg = 0;
+  int i;
 
-  if(has_character(input, '&')) {
-    bg = 1;
-    input[strcspn(input, "&")] = 0;
-  }
-    
-  if(has_character(input, '|')) {
-    parse_pipe(input, bg);
+  if(parse_function(input)) return;
+  start = now_ns();
+
+  scan_line(&scan, input, strlen(input));
+  list = parse_command_list(input, &scan);
+  scan_free(&scan);
+  if(!list) {
+    last_exit_status = 2;
+    return;
   }
+  stats_parsed(now_ns() - start - (waiting_ns - waited));
 
-  if(has_redirect(input)) {
-    parse_redirect(input, bg);
+  // the commands have to inherit the substitutions' ends of the pipes
+  for(i = 0; i < list->num_substitutions; i++) {
+    fcntl(list->substitutions[i].fd, F_SETFD, 0);
   }
-  
-  else {
-    parsed_input = malloc(sizeof(char*) * 100);
-    
-    if(has_character(input, ';')) semi = 1;
-    if(has_character(input, ' ')) {
-      parse_spaces(input, parsed_input);
-    }
-    else {
-      parsed_input[0] = input;
-    }
-    process_string(parsed_input, semi, bg);
-    free(parsed_input);
+  for(i = 0; i < list->num_pipelines; i++) {
+    bg |= list->pipelines[i].bg;
+    execute_pipeline(&list->pipelines[i]);
   }
+  end_substitutions(list, bg);
+  free_command_list(list);
 }
@@ -10,18 +10,27 @@
 #ifndef PROCESS_H
 # define PROCESS_H
 
+#include <stdio.h>
+
+#include "command.h"
+
 /**
  * Consumes whatever input the user gives
- * through the command line.
+ * through the command line. The line is read
+ * through the line editor, and kept in the
+ * history when it is not empty.
  *
+ * prompt:
+ *       prompt to show before the line
  * input:
  *      variable to store input given by user
  * char_count:
  *           maximum length of user input program can take
  *
- * Return value: 1 if input length is greater than 0, 0 otherwise
+ * Return value: 1 if input length is greater than 0, 0 otherwise,
+ *               -1 at end of input
  */
-int take_user_input(char* input, int char_count);
+int take_user_input(const char* prompt, char* input, int char_count);
 
 /**
  * Determines if input has piping,
@@ -35,17 +44,47 @@ int take_user_input(char* input, int char_count);
  */
 void parse_string(char* input);
 
+/**
+ * Parses the body of a function or alias once, so
+ * running it later needs no tokenizing.
+ *
+ * text:
+ *     the body, left unchanged
+ * params:
+ *       1 to mark positional parameters like $1 in the words
+ *
+ * Return value: the parsed body, which the caller frees
+ *               with free_command_list, NULL on a syntax error
+ */
+struct command_list* parse_definition(char* text, int params);
+
+/**
+ * Frees a command list and everything it owns.
+ *
+ * Return value: void
+ */
+void free_command_list(struct command_list* list);
+
+/**
+ * Reads commands one line at a time from stream
+ * and executes each of them until end of file.
+ *
+ * stream:
+ *       open stream to read commands from
+ *
+ * Return value: void
+ */
+void read_commands(FILE* stream);
+
 /**
  * Reads any command line input given from 
  * the filename provided when executing the shell.
  *
  * filename:
  *         name of the text file to read from
- * commands: 
- *         array of character pointers to store commands in
  *
  * Return value: void
  */
-void read_input_from_file(char* filename, char** commands);
+void read_input_from_file(char* filename);
 
 #endif
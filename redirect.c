@@ -0,0 +1,196 @@
+/**
+ * This C file contains the redirection engine. A
+ * command's redirections are a list of fd actions
+ * (open, dup, close) that run in the child, either
+ * directly after a fork or as posix_spawn file
+ * actions.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+
+#include "redirect.h"
+#include "fdcache.h"
+#include "stats.h"
+
+extern char** environ;
+
+/**
+ * Applies the redirections of cmd to the calling
+ * process, in order.
+ *
+ * cmd:
+ *    command whose redirections to apply
+ *
+ * Return value: 0 on success, -1 if a redirection failed
+ */
+int apply_redirects(struct command* cmd)
+{
+  int i, fd;
+
+  for(i = 0; i < cmd->num_redirects; i++) {
+    struct redirect* r = &cmd->redirects[i];
+
+    switch(r->kind) {
+    case REDIRECT_OPEN:
+      if((fd = fdcache_get(r->path, r->flags)) != -1) {
+	// a cached fd stays open in the shell, only copy it
+	if(fd == r->fd) fcntl(fd, F_SETFD, 0);
+	else dup2(fd, r->fd);
+	break;
+      }
+      if((fd = open(r->path, r->flags, REDIRECT_MODE)) == -1) {
+	fprintf(stderr, "Error: Unable to create/open file %s\n", r->path);
+	return -1;
+      }
+      if(fd != r->fd) {
+	dup2(fd, r->fd);
+	close(fd);
+      }
+      break;
+    case REDIRECT_DUP:
+    case REDIRECT_COPROC:
+    case REDIRECT_HEREDOC:
+      if(r->src_fd == r->fd) {
+	// dup2 onto itself is a no-op, but the fd must survive exec
+	fcntl(r->fd, F_SETFD, 0);
+      }
+      else if(dup2(r->src_fd, r->fd) == -1) {
+	fprintf(stderr, "Error: %d: bad file descriptor\n", r->src_fd);
+	return -1;
+      }
+      break;
+    case REDIRECT_CLOSE:
+      close(r->fd);
+      break;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Starts a system command with posix_spawnp. The
+ * pipe ends and redirections are passed along as
+ * spawn file actions, so they take effect only in
+ * the new process. So does the directory of a
+ * command that has one.
+ *
+ * Return value: 0 on success, an errno value otherwise
+ */
+int spawn_command(struct command* cmd, int in_fd, int out_fd, pid_t pgid,
+		  pid_t* pid)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  long long start;
+  int i, err, fd;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawnattr_init(&attr);
+  if(pgid != -1) {
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, pgid);
+  }
+
+  // relative paths of the redirections are in the new directory
+  if(cmd->cwd) posix_spawn_file_actions_addchdir_np(&actions, cmd->cwd);
+
+  // pipes first, so that 2>&1 can point stderr into the pipe
+  if(in_fd != -1) posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+  if(out_fd != -1) posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+
+  for(i = 0; i < cmd->num_redirects; i++) {
+    struct redirect* r = &cmd->redirects[i];
+
+    switch(r->kind) {
+    case REDIRECT_OPEN:
+      if((fd = fdcache_get(r->path, r->flags)) != -1) {
+	posix_spawn_file_actions_adddup2(&actions, fd, r->fd);
+      }
+      else {
+	posix_spawn_file_actions_addopen(&actions, r->fd, r->path, r->flags,
+					 REDIRECT_MODE);
+      }
+      break;
+    case REDIRECT_DUP:
+    case REDIRECT_COPROC:
+    case REDIRECT_HEREDOC:
+      posix_spawn_file_actions_adddup2(&actions, r->src_fd, r->fd);
+      break;
+    case REDIRECT_CLOSE:
+      posix_spawn_file_actions_addclose(&actions, r->fd);
+      break;
+    }
+  }
+
+  start = now_ns();
+  err = posix_spawnp(pid, cmd->argv[0], &actions, &attr, cmd->argv, environ);
+  stats_spawned(*pid, cmd->argv[0], now_ns() - start, err != 0);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  return err;
+}
+
+/**
+ * Starts a program with the descriptors of a
+ * built-in. The sources are first copied above
+ * every descriptor the program is given, so no
+ * copy overwrites one still to be made.
+ *
+ * argv:
+ *     program and its arguments
+ * std_fds:
+ *        the program's stdin, stdout and stderr, -1 to close
+ * io:
+ *   built-in whose redirections above 2 the program gets
+ * pid:
+ *    set to the process id of the new process
+ *
+ * Return value: 0 on success, an errno value otherwise
+ */
+int spawn_with_io(char** argv, const int* std_fds,
+		  const struct builtin_io* io, pid_t* pid)
+{
+  struct command cmd;
+  struct redirect* r;
+  int i, top = STDERR_FILENO, err = 0;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.argv = argv;
+  if(!(cmd.redirects = calloc(io->num_redirects + 3,
+			      sizeof(struct redirect)))) {
+    return ENOMEM;
+  }
+  for(i = 0; i < 3; i++) {
+    r = &cmd.redirects[cmd.num_redirects++];
+    r->kind = std_fds[i] == -1 ? REDIRECT_CLOSE : REDIRECT_DUP;
+    r->fd = i;
+    r->src_fd = std_fds[i];
+  }
+  for(i = 0; i < io->num_redirects; i++) {
+    cmd.redirects[cmd.num_redirects++] = io->redirects[i];
+    if(io->redirects[i].fd > top) top = io->redirects[i].fd;
+  }
+  for(i = 0; i < cmd.num_redirects; i++) {
+    r = &cmd.redirects[i];
+    if(r->kind == REDIRECT_DUP &&
+       (r->src_fd = fcntl(r->src_fd, F_DUPFD_CLOEXEC, top + 1)) == -1) {
+      err = errno;
+    }
+  }
+
+  if(!err) err = spawn_command(&cmd, -1, -1, -1, pid);
+  for(i = 0; i < cmd.num_redirects; i++) {
+    r = &cmd.redirects[i];
+    if(r->kind == REDIRECT_DUP && r->src_fd != -1) close(r->src_fd);
+  }
+  free(cmd.redirects);
+  return err;
+}
@@ -0,0 +1,77 @@
+/**
+ * This is the header class for redirect.c
+ *
+ * These methods carry out the redirections of a
+ * parsed command. They only ever act inside the
+ * child that runs the command, so the shell's own
+ * file descriptors are never touched.
+ */
+
+#ifndef REDIRECT_H
+# define REDIRECT_H
+
+#include <sys/types.h>
+
+#include "command.h"
+
+// permissions of files created by a redirection, before the umask
+#define REDIRECT_MODE 00666
+
+/**
+ * Applies the redirections of cmd to the calling
+ * process, in order. Only to be called in a child
+ * about to run cmd, or right before the shell
+ * replaces itself with cmd.
+ *
+ * cmd:
+ *    command whose redirections to apply
+ *
+ * Return value: 0 on success, -1 if a redirection failed
+ */
+int apply_redirects(struct command* cmd);
+
+/**
+ * Starts a system command with posix_spawnp. The
+ * pipe ends and redirections are passed along as
+ * spawn file actions, so they take effect only in
+ * the new process. So does the directory of a
+ * command that has one.
+ *
+ * cmd:
+ *    command to start
+ * in_fd:
+ *      file descriptor to use as stdin, -1 to inherit
+ * out_fd:
+ *       file descriptor to use as stdout, -1 to inherit
+ * pgid:
+ *     process group to put the new process in, 0 for a
+ *     new group led by it, -1 to stay in the shell's
+ * pid:
+ *    set to the process id of the new process
+ *
+ * Return value: 0 on success, an errno value otherwise
+ */
+int spawn_command(struct command* cmd, int in_fd, int out_fd, pid_t pgid,
+		  pid_t* pid);
+
+/**
+ * Starts a program on behalf of a built-in, with
+ * every descriptor the built-in has: the three
+ * given ones and the others its redirections set
+ * up, so 2>&1 or 3<file reach the program too.
+ *
+ * argv:
+ *     program and its arguments
+ * std_fds:
+ *        the program's stdin, stdout and stderr, -1 to close
+ * io:
+ *   built-in whose redirections above 2 the program gets
+ * pid:
+ *    set to the process id of the new process
+ *
+ * Return value: 0 on success, an errno value otherwise
+ */
+int spawn_with_io(char** argv, const int* std_fds,
+		  const struct builtin_io* io, pid_t* pid);
+
+#endif
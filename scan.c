@@ -0,0 +1,300 @@
+/**
+ * This C file contains the classifier behind the
+ * tokenizer. A line is read in 64-byte blocks; each
+ * block yields one 64-bit mask per scan_class, so a
+ * search for the next operator, quote or blank is a
+ * count of trailing zeros rather than a loop over
+ * characters.
+ *
+ * On x86-64 the blocks are compared 32 bytes at a time
+ * with AVX2 when the CPU has it, else 16 at a time with
+ * SSE2, which every x86-64 CPU has. Other machines use
+ * a lookup table. The choice is made once, at run time,
+ * by whichever thread scans first.
+ * The same instructions count the new lines for wc -l.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "scan.h"
+
+#if defined(__x86_64__)
+# include <immintrin.h>
+#endif
+
+#define BLOCK 64
+
+/**
+ * The characters of each class.
+ */
+static const char class_chars[SCAN_CLASSES][4] = {
+  [SCAN_BLANK] = " \t\n",
+  [SCAN_PIPE] = "|",
+  [SCAN_AMP] = "&",
+  [SCAN_SEMI] = ";",
+  [SCAN_LT] = "<",
+  [SCAN_GT] = ">",
+  [SCAN_SQUOTE] = "'",
+  [SCAN_DQUOTE] = "\"",
+  [SCAN_BACKSLASH] = "\\",
+  [SCAN_DOLLAR] = "$",
+};
+
+static void (*classify)(const unsigned char* block,
+			uint64_t masks[SCAN_CLASSES]) = NULL;
+static size_t (*count_byte)(const unsigned char* buf, size_t len,
+			    unsigned char c) = NULL;
+// built-ins scan on pipeline threads, so the choice is made once for all
+static pthread_once_t classifier_once = PTHREAD_ONCE_INIT;
+
+#if defined(__x86_64__)
+/**
+ * Classifies one block 16 bytes at a time.
+ *
+ * Return value: void
+ */
+static void classify_sse2(const unsigned char* block,
+			  uint64_t masks[SCAN_CLASSES])
+{
+  __m128i v[BLOCK / 16];
+  int i, c;
+  const char* ch;
+
+  for(i = 0; i < BLOCK / 16; i++) {
+    v[i] = _mm_loadu_si128((const __m128i*) (block + 16 * i));
+  }
+  for(c = 0; c < SCAN_CLASSES; c++) {
+    uint64_t m = 0;
+    for(ch = class_chars[c]; *ch; ch++) {
+      __m128i want = _mm_set1_epi8(*ch);
+      for(i = 0; i < BLOCK / 16; i++) {
+	uint32_t hits = _mm_movemask_epi8(_mm_cmpeq_epi8(v[i], want));
+	m |= (uint64_t) hits << (16 * i);
+      }
+    }
+    masks[c] = m;
+  }
+}
+
+/**
+ * Classifies one block 32 bytes at a time.
+ *
+ * Return value: void
+ */
+__attribute__((target("avx2")))
+static void classify_avx2(const unsigned char* block,
+			  uint64_t masks[SCAN_CLASSES])
+{
+  __m256i lo = _mm256_loadu_si256((const __m256i*) block);
+  __m256i hi = _mm256_loadu_si256((const __m256i*) (block + 32));
+  int c;
+  const char* ch;
+
+  for(c = 0; c < SCAN_CLASSES; c++) {
+    uint64_t m = 0;
+    for(ch = class_chars[c]; *ch; ch++) {
+      __m256i want = _mm256_set1_epi8(*ch);
+      uint32_t l = _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, want));
+      uint32_t h = _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, want));
+      m |= (uint64_t) h << 32 | l;
+    }
+    masks[c] = m;
+  }
+}
+
+/**
+ * Counts the bytes equal to c, 16 at a time.
+ *
+ * Return value: the count
+ */
+static size_t count_sse2(const unsigned char* buf, size_t len,
+			 unsigned char c)
+{
+  __m128i want = _mm_set1_epi8(c);
+  size_t i = 0, n = 0;
+
+  for(; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (buf + i));
+    n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, want)));
+  }
+  for(; i < len; i++) {
+    n += buf[i] == c;
+  }
+  return n;
+}
+
+/**
+ * Counts the bytes equal to c, 64 at a time.
+ *
+ * Return value: the count
+ */
+__attribute__((target("avx2,popcnt")))
+static size_t count_avx2(const unsigned char* buf, size_t len,
+			 unsigned char c)
+{
+  __m256i want = _mm256_set1_epi8(c);
+  size_t i = 0, n = 0;
+
+  for(; i + 64 <= len; i += 64) {
+    __m256i lo = _mm256_loadu_si256((const __m256i*) (buf + i));
+    __m256i hi = _mm256_loadu_si256((const __m256i*) (buf + i + 32));
+    uint32_t l = _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, want));
+    uint32_t h = _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, want));
+    n += __builtin_popcountll((uint64_t) h << 32 | l);
+  }
+  for(; i < len; i++) {
+    n += buf[i] == c;
+  }
+  return n;
+}
+#else
+// class + 1 of every byte value, 0 for bytes in no class
+static unsigned char byte_class[256];
+
+/**
+ * Classifies one block a byte at a time.
+ *
+ * Return value: void
+ */
+static void classify_table(const unsigned char* block,
+			   uint64_t masks[SCAN_CLASSES])
+{
+  int i;
+
+  memset(masks, 0, sizeof(uint64_t) * SCAN_CLASSES);
+  for(i = 0; i < BLOCK; i++) {
+    int c = byte_class[block[i]];
+    if(c) masks[c - 1] |= 1ULL << i;
+  }
+}
+
+/**
+ * Counts the bytes equal to c with memchr.
+ *
+ * Return value: the count
+ */
+static size_t count_memchr(const unsigned char* buf, size_t len,
+			   unsigned char c)
+{
+  const unsigned char* end = buf + len;
+  size_t n = 0;
+
+  while((buf = memchr(buf, c, end - buf))) {
+    n++;
+    buf++;
+  }
+  return n;
+}
+#endif
+
+/**
+ * Picks the fastest classifier and counter the CPU
+ * supports.
+ *
+ * Return value: void
+ */
+static void choose_classifier()
+{
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    classify = classify_avx2;
+    count_byte = count_avx2;
+  }
+  else {
+    classify = classify_sse2;
+    count_byte = count_sse2;
+  }
+#else
+  const char* ch;
+  int c;
+
+  for(c = 0; c < SCAN_CLASSES; c++) {
+    for(ch = class_chars[c]; *ch; ch++) {
+      byte_class[(unsigned char) *ch] = c + 1;
+    }
+  }
+  classify = classify_table;
+  count_byte = count_memchr;
+#endif
+}
+
+/**
+ * Classifies the bytes of a line.
+ *
+ * Return value: void
+ */
+void scan_line(struct scan_index* idx, const char* text, size_t len)
+{
+  unsigned char tail[BLOCK];
+  size_t b, full = len / BLOCK;
+
+  pthread_once(&classifier_once, choose_classifier);
+
+  idx->text = text;
+  idx->len = len;
+  idx->num_blocks = (len + BLOCK - 1) / BLOCK;
+  idx->blocks = idx->inline_blocks;
+  if(idx->num_blocks > SCAN_INLINE_BLOCKS) {
+    idx->blocks = malloc(sizeof(*idx->blocks) * idx->num_blocks);
+  }
+
+  for(b = 0; b < full; b++) {
+    classify((const unsigned char*) text + b * BLOCK, idx->blocks[b]);
+  }
+  // the last partial block is padded with bytes of no class
+  if(full < idx->num_blocks) {
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, text + full * BLOCK, len - full * BLOCK);
+    classify(tail, idx->blocks[full]);
+  }
+}
+
+/**
+ * Finds the next byte at or after pos that belongs to
+ * one of the given classes.
+ *
+ * Return value: offset of the byte, the length of the line if none
+ */
+size_t scan_next(const struct scan_index* idx, size_t pos, unsigned classes)
+{
+  size_t b = pos / BLOCK;
+  uint64_t bits = 0;
+  unsigned todo;
+
+  if(pos >= idx->len) return idx->len;
+
+  while(1) {
+    for(todo = classes; todo; todo &= todo - 1) {
+      bits |= idx->blocks[b][__builtin_ctz(todo)];
+    }
+    // bytes before pos in the first block do not count
+    if(b == pos / BLOCK) bits &= ~0ULL << (pos % BLOCK);
+    if(bits) return b * BLOCK + __builtin_ctzll(bits);
+    if(++b == idx->num_blocks) return idx->len;
+  }
+}
+
+/**
+ * Counts the bytes equal to c in buf.
+ *
+ * Return value: the count
+ */
+size_t scan_count(const char* buf, size_t len, char c)
+{
+  pthread_once(&classifier_once, choose_classifier);
+  return count_byte((const unsigned char*) buf, len, (unsigned char) c);
+}
+
+/**
+ * Frees the masks made by scan_line.
+ *
+ * Return value: void
+ */
+void scan_free(struct scan_index* idx)
+{
+  if(idx->blocks != idx->inline_blocks) free(idx->blocks);
+  idx->blocks = NULL;
+}
@@ -0,0 +1,107 @@
+/**
+ * This is the header class for scan.c
+ *
+ * These methods classify every byte of a command line
+ * in one pass, 64 bytes at a time, into one bitmask
+ * per kind of character the tokenizer stops at. The
+ * tokenizer then jumps from one marked byte to the
+ * next instead of testing each character.
+ */
+
+#ifndef SCAN_H
+# define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Kinds of characters that are marked.
+ */
+enum scan_class {
+  SCAN_BLANK,      // ' ', '\t', '\n'
+  SCAN_PIPE,       // |
+  SCAN_AMP,        // &
+  SCAN_SEMI,       // ;
+  SCAN_LT,         // <
+  SCAN_GT,         // >
+  SCAN_SQUOTE,     // '
+  SCAN_DQUOTE,     // "
+  SCAN_BACKSLASH,  // backslash
+  SCAN_DOLLAR,     // $
+  SCAN_CLASSES
+};
+
+#define SCAN_BIT(class) (1u << (class))
+// characters that end a word because they start an operator
+#define SCAN_OPERATORS (SCAN_BIT(SCAN_PIPE) | SCAN_BIT(SCAN_AMP) | \
+			SCAN_BIT(SCAN_SEMI) | SCAN_BIT(SCAN_LT) | \
+			SCAN_BIT(SCAN_GT))
+
+// lines of up to this many 64-byte blocks need no allocation
+#define SCAN_INLINE_BLOCKS 8
+
+/**
+ * The masks of one line. Bit i of blocks[b][class] is
+ * set when byte 64 * b + i belongs to class.
+ */
+struct scan_index {
+  const char* text;
+  size_t len;
+  size_t num_blocks;
+  uint64_t (*blocks)[SCAN_CLASSES];
+  uint64_t inline_blocks[SCAN_INLINE_BLOCKS][SCAN_CLASSES];
+};
+
+/**
+ * Classifies the bytes of a line. Uses AVX2 or SSE2
+ * when the CPU has them and a lookup table otherwise.
+ *
+ * idx:
+ *    filled in with the masks, freed with scan_free
+ * text:
+ *     the line, which must stay unchanged while idx is used
+ * len:
+ *    length of the line
+ *
+ * Return value: void
+ */
+void scan_line(struct scan_index* idx, const char* text, size_t len);
+
+/**
+ * Finds the next byte at or after pos that belongs to
+ * one of the given classes.
+ *
+ * idx:
+ *    masks made by scan_line
+ * pos:
+ *    offset to start at
+ * classes:
+ *        SCAN_BIT values or'ed together
+ *
+ * Return value: offset of the byte, the length of the line if none
+ */
+size_t scan_next(const struct scan_index* idx, size_t pos, unsigned classes);
+
+/**
+ * Counts the bytes equal to c in buf, with the same
+ * vector instructions as scan_line.
+ *
+ * buf:
+ *    bytes to look at
+ * len:
+ *    number of bytes
+ * c:
+ *  byte to count
+ *
+ * Return value: the count
+ */
+size_t scan_count(const char* buf, size_t len, char c);
+
+/**
+ * Frees the masks made by scan_line.
+ *
+ * Return value: void
+ */
+void scan_free(struct scan_index* idx);
+
+#endif
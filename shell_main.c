@@ -1,26 +1,81 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/wait.h>
+#include <unistd.h>
 
 #include "draw.h"
 #include "process.h"
 #include "commands.h"
+#include "complete.h"
+#include "history.h"
+#include "jobs.h"
+#include "jobsched.h"
+#include "lineedit.h"
+#include "audit.h"
+#include "stats.h"
 
 #define MAXINPUT 1000
-#define MAXCOUNT 100
 
 /**
- * Main method - It first clears the screen and prints some 
- * shell info for the user. Next, if there is a file present
- * in the arguments, it is read from and the shell exits. If not, 
- * the shell goes into an infinite loop reading in and asking for
- * input from the user.
+ * Main method - The shell runs in one of four modes:
+ *
+ *   shell_main -c 'cmd'   runs cmd and exits
+ *   shell_main -s         reads commands from stdin until EOF
+ *   shell_main file       runs every line of file and exits
+ *   shell_main            interactive
+ *
+ * The first two are meant for tooling and skip the screen
+ * clear, the banner and the prompt, so nothing but the
+ * commands themselves touches the terminal. Input that is
+ * not a terminal is treated like -s. Only the interactive
+ * mode clears the screen, prints some shell info and goes
+ * into an infinite loop reading input from the user.
  */
 int main(int argc, char* argv[]) {
   char input[MAXINPUT];
-  char* commands[MAXCOUNT];
+
+  audit_open();
+  stats_open();
+
+  if(argc > 1 && strcmp(argv[1], "-c") == 0) {
+    if(argc < 3) {
+      fprintf(stderr, "usage: %s -c command\n", argv[0]);
+      exit(2);
+    }
+    // several lines are run like a script, which also
+    // lets here-documents find their bodies
+    if(strchr(argv[2], '\n')) {
+      FILE* script = fmemopen(argv[2], strlen(argv[2]), "r");
+      read_commands(script);
+      fclose(script);
+    }
+    else {
+      // the parser may write into the line, which must not
+      // reach past argv[2] into the strings after it
+      char* line = strdup(argv[2]);
+
+      if(!line) {
+	fprintf(stderr, "Error: Out of memory while reading command\n");
+	exit(1);
+      }
+      // a lone command has nothing to return to
+      exec_in_place = !strpbrk(line, ";|&");
+      parse_string(line);
+      free(line);
+    }
+    // queued background jobs still need starting
+    jobsched_drain();
+    fflush(stdout);
+    exit(last_exit_status);
+  }
+
+  if((argc > 1 && strcmp(argv[1], "-s") == 0) ||
+     (argc == 1 && !isatty(STDIN_FILENO))) {
+    read_commands(stdin);
+    jobsched_drain();
+    fflush(stdout);
+    exit(last_exit_status);
+  }
 
   // clear the screen
   clr();
@@ -29,19 +84,33 @@ int main(int argc, char* argv[]) {
 
   // read from file if provided
   if(argv[1]) {
-    read_input_from_file(argv[1], commands);
+    read_input_from_file(argv[1]);
+    jobsched_drain();
     exit(0); 
   }
 
   // give the user the prompt, take input, display results
   // also, check the status of any background processes
+  history_open();
+  complete_start();
+  // queued background jobs start even while nobody types
+  edit_line_watch(jobsched_ready_fd(), jobsched_start_ready);
   while(1) {
-    int status;
-    waitpid(-1, &status, WNOHANG);
-    prompt();
+    int got;
+
+    reap_children();
+    jobsched_start_ready();
+    got = take_user_input(prompt_text(), input, MAXINPUT);
+    if(got == -1) {
+      // end of input quits like the quit built-in
+      printf("Goodbye...\n");
+      exit(last_exit_status);
+    }
+    if(got && strlen(input) > 1) {
+      long long start = now_ns();
 
-    if(take_user_input(input, MAXINPUT) && strlen(input) > 1) {
       parse_string(input);
+      prompt_command_time((now_ns() - start) / 1000000);
     }
   }
 }
@@ -0,0 +1,239 @@
+/**
+ * Reader of the statistics segment that shells run
+ * with MYSHELL_STATS publish into. It maps the segment
+ * read-only and adds up every slot, so it never
+ * signals or waits for a shell; a count it reads
+ * while a shell is adding to it is at most one
+ * update behind.
+ *
+ * usage: shstat [-i seconds] [-n commands] [name]
+ *
+ * name defaults to MYSHELL_STATS, or the segment
+ * shells use when that is empty. With -i the totals
+ * are printed again every so many seconds.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+
+#define DEFAULT_COMMANDS 20
+
+/**
+ * Totals of one histogram over every slot.
+ */
+struct histogram_total {
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t buckets[STATS_BUCKETS];
+};
+
+/**
+ * Totals of one command name over every slot.
+ */
+struct command_total {
+  char name[STATS_NAME_LEN];
+  uint64_t runs;
+  uint64_t failures;
+  uint64_t wall_ns;
+  uint64_t cpu_ns;
+};
+
+/**
+ * Prints a time in microseconds with a fitting unit.
+ */
+static void print_us(double us)
+{
+  if(us < 1000) printf("%.0f us", us);
+  else if(us < 1000000) printf("%.1f ms", us / 1000);
+  else printf("%.2f s", us / 1000000);
+}
+
+/**
+ * Adds a histogram of a slot to the totals.
+ */
+static void add_histogram(struct histogram_total* total,
+			  struct stats_histogram* h)
+{
+  int b;
+
+  total->count += atomic_load_explicit(&h->count, memory_order_relaxed);
+  total->sum_ns += atomic_load_explicit(&h->sum_ns, memory_order_relaxed);
+  for(b = 0; b < STATS_BUCKETS; b++) {
+    total->buckets[b] += atomic_load_explicit(&h->buckets[b],
+					      memory_order_relaxed);
+  }
+}
+
+/**
+ * Prints the mean of a histogram and the bucket
+ * bounds of its median and 99th percentile.
+ */
+static void print_histogram(const char* label, struct histogram_total* h)
+{
+  const double quantiles[] = { 0.5, 0.99 };
+  uint64_t seen;
+  int q, b;
+
+  printf("%-12s %10llu", label, (unsigned long long) h->count);
+  if(!h->count) {
+    putchar('\n');
+    return;
+  }
+  printf(", mean ");
+  print_us(h->sum_ns / 1000.0 / h->count);
+
+  for(q = 0; q < 2; q++) {
+    seen = 0;
+    for(b = 0; b < STATS_BUCKETS - 1; b++) {
+      seen += h->buckets[b];
+      if(seen >= quantiles[q] * h->count) break;
+    }
+    printf(", p%.0f < ", quantiles[q] * 100);
+    print_us((double) (1ULL << b));
+  }
+  putchar('\n');
+}
+
+/**
+ * Orders command totals by CPU time, most first.
+ */
+static int by_cpu(const void* a, const void* b)
+{
+  const struct command_total* x = a;
+  const struct command_total* y = b;
+
+  if(x->cpu_ns != y->cpu_ns) return x->cpu_ns < y->cpu_ns ? 1 : -1;
+  return strcmp(x->name, y->name);
+}
+
+/**
+ * Adds up every slot of the segment and prints the
+ * totals, with the commands that used the most CPU.
+ */
+static void report(struct stats_segment* seg, int max_commands)
+{
+  struct histogram_total spawn_time = { 0 }, parse_time = { 0 };
+  struct command_total* commands;
+  uint64_t spawns = 0, failures = 0;
+  int shells = 0, num_commands = 0;
+  int i, j, k;
+
+  commands = calloc(STATS_SLOTS * STATS_NAMES, sizeof(struct command_total));
+  if(!commands) {
+    fprintf(stderr, "shstat: out of memory\n");
+    exit(1);
+  }
+
+  for(i = 0; i < STATS_SLOTS; i++) {
+    struct stats_slot* s = &seg->slots[i];
+
+    if(atomic_load(&s->owner)) shells++;
+    spawns += atomic_load_explicit(&s->spawns, memory_order_relaxed);
+    failures += atomic_load_explicit(&s->spawn_failures, memory_order_relaxed);
+    add_histogram(&spawn_time, &s->spawn_time);
+    add_histogram(&parse_time, &s->parse_time);
+
+    for(j = 0; j < STATS_NAMES; j++) {
+      struct stats_command* c = &s->commands[j];
+      struct command_total* t;
+
+      if(!atomic_load_explicit(&c->used, memory_order_acquire)) break;
+      for(k = 0; k < num_commands; k++) {
+	if(strncmp(commands[k].name, c->name, STATS_NAME_LEN) == 0) break;
+      }
+      t = &commands[k];
+      if(k == num_commands) {
+	memcpy(t->name, c->name, STATS_NAME_LEN);
+	t->name[STATS_NAME_LEN - 1] = 0;
+	num_commands++;
+      }
+      t->runs += atomic_load_explicit(&c->runs, memory_order_relaxed);
+      t->failures += atomic_load_explicit(&c->failures, memory_order_relaxed);
+      t->wall_ns += atomic_load_explicit(&c->wall_ns, memory_order_relaxed);
+      t->cpu_ns += atomic_load_explicit(&c->cpu_ns, memory_order_relaxed);
+    }
+  }
+
+  printf("shells: %d running, spawns: %llu, failed to spawn: %llu\n", shells,
+	 (unsigned long long) spawns, (unsigned long long) failures);
+  print_histogram("spawn time", &spawn_time);
+  print_histogram("parse time", &parse_time);
+
+  qsort(commands, num_commands, sizeof(struct command_total), by_cpu);
+  printf("\n%-24s %10s %10s %12s %12s\n", "command", "runs", "failed",
+	 "wall s", "cpu s");
+  for(i = 0; i < num_commands && i < max_commands; i++) {
+    printf("%-24s %10llu %10llu %12.3f %12.3f\n", commands[i].name,
+	   (unsigned long long) commands[i].runs,
+	   (unsigned long long) commands[i].failures,
+	   commands[i].wall_ns / 1e9, commands[i].cpu_ns / 1e9);
+  }
+  free(commands);
+}
+
+int main(int argc, char* argv[])
+{
+  const char* env = getenv("MYSHELL_STATS");
+  struct stats_segment* seg;
+  struct stat st;
+  char name[256];
+  int interval = 0, max_commands = DEFAULT_COMMANDS;
+  int opt, fd;
+
+  while((opt = getopt(argc, argv, "i:n:")) != -1) {
+    switch(opt) {
+    case 'i':
+      interval = atoi(optarg);
+      break;
+    case 'n':
+      max_commands = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-i seconds] [-n commands] [name]\n",
+	      argv[0]);
+      return 2;
+    }
+  }
+  if(optind < argc) env = argv[optind];
+  if(!env || !*env) env = STATS_DEFAULT_NAME;
+  snprintf(name, sizeof(name), "%s%s", *env != '/' ? "/" : "", env);
+
+  if((fd = shm_open(name, O_RDONLY, 0)) == -1) {
+    fprintf(stderr, "shstat: %s: %s\n", name, strerror(errno));
+    return 1;
+  }
+  // a segment still being made may not have its size yet
+  if(fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(*seg)) {
+    fprintf(stderr, "shstat: %s is not a statistics segment\n", name);
+    return 1;
+  }
+  seg = mmap(NULL, sizeof(struct stats_segment), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(seg == MAP_FAILED) {
+    fprintf(stderr, "shstat: %s: %s\n", name, strerror(errno));
+    return 1;
+  }
+  if(atomic_load(&seg->magic) != STATS_MAGIC) {
+    fprintf(stderr, "shstat: %s was not made by this version\n", name);
+    return 1;
+  }
+
+  while(1) {
+    report(seg, max_commands);
+    if(interval <= 0) break;
+    fflush(stdout);
+    sleep(interval);
+    printf("\n");
+  }
+  return 0;
+}
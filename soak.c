@@ -0,0 +1,335 @@
+/**
+ * Soak test for the shell. It feeds "shell_main -s" a
+ * generated script of mixed command lines (pipelines,
+ * redirections, background jobs, ';' lists, functions,
+ * and commands and redirections that fail) and, every
+ * so many lines, samples the shell's resident memory,
+ * open descriptors and zombie children from /proc.
+ *
+ * Samples are taken at a sync point: the script echoes
+ * a marker and the sample waits until the marker comes
+ * back, so every line before it has run. The first
+ * sample is the baseline; the test fails as soon as
+ * memory or descriptors grow past their bound over it,
+ * or zombies exceed theirs.
+ *
+ * usage: soak [-r KiB] [-f fds] [-z zombies] [-s lines]
+ *             <shell> [lines]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define DEFAULT_LINES 1000000
+// growth over the baseline allowed before the test fails
+#define DEFAULT_RSS_KIB 4096
+#define DEFAULT_FDS 0
+#define DEFAULT_ZOMBIES 4
+#define SAMPLES 100
+#define MARKER "@soak-sync "
+
+extern char** environ;
+
+/**
+ * Command lines of the script; %1$s is a scratch directory.
+ */
+static const char* templates[] = {
+  "/bin/true",
+  "/bin/echo soak | /usr/bin/tr a-z A-Z | /bin/cat > /dev/null",
+  "echo soak > %1$s/out; cat < %1$s/out > %1$s/copy",
+  "/bin/true &",
+  "/nonexistent/soak-command",
+  "echo soak > %1$s/missing/file",
+  "cat < %1$s/missing",
+  "/bin/sleep 0 & /bin/true; /bin/echo soak 2>&1 >> %1$s/log",
+  "soakf x | /bin/cat > /dev/null",
+  "soakf y",
+  "/bin/cat %1$s/missing 2> /dev/null",
+  "wc -l < %1$s/copy > /dev/null",
+  "/bin/echo soak > %1$s/missing/file",
+  "timeout 5 /bin/true | wc -l > /dev/null",
+  "/bin/echo soak > %1$s/log",
+};
+
+#define NUM_TEMPLATES (sizeof(templates) / sizeof(templates[0]))
+
+// the last marker read back from the shell
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sync_seen = PTHREAD_COND_INITIALIZER;
+static long last_marker = -1;
+static int output_closed = 0;
+
+/**
+ * Thread body that drains the shell's output and
+ * notes every marker in it.
+ */
+static void* read_output(void* arg)
+{
+  FILE* out = arg;
+  char* line = NULL;
+  size_t cap = 0;
+  char* mark;
+
+  while(getline(&line, &cap, out) != -1) {
+    if(!(mark = strstr(line, MARKER))) continue;
+    pthread_mutex_lock(&sync_lock);
+    last_marker = atol(mark + strlen(MARKER));
+    pthread_cond_broadcast(&sync_seen);
+    pthread_mutex_unlock(&sync_lock);
+  }
+  pthread_mutex_lock(&sync_lock);
+  output_closed = 1;
+  pthread_cond_broadcast(&sync_seen);
+  pthread_mutex_unlock(&sync_lock);
+  free(line);
+  return NULL;
+}
+
+/**
+ * Writes a marker into the script and waits until the
+ * shell has run everything before it.
+ *
+ * Return value: 0 once synced, -1 if the shell went away
+ */
+static int sync_shell(FILE* script, long n)
+{
+  int ok;
+
+  fprintf(script, "echo " MARKER "%ld\n", n);
+  fflush(script);
+
+  pthread_mutex_lock(&sync_lock);
+  while(last_marker < n && !output_closed) {
+    pthread_cond_wait(&sync_seen, &sync_lock);
+  }
+  ok = last_marker >= n;
+  pthread_mutex_unlock(&sync_lock);
+  return ok ? 0 : -1;
+}
+
+/**
+ * Reads the resident set size of a process.
+ *
+ * Return value: size in KiB, -1 on error
+ */
+static long rss_kib(pid_t pid)
+{
+  char path[64], line[256];
+  long kib = -1;
+  FILE* f;
+
+  snprintf(path, sizeof(path), "/proc/%d/status", pid);
+  if(!(f = fopen(path, "r"))) return -1;
+  while(fgets(line, sizeof(line), f)) {
+    if(sscanf(line, "VmRSS: %ld", &kib) == 1) break;
+  }
+  fclose(f);
+  return kib;
+}
+
+/**
+ * Counts the open descriptors of a process.
+ *
+ * Return value: the count, -1 on error
+ */
+static int open_fds(pid_t pid)
+{
+  char path[64];
+  struct dirent* e;
+  int n = 0;
+  DIR* dir;
+
+  snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+  if(!(dir = opendir(path))) return -1;
+  while((e = readdir(dir))) {
+    if(e->d_name[0] != '.') n++;
+  }
+  closedir(dir);
+  return n;
+}
+
+/**
+ * Counts the children of a process that have exited
+ * and not been reaped, looking through every process
+ * since the shell has several threads.
+ *
+ * Return value: the count
+ */
+static int zombies(pid_t parent)
+{
+  char path[300], stat[512];
+  struct dirent* e;
+  int n = 0, ppid;
+  char state;
+  char* close_paren;
+  DIR* proc;
+  FILE* f;
+
+  if(!(proc = opendir("/proc"))) return 0;
+  while((e = readdir(proc))) {
+    if(e->d_name[0] < '0' || e->d_name[0] > '9') continue;
+    snprintf(path, sizeof(path), "/proc/%s/stat", e->d_name);
+    if(!(f = fopen(path, "r"))) continue;
+    if(fgets(stat, sizeof(stat), f) &&
+       (close_paren = strrchr(stat, ')')) &&
+       sscanf(close_paren + 1, " %c %d", &state, &ppid) == 2 &&
+       ppid == parent && state == 'Z') {
+      n++;
+    }
+    fclose(f);
+  }
+  closedir(proc);
+  return n;
+}
+
+/**
+ * Starts the shell in -s mode with its input and
+ * output on pipes.
+ *
+ * Return value: process id of the shell, -1 on error
+ */
+static pid_t start_shell(const char* shell, FILE** script, FILE** output)
+{
+  posix_spawn_file_actions_t actions;
+  char* argv[] = { (char*) shell, "-s", NULL };
+  int in[2], out[2];
+  pid_t pid;
+
+  if(pipe(in) == -1 || pipe(out) == -1) return -1;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, out[1], STDERR_FILENO);
+  posix_spawn_file_actions_addclose(&actions, in[1]);
+  posix_spawn_file_actions_addclose(&actions, out[0]);
+  if(posix_spawn(&pid, shell, &actions, NULL, argv, environ) != 0) {
+    posix_spawn_file_actions_destroy(&actions);
+    return -1;
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  close(in[0]);
+  close(out[1]);
+
+  *script = fdopen(in[1], "w");
+  *output = fdopen(out[0], "r");
+  return pid;
+}
+
+int main(int argc, char* argv[])
+{
+  long lines = DEFAULT_LINES, every = 0, n;
+  long rss_bound = DEFAULT_RSS_KIB, base_rss = 0, rss;
+  int fd_bound = DEFAULT_FDS, zombie_bound = DEFAULT_ZOMBIES;
+  int base_fds = 0, fds, dead, failed = 0;
+  unsigned long seed = 1;
+  char dir[] = "/tmp/soak.XXXXXX";
+  char command[512];
+  FILE* script;
+  FILE* output;
+  pthread_t reader;
+  pid_t pid;
+  int opt, status;
+
+  while((opt = getopt(argc, argv, "r:f:z:s:")) != -1) {
+    switch(opt) {
+    case 'r':
+      rss_bound = atol(optarg);
+      break;
+    case 'f':
+      fd_bound = atoi(optarg);
+      break;
+    case 'z':
+      zombie_bound = atoi(optarg);
+      break;
+    case 's':
+      every = atol(optarg);
+      break;
+    default:
+      optind = argc;
+      break;
+    }
+  }
+  if(optind >= argc) {
+    fprintf(stderr, "usage: %s [-r KiB] [-f fds] [-z zombies] [-s lines] "
+	    "<shell> [lines]\n", argv[0]);
+    return 2;
+  }
+  if(optind + 1 < argc && atol(argv[optind + 1]) > 0) {
+    lines = atol(argv[optind + 1]);
+  }
+  if(every <= 0) every = lines / SAMPLES > 0 ? lines / SAMPLES : 1;
+
+  if(!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  if((pid = start_shell(argv[optind], &script, &output)) == -1) {
+    fprintf(stderr, "soak: could not start %s\n", argv[optind]);
+    return 1;
+  }
+  pthread_create(&reader, NULL, read_output, output);
+
+  fprintf(script, "soakf() { echo $1 > /dev/null; /bin/true; }\n");
+  printf("%10s %10s %6s %8s\n", "lines", "rss KiB", "fds", "zombies");
+
+  for(n = 1; n <= lines && !failed; n++) {
+    // a fixed sequence, so runs can be compared
+    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+    snprintf(command, sizeof(command),
+	     templates[(seed >> 33) % NUM_TEMPLATES], dir);
+    fprintf(script, "%s\n", command);
+
+    if(n % every != 0 && n != lines) continue;
+    if(sync_shell(script, n) == -1) {
+      fprintf(stderr, "soak: the shell exited after %ld lines\n", n);
+      failed = 1;
+      break;
+    }
+
+    rss = rss_kib(pid);
+    fds = open_fds(pid);
+    dead = zombies(pid);
+    printf("%10ld %10ld %6d %8d\n", n, rss, fds, dead);
+    fflush(stdout);
+
+    if(n == every) {
+      base_rss = rss;
+      base_fds = fds;
+    }
+    if(rss - base_rss > rss_bound) {
+      fprintf(stderr, "soak: memory grew by %ld KiB, more than %ld\n",
+	      rss - base_rss, rss_bound);
+      failed = 1;
+    }
+    if(fds - base_fds > fd_bound) {
+      fprintf(stderr, "soak: descriptors grew by %d, more than %d\n",
+	      fds - base_fds, fd_bound);
+      failed = 1;
+    }
+    if(dead > zombie_bound) {
+      fprintf(stderr, "soak: %d zombies, more than %d\n", dead, zombie_bound);
+      failed = 1;
+    }
+  }
+
+  fclose(script);
+  pthread_join(reader, NULL);
+  fclose(output);
+  waitpid(pid, &status, 0);
+
+  snprintf(command, sizeof(command), "rm -rf %s", dir);
+  if(system(command) != 0) fprintf(stderr, "soak: could not remove %s\n", dir);
+
+  printf(failed ? "soak failed\n" : "soak passed\n");
+  return failed;
+}
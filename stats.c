@@ -0,0 +1,301 @@
+/**
+ * This C file contains the shell's side of the shared
+ * statistics segment: taking a slot, and counting
+ * into it. Children are timed from spawn_command to
+ * the wait4 that reaps them, with their CPU time
+ * taken from wait4's resource usage.
+ *
+ * Several threads of a shell spawn and reap, so the
+ * counters are added to atomically and the table of
+ * children still running is locked. Neither is ever
+ * shared with another process: a forked child stops
+ * publishing, so a slot always has a single writer.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+
+// permissions of a new segment, before the umask
+#define STATS_MODE 0600
+
+/**
+ * A child being timed, and where its times go.
+ */
+struct stats_child {
+  pid_t pid;
+  struct stats_command* command;
+  long long start_ns;
+};
+
+static struct stats_slot* slot = NULL;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stats_child* children = NULL;
+static int num_children = 0;
+static int cap_children = 0;
+
+/**
+ * Reads the monotonic clock.
+ *
+ * Return value: nanoseconds since some fixed point
+ */
+long long now_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Adds to a counter of the slot.
+ *
+ * Return value: void
+ */
+static void add(_Atomic uint64_t* counter, uint64_t n)
+{
+  atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+/**
+ * Counts a time in a histogram. Bucket b holds times
+ * of at least 2^(b-1) and under 2^b microseconds.
+ *
+ * Return value: void
+ */
+static void add_time(struct stats_histogram* h, long long ns)
+{
+  long long us = ns / 1000;
+  int b = us > 0 ? 64 - __builtin_clzll(us) : 0;
+
+  if(b >= STATS_BUCKETS) b = STATS_BUCKETS - 1;
+  add(&h->count, 1);
+  add(&h->sum_ns, ns);
+  add(&h->buckets[b], 1);
+}
+
+/**
+ * Finds the entry of a command name in the slot,
+ * adding it if there is room. Names past the end of
+ * the table share the last entry. Called with
+ * stats_lock held.
+ *
+ * Return value: the entry
+ */
+static struct stats_command* find_command(const char* name)
+{
+  const char* base = strrchr(name, '/');
+  struct stats_command* c;
+  int i;
+
+  base = base ? base + 1 : name;
+  for(i = 0; i < STATS_NAMES - 1; i++) {
+    c = &slot->commands[i];
+    if(!atomic_load_explicit(&c->used, memory_order_relaxed)) break;
+    if(strncmp(c->name, base, STATS_NAME_LEN - 1) == 0) return c;
+  }
+  c = &slot->commands[i];
+  if(!atomic_load_explicit(&c->used, memory_order_relaxed)) {
+    snprintf(c->name, STATS_NAME_LEN, "%s",
+	     i < STATS_NAMES - 1 ? base : "(other)");
+    // readers only look at the name once used is seen
+    atomic_store_explicit(&c->used, 1, memory_order_release);
+  }
+  return c;
+}
+
+/**
+ * Takes a free slot, or the slot of a shell that died
+ * without giving its slot back.
+ *
+ * Return value: the slot, NULL if all are taken
+ */
+static struct stats_slot* take_slot(struct stats_segment* seg)
+{
+  int32_t pid = getpid(), owner;
+  int i;
+
+  for(i = 0; i < STATS_SLOTS; i++) {
+    owner = 0;
+    if(atomic_compare_exchange_strong(&seg->slots[i].owner, &owner, pid)) {
+      return &seg->slots[i];
+    }
+  }
+  for(i = 0; i < STATS_SLOTS; i++) {
+    owner = atomic_load(&seg->slots[i].owner);
+    if(owner && kill(owner, 0) == -1 && errno == ESRCH &&
+       atomic_compare_exchange_strong(&seg->slots[i].owner, &owner, pid)) {
+      return &seg->slots[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Gives the slot back when the shell exits.
+ *
+ * Return value: void
+ */
+static void release_slot()
+{
+  if(slot) atomic_store(&slot->owner, 0);
+}
+
+/**
+ * A forked child of the shell leaves the slot to it.
+ *
+ * Return value: void
+ */
+static void stop_in_child()
+{
+  slot = NULL;
+}
+
+/**
+ * Takes a slot of the segment MYSHELL_STATS names, if
+ * it is set.
+ *
+ * Return value: 0 if publishing or not wanted, -1 on error
+ */
+int stats_open()
+{
+  const char* env = getenv("MYSHELL_STATS");
+  struct stats_segment* seg;
+  struct stat st;
+  char name[256];
+  uint32_t magic = 0;
+  int fd;
+
+  if(!env) return 0;
+  snprintf(name, sizeof(name), "%s%s", *env && *env != '/' ? "/" : "",
+	   *env ? env : STATS_DEFAULT_NAME);
+
+  if((fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, STATS_MODE)) == -1) {
+    fprintf(stderr, "Error: Could not open statistics %s: %s\n", name,
+	    strerror(errno));
+    return -1;
+  }
+  // a shell that finds the segment new makes it big enough;
+  // two doing so at once set the same size
+  if(fstat(fd, &st) == -1 ||
+     (st.st_size < (off_t) sizeof(struct stats_segment) &&
+      ftruncate(fd, sizeof(struct stats_segment)) == -1)) {
+    fprintf(stderr, "Error: Could not size statistics %s: %s\n", name,
+	    strerror(errno));
+    close(fd);
+    return -1;
+  }
+  seg = mmap(NULL, sizeof(struct stats_segment), PROT_READ | PROT_WRITE,
+	     MAP_SHARED, fd, 0);
+  close(fd);
+  if(seg == MAP_FAILED) {
+    fprintf(stderr, "Error: Could not map statistics %s: %s\n", name,
+	    strerror(errno));
+    return -1;
+  }
+
+  if(!atomic_compare_exchange_strong(&seg->magic, &magic, STATS_MAGIC) &&
+     magic != STATS_MAGIC) {
+    fprintf(stderr, "Error: Statistics %s were made by another version\n",
+	    name);
+    munmap(seg, sizeof(struct stats_segment));
+    return -1;
+  }
+  if(!(slot = take_slot(seg))) {
+    fprintf(stderr, "Error: Statistics %s have no free slot\n", name);
+    munmap(seg, sizeof(struct stats_segment));
+    return -1;
+  }
+
+  pthread_atfork(NULL, NULL, stop_in_child);
+  atexit(release_slot);
+  return 0;
+}
+
+/**
+ * Counts a spawn and starts timing the child.
+ *
+ * Return value: void
+ */
+void stats_spawned(pid_t pid, const char* name, long long spawn_ns,
+		   int failed)
+{
+  struct stats_child* child;
+
+  if(!slot) return;
+  add(&slot->spawns, 1);
+  if(failed) {
+    add(&slot->spawn_failures, 1);
+    return;
+  }
+  add_time(&slot->spawn_time, spawn_ns);
+
+  pthread_mutex_lock(&stats_lock);
+  if(num_children == cap_children) {
+    cap_children = cap_children ? cap_children * 2 : 16;
+    children = realloc(children, sizeof(struct stats_child) * cap_children);
+    if(!children) {
+      fprintf(stderr, "Error: Out of memory while timing children\n");
+      exit(1);
+    }
+  }
+  child = &children[num_children++];
+  child->pid = pid;
+  child->command = find_command(name);
+  child->start_ns = now_ns();
+  pthread_mutex_unlock(&stats_lock);
+}
+
+/**
+ * Adds a child that was reaped to the times of its
+ * command.
+ *
+ * Return value: void
+ */
+void stats_reaped(pid_t pid, int status, const struct rusage* usage)
+{
+  struct stats_child child = { 0 };
+  int i;
+
+  if(!slot) return;
+
+  pthread_mutex_lock(&stats_lock);
+  for(i = 0; i < num_children; i++) {
+    if(children[i].pid == pid) {
+      child = children[i];
+      children[i] = children[--num_children];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&stats_lock);
+  if(!child.command) return;
+
+  add(&child.command->runs, 1);
+  if(status != 0) add(&child.command->failures, 1);
+  add(&child.command->wall_ns, now_ns() - child.start_ns);
+  add(&child.command->cpu_ns,
+      (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000000LL +
+      (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) * 1000LL);
+}
+
+/**
+ * Counts the time one command line took to parse.
+ *
+ * Return value: void
+ */
+void stats_parsed(long long ns)
+{
+  if(slot) add_time(&slot->parse_time, ns);
+}
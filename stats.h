@@ -0,0 +1,130 @@
+/**
+ * This is the header class for stats.c, and the
+ * layout of the shared-memory segment it fills in,
+ * which shstat.c reads.
+ *
+ * When MYSHELL_STATS names a segment, each shell takes
+ * a slot of it and counts its spawns, how long they
+ * took, how long its command lines took to parse, and
+ * the wall and CPU time of its children by command
+ * name. Only the shell owning a slot writes to it,
+ * with relaxed atomic adds, so readers never stop a
+ * shell. A slot keeps its counts when its shell exits
+ * and the next shell to take it adds on, so the
+ * segment holds totals since it was made.
+ */
+
+#ifndef STATS_H
+# define STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+// changes with the layout below, so old segments are not misread
+#define STATS_MAGIC 0x4d595331
+// shells that can publish at once
+#define STATS_SLOTS 256
+// command names counted per slot, the last one is "(other)"
+#define STATS_NAMES 64
+#define STATS_NAME_LEN 32
+// bucket b counts times under 2^b microseconds, above the previous
+#define STATS_BUCKETS 26
+// segment name used when MYSHELL_STATS is set but empty
+#define STATS_DEFAULT_NAME "/myshell-stats"
+
+struct stats_histogram {
+  _Atomic uint64_t count;
+  _Atomic uint64_t sum_ns;
+  _Atomic uint64_t buckets[STATS_BUCKETS];
+};
+
+struct stats_command {
+  // set once name is filled in, never cleared
+  _Atomic uint32_t used;
+  char name[STATS_NAME_LEN];
+  _Atomic uint64_t runs;
+  // runs that exited with a status other than 0
+  _Atomic uint64_t failures;
+  _Atomic uint64_t wall_ns;
+  // user plus system time of the child
+  _Atomic uint64_t cpu_ns;
+};
+
+struct stats_slot {
+  // process id of the shell writing the slot, 0 if free
+  _Atomic int32_t owner;
+  _Atomic uint64_t spawns;
+  _Atomic uint64_t spawn_failures;
+  struct stats_histogram spawn_time;
+  struct stats_histogram parse_time;
+  struct stats_command commands[STATS_NAMES];
+};
+
+struct stats_segment {
+  _Atomic uint32_t magic;
+  struct stats_slot slots[STATS_SLOTS];
+};
+
+/**
+ * Reads the monotonic clock, which every timing in
+ * the shell is taken from.
+ *
+ * Return value: nanoseconds since some fixed point
+ */
+long long now_ns();
+
+/**
+ * Takes a slot of the segment MYSHELL_STATS names, if
+ * it is set, making the segment when it does not
+ * exist yet.
+ *
+ * Return value: 0 if publishing or not wanted, -1 on error
+ */
+int stats_open();
+
+/**
+ * Counts a spawn and starts timing the child.
+ *
+ * pid:
+ *    process id of the child, if it started
+ * name:
+ *     the command run
+ * spawn_ns:
+ *         time the spawn took
+ * failed:
+ *       1 if the child could not be started
+ *
+ * Return value: void
+ */
+void stats_spawned(pid_t pid, const char* name, long long spawn_ns,
+		   int failed);
+
+/**
+ * Adds a child that was reaped to the times of its
+ * command. Children stats_spawned did not see are
+ * ignored.
+ *
+ * pid:
+ *    process id of the child
+ * status:
+ *       its exit status, see shell_status
+ * usage:
+ *      its resource usage from wait4
+ *
+ * Return value: void
+ */
+void stats_reaped(pid_t pid, int status, const struct rusage* usage);
+
+/**
+ * Counts the time one command line took to parse.
+ *
+ * ns:
+ *   time taken
+ *
+ * Return value: void
+ */
+void stats_parsed(long long ns);
+
+#endif